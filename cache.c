@@ -3,9 +3,14 @@
  * This file is a part of the Links program, released under GPL.
  */
 
+#ifdef __linux__
+	#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <limits.h>
 #include <search.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "links.h"
@@ -212,6 +217,115 @@ detach_cache_entry(struct cache_entry *e)
 	((((x) + sizeof(struct fragment)) | (page_size - 1))                   \
 	 - sizeof(struct fragment))
 
+#define MAP_ALIGN(x) (((x) + page_size - 1) & ~(size_t)(page_size - 1))
+
+/* Fragments of FRAGMENT_MMAP_MIN bytes and more get a mapping of their own.
+ * Growing one with mremap moves page table entries instead of copying the
+ * data, and the pages of a reserve cost nothing until they are written. */
+static struct fragment *
+frag_alloc(size_t size)
+{
+	struct fragment *f;
+	size_t m;
+	if (size < FRAGMENT_MMAP_MIN) {
+		f = xmalloc(size);
+		f->mapped = 0;
+		return f;
+	}
+	m = MAP_ALIGN(size);
+	f = mmap(NULL, m, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1,
+	         0);
+	if (f == MAP_FAILED)
+		die("mmap: %s\n", strerror(errno));
+	f->mapped = m;
+	return f;
+}
+
+static void
+frag_free(struct fragment *f)
+{
+	if (!f->mapped)
+		free(f);
+	else
+		munmap(f, f->mapped);
+}
+
+/* The caller has to fix up the list and real_length. */
+static struct fragment *
+frag_realloc(struct fragment *f, size_t size)
+{
+	struct fragment *n;
+	size_t m;
+	if (!f->mapped) {
+		if (size < FRAGMENT_MMAP_MIN)
+			return xrealloc(f, size);
+		n = frag_alloc(size);
+		m = n->mapped;
+		memcpy(n, f, sizeof(struct fragment) + (size_t)f->length);
+		n->mapped = m;
+		free(f);
+		return n;
+	}
+	m = MAP_ALIGN(size);
+	if (m == f->mapped)
+		return f;
+#ifdef MREMAP_MAYMOVE
+	if ((n = mremap(f, f->mapped, m, MREMAP_MAYMOVE)) == MAP_FAILED)
+		die("mremap: %s\n", strerror(errno));
+#else
+	if (m < f->mapped) {
+		munmap((unsigned char *)f + m, f->mapped - m);
+		n = f;
+	} else {
+		n = frag_alloc(m);
+		m = n->mapped;
+		memcpy(n, f, sizeof(struct fragment) + (size_t)f->length);
+		munmap(f, f->mapped);
+	}
+#endif
+	n->mapped = m;
+	return n;
+}
+
+/* Room for a fragment at the end of e that has to hold len bytes from
+ * offset. The reserve is not counted in cache_size, so it is at most what
+ * the fragment had so far and a small part of the cache, and it never goes
+ * past the length the server announced. */
+static off_t
+fragment_room(struct cache_entry *e, off_t offset, off_t len, off_t old)
+{
+	off_t want = len, cap = (off_t)memory_cache_size * MAX_FRAGMENT_RESERVE;
+	if (old * 2 > len)
+		want = old * 2;
+	if (e->expected_length && want > e->expected_length - offset)
+		want = e->expected_length - offset;
+	if (want - len > cap)
+		want = len + cap;
+	if (want < len || C_ALIGN(want) > INT_MAX - sizeof(struct fragment))
+		want = len;
+	return C_ALIGN(want);
+}
+
+/* Make room for len bytes in f. A fragment at the end is grown with some
+ * reserve, others only if the result gets a mapping of its own. */
+static int
+grow_fragment(struct cache_entry *e, struct fragment **fp, off_t len)
+{
+	struct fragment *f = *fp;
+	off_t ca = C_ALIGN(len);
+	if (ca < 0 || ca > INT_MAX - (int)sizeof(struct fragment))
+		return 0;
+	if (f->list_entry.next == &e->frag)
+		ca = fragment_room(e, f->offset, len, f->real_length);
+	else if (sizeof(struct fragment) + (size_t)ca < FRAGMENT_MMAP_MIN)
+		return 0;
+	f = frag_realloc(f, sizeof(struct fragment) + (size_t)ca);
+	fix_list_after_realloc(f);
+	f->real_length = ca;
+	*fp = f;
+	return 1;
+}
+
 int
 add_fragment(struct cache_entry *e, off_t offset, const unsigned char *data,
              off_t length)
@@ -256,7 +370,9 @@ have_f:
 				                    - offset)))
 					trunc = 1;
 				if (offset - f->offset + length
-				    <= f->real_length) {
+				        <= f->real_length
+				    || grow_fragment(e, &f,
+				                     offset - f->offset + length)) {
 					sf((offset + length)
 					   - (f->offset + f->length));
 					f->length = offset - f->offset + length;
@@ -281,11 +397,13 @@ have_f:
 	ca = C_ALIGN(length);
 	if (ca > INT_MAX - (int)sizeof(struct fragment) || ca < 0)
 		return S_LARGE_FILE;
-	nf = xmalloc(sizeof(struct fragment) + (size_t)ca);
+	if (lf == &e->frag)
+		ca = fragment_room(e, offset, length, 0);
+	nf = frag_alloc(sizeof(struct fragment) + (size_t)ca);
 	sf(length);
 	nf->offset = offset;
 	nf->length = length;
-	nf->real_length = C_ALIGN(length);
+	nf->real_length = ca;
 	memcpy(nf->data, data, (size_t)length);
 	add_before_list_entry(lf, &nf->list_entry);
 	f = nf;
@@ -297,9 +415,10 @@ ch_o:
 		struct fragment *next =
 		    list_struct(f->list_entry.next, struct fragment);
 		if (f->offset + f->length < next->offset + next->length) {
-			f = xrealloc(f, sizeof(struct fragment)
-			                    + (size_t)(next->offset - f->offset
-			                               + next->length));
+			f = frag_realloc(
+			    f, sizeof(struct fragment)
+			           + (size_t)(next->offset - f->offset
+			                      + next->length));
 			fix_list_after_realloc(f);
 			if (memcmp(
 				f->data + next->offset - f->offset, next->data,
@@ -318,7 +437,7 @@ ch_o:
 			trunc = 1;
 		del_from_list(next);
 		sf(-next->length);
-		free(next);
+		frag_free(next);
 	}
 	if (trunc)
 		truncate_entry(e, offset + length, 0);
@@ -332,7 +451,7 @@ ch_o:
 int
 defrag_entry(struct cache_entry *e)
 {
-	struct fragment *f, *n;
+	struct fragment *f, *hf;
 	struct list_head *g, *h;
 	off_t l;
 	if (list_empty(e->frag))
@@ -353,13 +472,13 @@ defrag_entry(struct cache_entry *e)
 			return S_INTERNAL;
 		}
 	if (g == f->list_entry.next) {
-		if (f->length != f->real_length) {
-			f = xrealloc(f, sizeof(struct fragment)
-			                    + (size_t)f->length);
-			if (f) {
-				f->real_length = f->length;
-				fix_list_after_realloc(f);
-			}
+		/* the reserve of an entry being loaded is still needed; it is
+		 * trimmed when the connection ends */
+		if (f->length != f->real_length && !is_entry_used(e)) {
+			f = frag_realloc(f, sizeof(struct fragment)
+			                        + (size_t)f->length);
+			f->real_length = f->length;
+			fix_list_after_realloc(f);
 		}
 		return 0;
 	}
@@ -374,19 +493,18 @@ defrag_entry(struct cache_entry *e)
 	}
 	if (l > INT_MAX - (int)sizeof(struct fragment))
 		return S_LARGE_FILE;
-	n = xmalloc(sizeof(struct fragment) + (size_t)l);
-	n->offset = 0;
-	n->length = l;
-	n->real_length = l;
-	for (l = 0, h = &f->list_entry; h != g; h = h->next) {
-		struct fragment *hf = list_struct(h, struct fragment);
-		memcpy(n->data + l, hf->data, (size_t)hf->length);
-		l += hf->length;
-		h = h->prev;
+	/* the first fragment is kept, so a mapped one is not copied */
+	f = frag_realloc(f, sizeof(struct fragment) + (size_t)l);
+	fix_list_after_realloc(f);
+	f->real_length = l;
+	for (h = f->list_entry.next; h != g;) {
+		hf = list_struct(h, struct fragment);
+		memcpy(f->data + f->length, hf->data, (size_t)hf->length);
+		f->length += hf->length;
+		h = h->next;
 		del_from_list(hf);
-		free(hf);
+		frag_free(hf);
 	}
-	add_to_list(e->frag, n);
 	return 0;
 }
 
@@ -406,7 +524,7 @@ truncate_entry(struct cache_entry *e, off_t off, int final)
 			sf(-f->length);
 			lf = lf->prev;
 			del_from_list(f);
-			free(f);
+			frag_free(f);
 			continue;
 		}
 		if (f->offset + f->length > off) {
@@ -414,8 +532,8 @@ truncate_entry(struct cache_entry *e, off_t off, int final)
 			sf(-(f->offset + f->length - off));
 			f->length = off - f->offset;
 			if (final) {
-				g = xrealloc(f, sizeof(struct fragment)
-				                    + (size_t)f->length);
+				g = frag_realloc(f, sizeof(struct fragment)
+				                        + (size_t)f->length);
 				if (g) {
 					f = g;
 					fix_list_after_realloc(f);
@@ -444,7 +562,7 @@ free_entry_to(struct cache_entry *e, off_t off)
 			sf(-f->length);
 			lf = lf->prev;
 			del_from_list(f);
-			free(f);
+			frag_free(f);
 		} else if (f->offset < off) {
 			sf(f->offset - off);
 			memmove(f->data, f->data + (off - f->offset),
@@ -470,8 +588,8 @@ trim_cache_entry(struct cache_entry *e)
 	struct list_head *lf;
 	foreach (struct fragment, f, lf, e->frag) {
 		if (f->length != f->real_length) {
-			nf = xrealloc(f, sizeof(struct fragment)
-			                     + (size_t)f->length);
+			nf = frag_realloc(f, sizeof(struct fragment)
+			                         + (size_t)f->length);
 			if (nf) {
 				f = nf;
 				fix_list_after_realloc(f);
@@ -352,9 +352,11 @@ return_decompressed:
 		    || !casestrcmp(enc, cast_uchar "x-gzip")
 		    || !casestrcmp(enc, cast_uchar "deflate")) {
 			int defl = !casestrcmp(enc, cast_uchar "deflate");
+			uttime t = get_time();
 			free(enc);
 			if (decode_gzip(term, ce, defl, errp))
 				goto uncompressed;
+			perf_add(PERF_DECOMPRESS, get_time() - t);
 			goto return_decompressed;
 		}
 		free(enc);
@@ -0,0 +1 @@
+static const int support_ipv6 = 1;
\ No newline at end of file
@@ -3,6 +3,11 @@
  * This file is a part of the Links program, released under GPL.
  */
 
+#ifdef __linux__
+	#define _GNU_SOURCE
+	#include <fcntl.h>
+#endif
+
 #include <limits.h>
 
 #include "links.h"
@@ -13,6 +18,8 @@ static void connected_callback(struct connection *);
 static void dns_found(void *, int);
 static void try_connect(struct connection *);
 static void handle_socks_reply(void *);
+static void write_select(void *);
+static void write_done(struct connection *);
 
 int
 socket_and_bind(int pf, unsigned char *address)
@@ -98,9 +105,18 @@ struct conn_info {
 	int socks_byte_count;
 	int socks_handled;
 	unsigned char socks_reply[8];
+	uttime stage_time; /* start of the DNS, connect or TLS stage */
 	char host[1];
 };
 
+struct write_buffer {
+	int sock;
+	int len;
+	int pos;
+	void (*done)(struct connection *);
+	unsigned char data[1];
+};
+
 void
 make_connection(struct connection *c, int port, int *sock,
                 void (*func)(struct connection *))
@@ -149,6 +165,7 @@ badu:
 	b->l.socks_port = socks_port;
 	b->l.target_port = port;
 	strcpy(b->host, host);
+	b->stage_time = get_time();
 	c->newconn = b;
 	if (c->last_lookup_state.addr_index < c->last_lookup_state.addr.n) {
 		b->l.addr = c->last_lookup_state.addr;
@@ -217,6 +234,11 @@ ssl_downgrade_dance(struct connection *c)
 #if !defined(HAVE_NSS)
 	int downgrades = 0;
 	c->no_ssl_session = 1;
+	if (c->ssl && c->ssl->early_data) {
+		unsigned char *h = get_host_name(remove_proxy_prefix(c->url));
+		add_blacklist_entry(h, BL_NO_EARLY_DATA);
+		free(h);
+	}
 	if (c->ssl && c->ssl->session_set) {
 		retry_connect(c, S_SSL_ERROR, 1);
 		return;
@@ -267,6 +289,94 @@ ssl_want_io(void *c_)
 	}
 }
 
+/*
+ * TLS 1.3 early data (0-RTT) lets a resumed connection carry the request in
+ * its first flight, so the response comes one round trip sooner. Early data
+ * can be replayed by anyone who captures it, hence it is used only for GET
+ * requests and only if the user asks for it, and a ticket is used for it
+ * only once. A server that resumes the session but rejects the early data,
+ * or fails the handshake, is not offered it again.
+ */
+static int
+want_early_data(struct connection *c, unsigned char *host, SSL_SESSION *ses)
+{
+#ifdef SSL_EARLY_DATA_ACCEPTED
+	if (!ssl_options.early_data || c->no_tls || c->preconnect)
+		return 0;
+	if (strchr(cast_const_char c->url, POST_CHAR))
+		return 0;
+	if (!SSL_SESSION_get_max_early_data(ses))
+		return 0;
+	return !(get_blacklist_flags(host) & BL_NO_EARLY_DATA);
+#else
+	return 0;
+#endif
+}
+
+/* Write the request as early data and then finish the handshake. A request
+ * larger than the server takes is left for after the handshake. */
+static void
+ssl_early_write(void *c_)
+{
+#ifdef SSL_EARLY_DATA_ACCEPTED
+	struct connection *c = (struct connection *)c_;
+	struct write_buffer *wb = c->buffer;
+	SSL *ssl = c->ssl->ssl;
+	size_t wr;
+
+	set_connection_timeout(c);
+
+	if ((unsigned)wb->len
+	    <= SSL_SESSION_get_max_early_data(SSL_get0_session(ssl)))
+		while (wb->pos < wb->len) {
+			if (SSL_write_early_data(ssl, wb->data + wb->pos,
+			                         wb->len - wb->pos, &wr)
+			    != 1) {
+				switch (SSL_get_error(ssl, 0)) {
+				case SSL_ERROR_WANT_READ:
+					set_handlers(wb->sock, ssl_early_write,
+					             NULL, c);
+					return;
+				case SSL_ERROR_WANT_WRITE:
+					set_handlers(wb->sock, NULL,
+					             ssl_early_write, c);
+					return;
+				default:
+					ssl_downgrade_dance(c);
+					return;
+				}
+			}
+			wb->pos += wr;
+		}
+	ssl_want_io(c);
+#endif
+}
+
+/* The handshake is done; if the server did not take the early data, the
+ * request is sent again. */
+static void
+ssl_early_done(struct connection *c)
+{
+#ifdef SSL_EARLY_DATA_ACCEPTED
+	struct write_buffer *wb = c->buffer;
+	c->ssl->early_data = 0;
+	if (SSL_get_early_data_status(c->ssl->ssl) != SSL_EARLY_DATA_ACCEPTED) {
+		if (wb->pos && SSL_session_reused(c->ssl->ssl)) {
+			unsigned char *h =
+			    get_host_name(remove_proxy_prefix(c->url));
+			add_blacklist_entry(h, BL_NO_EARLY_DATA);
+			free(h);
+		}
+		wb->pos = 0;
+	}
+	c->ssl->bytes_written += wb->pos;
+	if (wb->pos < wb->len)
+		set_handlers(wb->sock, NULL, write_select, c);
+	else
+		write_done(c);
+#endif
+}
+
 static void
 handle_socks(void *c_)
 {
@@ -378,6 +488,7 @@ dns_found(void *c_, int state)
 		abort_connection(c);
 		return;
 	}
+	perf_add(PERF_DNS, get_time() - c->newconn->stage_time);
 	try_connect(c);
 }
 
@@ -387,6 +498,13 @@ retry_connect(struct connection *c, int err, int ssl_downgrade)
 	struct conn_info *b = c->newconn;
 	if (!b->l.addr_index)
 		b->first_error = err;
+	if (c->ssl && c->ssl != DUMMY && c->ssl->early_data) {
+		/* the request is made again for the next attempt */
+		free(c->buffer);
+		c->buffer = NULL;
+		free(c->info);
+		c->info = NULL;
+	}
 	freeSSL(c->ssl);
 	c->ssl = NULL;
 	if (ssl_downgrade) {
@@ -433,6 +551,7 @@ try_connect(struct connection *c)
 	}
 	set_nonblock(s);
 	*b->sock = s;
+	b->stage_time = get_time();
 	b->socks_handled = 0;
 	b->socks_byte_count = 0;
 	p = b->l.socks_port != -1 ? b->l.socks_port : b->l.target_port;
@@ -470,6 +589,9 @@ try_connect(struct connection *c)
 			set_connection_timeout(c);
 		}
 #endif
+		/* load the CA certificates while the connection is made */
+		if (c->ssl)
+			ssl_preload();
 	} else {
 		connected(c);
 	}
@@ -525,6 +647,10 @@ connected(void *c_)
 	}
 #endif
 	set_connection_timeout(c);
+	if (b->stage_time) {
+		perf_add(PERF_CONNECT, get_time() - b->stage_time);
+		b->stage_time = 0;
+	}
 	if (b->l.socks_port != -1 && !b->socks_handled) {
 		b->socks_handled = 1;
 		update_dns_priority(c);
@@ -550,6 +676,10 @@ connected(void *c_)
 				if (SSL_set_session(c->ssl->ssl, ses) == 1)
 					c->ssl->session_set = 1;
 			}
+			if (c->ssl->session_set && want_early_data(c, h, ses)) {
+				c->ssl->early_data = 1;
+				drop_session_cache_entry(c->ssl->ctx, h, p);
+			}
 			free(h);
 		}
 #if !defined(OPENSSL_NO_STDIO)
@@ -578,6 +708,14 @@ connected(void *c_)
 skip_numeric_address:
 #endif
 		free(h);
+		b->stage_time = get_time();
+		if (c->ssl->early_data) {
+			/* the request is written by ssl_early_write and the
+			 * handshake is completed after it */
+			setcstate(c, S_SSL_NEG);
+			b->func(c);
+			return;
+		}
 		switch (SSL_get_error(c->ssl->ssl, SSL_connect(c->ssl->ssl))) {
 		case SSL_ERROR_WANT_READ:
 			setcstate(c, S_SSL_NEG);
@@ -621,6 +759,8 @@ connected_callback(struct connection *c)
 	int flags;
 	struct conn_info *b = c->newconn;
 	update_dns_priority(c);
+	if (b->stage_time)
+		perf_add(PERF_TLS, get_time() - b->stage_time);
 	if (c->ssl) {
 		if (ssl_options.certificates
 		    != SSL_ACCEPT_INVALID_CERTIFICATE) {
@@ -676,18 +816,13 @@ ignore_cipher:
 	retrieve_ssl_session(c);
 	c->last_lookup_state = b->l;
 	c->newconn = NULL;
-	b->func(c);
+	if (c->ssl && c->ssl->early_data)
+		ssl_early_done(c);
+	else
+		b->func(c);
 	free(b);
 }
 
-struct write_buffer {
-	int sock;
-	int len;
-	int pos;
-	void (*done)(struct connection *);
-	unsigned char data[1];
-};
-
 static void
 write_select(void *c_)
 {
@@ -741,13 +876,19 @@ write_select(void *c_)
 		}
 	}
 
-	if ((wb->pos += wr) == wb->len) {
-		void (*f)(struct connection *) = wb->done;
-		c->buffer = NULL;
-		set_handlers(wb->sock, NULL, NULL, NULL);
-		free(wb);
-		f(c);
-	}
+	if ((wb->pos += wr) == wb->len)
+		write_done(c);
+}
+
+static void
+write_done(struct connection *c)
+{
+	struct write_buffer *wb = c->buffer;
+	void (*f)(struct connection *) = wb->done;
+	c->buffer = NULL;
+	set_handlers(wb->sock, NULL, NULL, NULL);
+	free(wb);
+	f(c);
 }
 
 void
@@ -765,12 +906,63 @@ write_to_socket(struct connection *c, int s, unsigned char *data, int len,
 	memcpy(wb->data, data, len);
 	free(c->buffer);
 	c->buffer = wb;
-	set_handlers(s, NULL, write_select, c);
+	if (c->newconn && c->ssl && c->ssl->early_data)
+		set_handlers(s, NULL, ssl_early_write, c);
+	else
+		set_handlers(s, NULL, write_select, c);
 }
 
 #define READ_SIZE  64240
 #define TOTAL_READ (4193008 - READ_SIZE)
 
+#ifdef __linux__
+static int splice_pipe[2] = { -1, -1 };
+
+/* Move body data from the socket to c->sink through a pipe, so that they
+ * never get copied to user space. If the sink can't take the data, the
+ * rest is put to rb->data and written, kept or dropped by the protocol; a
+ * sink that does not support splice is not tried again. */
+static int
+splice_to_sink(struct connection *c, struct read_buffer *rb)
+{
+	ssize_t in, out;
+	size_t len = READ_SIZE;
+	int done = 0;
+	if (splice_pipe[0] == -1 && c_pipe(splice_pipe))
+		return -1;
+	if (rb->splice > 0 && (off_t)len > rb->splice)
+		len = (size_t)rb->splice;
+	EINTRLOOP(in, splice(rb->sock, NULL, splice_pipe[1], NULL, len,
+	                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+	if (in <= 0)
+		return (int)in;
+	while (done < in) {
+		EINTRLOOP(out, splice(splice_pipe[0], NULL, c->sink, NULL,
+		                      in - done, SPLICE_F_MOVE));
+		if (out < 0 && errno == EINVAL)
+			c->sink_no_splice = 1;
+		if (out <= 0)
+			break;
+		done += (int)out;
+	}
+	rb->spliced += done;
+	if (rb->splice > 0)
+		rb->splice -= in;
+	if (done < in) {
+		if (hard_read(splice_pipe[0], rb->data + rb->len, (int)in - done)
+		    != (int)in - done) {
+			/* what is left in the pipe would go to the next sink */
+			close_socket(&splice_pipe[0]);
+			close_socket(&splice_pipe[1]);
+			return -1;
+		}
+		rb->len += (int)in - done;
+		rb->splice = 0;
+	}
+	return (int)in;
+}
+#endif
+
 static void
 read_select(void *c_)
 {
@@ -826,8 +1018,16 @@ read_more:
 		}
 		c->ssl->bytes_read += rd;
 	} else {
-		EINTRLOOP(rd,
-		          (int)read(rb->sock, rb->data + rb->len, READ_SIZE));
+#ifdef __linux__
+		if (rb->splice && c->sink != -1 && !rb->len) {
+			if ((rd = splice_to_sink(c, rb)) > 0) {
+				total_read += rd;
+				goto check_more;
+			}
+		} else
+#endif
+			EINTRLOOP(rd, (int)read(rb->sock, rb->data + rb->len,
+			                        READ_SIZE));
 		if (rd <= 0) {
 			if (total_read)
 				goto success;
@@ -845,6 +1045,9 @@ read_more:
 	rb->len += rd;
 	total_read += rd;
 
+#ifdef __linux__
+check_more:
+#endif
 	if ((rd == READ_SIZE || c->ssl) && total_read <= TOTAL_READ) {
 		if (can_read(rb->sock))
 			goto read_more;
@@ -863,6 +1066,15 @@ alloc_read_buffer(void)
 	return rb;
 }
 
+static void
+resume_read(struct connection *c)
+{
+	struct read_buffer *rb = c->buffer;
+	set_connection_timeout(c);
+	set_handlers(rb->sock, read_select, NULL, c);
+}
+
+/* Nothing more is read while the sink is full. */
 void
 read_from_socket(struct connection *c, int s, struct read_buffer *buf,
                  void (*read_func)(struct connection *, struct read_buffer *))
@@ -872,7 +1084,119 @@ read_from_socket(struct connection *c, int s, struct read_buffer *buf,
 	if (buf != c->buffer)
 		free(c->buffer);
 	c->buffer = buf;
-	set_handlers(s, read_select, NULL, c);
+	if (c->sink_buf_len)
+		wait_for_sink(c, resume_read);
+	else
+		set_handlers(s, read_select, NULL, c);
+}
+
+/* Write data to c->sink. What a full sink does not take is kept in
+ * c->sink_buf, and so is everything after it until the sink has taken it.
+ * Returns 0, or -1 if the sink failed after taking what is before
+ * *c->sink_pos. */
+int
+write_to_sink(struct connection *c, unsigned char *data, int l)
+{
+	int w;
+	while (l > 0 && !c->sink_buf_len) {
+		EINTRLOOP(w, (int)write(c->sink, data, l));
+		if (w < 0 && errno == EAGAIN)
+			break;
+		if (w <= 0)
+			return -1;
+		*c->sink_pos += w;
+		data += w;
+		l -= w;
+	}
+	if (l > 0) {
+		if ((unsigned)l > INT_MAX - (unsigned)c->sink_buf_len)
+			overalloc();
+		c->sink_buf = xrealloc(c->sink_buf, c->sink_buf_len + l);
+		memcpy(c->sink_buf + c->sink_buf_len, data, l);
+		c->sink_buf_len += l;
+	}
+	return 0;
+}
+
+static void
+sink_written(void *c_)
+{
+	struct connection *c = (struct connection *)c_;
+	void (*fn)(struct connection *) = c->sink_wait;
+	c->sink_wait = NULL;
+	fn(c);
+}
+
+static void
+write_sink(void *c_)
+{
+	struct connection *c = (struct connection *)c_;
+	void (*fn)(struct connection *);
+	int w;
+	EINTRLOOP(w, (int)write(c->sink, c->sink_buf, c->sink_buf_len));
+	if (w < 0 && errno == EAGAIN)
+		return;
+	if (w > 0) {
+		*c->sink_pos += w;
+		c->sink_buf_len -= w;
+		memmove(c->sink_buf, c->sink_buf + w, c->sink_buf_len);
+		if (c->sink_buf_len)
+			return;
+		free(c->sink_buf);
+		c->sink_buf = NULL;
+	}
+	set_handlers(c->sink, NULL, NULL, NULL);
+	fn = c->sink_wait;
+	c->sink_wait = NULL;
+	if (w <= 0 && (w = drop_connection_sink(c)) < 0) {
+		setcstate(c, w);
+		abort_connection(c);
+		return;
+	}
+	fn(c);
+}
+
+/* Call fn once the data the sink was full for are written. The connection
+ * does nothing else meanwhile, so its timeout is off. */
+void
+wait_for_sink(struct connection *c, void (*fn)(struct connection *))
+{
+	c->sink_wait = fn;
+	clear_connection_timeout(c);
+	set_handlers(c->sink, NULL, write_sink, c);
+}
+
+void
+stop_waiting_for_sink(struct connection *c)
+{
+	if (!c->sink_wait)
+		return;
+	if (c->sink != -1)
+		set_handlers(c->sink, NULL, NULL, NULL);
+	unregister_bottom_half(sink_written, c);
+	c->sink_wait = NULL;
+}
+
+/* Stop writing to the sink. The data it was full for go to the cache and
+ * the connection goes on if it was waiting for them. Returns the result of
+ * add_fragment. */
+int
+drop_connection_sink(struct connection *c)
+{
+	int r = 0;
+	if (c->sink_buf_len)
+		r = add_fragment(c->cache, *c->sink_pos, c->sink_buf,
+		                 c->sink_buf_len);
+	free(c->sink_buf);
+	c->sink_buf = NULL;
+	c->sink_buf_len = 0;
+	if (c->sink_wait) {
+		set_handlers(c->sink, NULL, NULL, NULL);
+		register_bottom_half(sink_written, c);
+	}
+	c->sink = -1;
+	c->sink_pos = NULL;
+	return r;
 }
 
 void
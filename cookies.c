@@ -4,7 +4,9 @@
  * This file is a part of the Links program, released under GPL
  */
 
+#include <errno.h>
 #include <limits.h>
+#include <search.h>
 
 #include "links.h"
 
@@ -13,10 +15,15 @@
 
 static int accept_cookies = ACCEPT_ALL;
 
-struct list_head all_cookies = { &all_cookies, &all_cookies };
-
 struct list_head c_domains = { &c_domains, &c_domains };
 
+/* c_domains indexed by domain name */
+static void *c_domain_root;
+
+/* cookies with an expiry date, the soonest to expire at the top */
+static struct cookie **expiry_heap;
+static size_t expiry_heap_n, expiry_heap_size;
+
 struct c_server {
 	list_entry_1st;
 	int accpt;
@@ -124,35 +131,159 @@ ok:
 	return 0;
 }
 
+static int
+c_domain_compare(const void *p1, const void *p2)
+{
+	if (p1 == p2)
+		return 0;
+	return casestrcmp(p1, p2);
+}
+
+static struct c_domain *
+find_c_domain(unsigned char *domain)
+{
+	void **p;
+	if (!(p = tfind(domain, &c_domain_root, c_domain_compare)))
+		return NULL;
+	return get_struct(*p, struct c_domain, domain);
+}
+
+static struct c_domain *
+new_c_domain(unsigned char *domain)
+{
+	struct c_domain *cd;
+	size_t sl = strlen((const char *)domain);
+	if (sl > INT_MAX - sizeof(struct c_domain))
+		overalloc();
+	cd = xmalloc(sizeof(struct c_domain) + sl);
+	strcpy(cast_char cd->domain, cast_const_char domain);
+	init_list(cd->cookies);
+	if (!tsearch(cd->domain, &c_domain_root, c_domain_compare))
+		die("tsearch: %s\n", strerror(errno));
+	add_to_list(c_domains, cd);
+	return cd;
+}
+
+static void
+free_c_domain(struct c_domain *cd)
+{
+	if (!tdelete(cd->domain, &c_domain_root, c_domain_compare))
+		internal("free_c_domain: domain '%s' not found", cd->domain);
+	del_from_list(cd);
+	free(cd);
+}
+
+static void
+heap_set(size_t i, struct cookie *c)
+{
+	expiry_heap[i] = c;
+	c->heap_pos = i;
+}
+
+static void
+heap_up(size_t i)
+{
+	struct cookie *c = expiry_heap[i];
+	while (i && expiry_heap[(i - 1) / 2]->expires > c->expires) {
+		heap_set(i, expiry_heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(i, c);
+}
+
+static void
+heap_down(size_t i)
+{
+	struct cookie *c = expiry_heap[i];
+	size_t j;
+	while ((j = 2 * i + 1) < expiry_heap_n) {
+		if (j + 1 < expiry_heap_n
+		    && expiry_heap[j + 1]->expires < expiry_heap[j]->expires)
+			j++;
+		if (expiry_heap[j]->expires >= c->expires)
+			break;
+		heap_set(i, expiry_heap[j]);
+		i = j;
+	}
+	heap_set(i, c);
+}
+
+static void
+heap_insert(struct cookie *c)
+{
+	if (expiry_heap_n == expiry_heap_size) {
+		expiry_heap_size = expiry_heap_size ? expiry_heap_size * 2 : 16;
+		expiry_heap = xreallocarray(expiry_heap, expiry_heap_size,
+		                            sizeof(struct cookie *));
+	}
+	heap_set(expiry_heap_n++, c);
+	heap_up(c->heap_pos);
+}
+
+static void
+heap_delete(struct cookie *c)
+{
+	size_t i = c->heap_pos;
+	struct cookie *m;
+	if (i == --expiry_heap_n)
+		return;
+	heap_set(i, m = expiry_heap[expiry_heap_n]);
+	heap_up(i);
+	heap_down(m->heap_pos);
+}
+
+static void
+delete_cookie(struct cookie *c)
+{
+	del_from_list(c);
+	if (c->expires)
+		heap_delete(c);
+	free_cookie(c);
+}
+
+/* Drop the cookies that have expired. */
+static void
+prune_cookies(void)
+{
+	time_t t;
+	errno = 0;
+	EINTRLOOPX(t, time(NULL), (time_t)-1);
+	while (expiry_heap_n && expiry_heap[0]->expires < t) {
+		struct cookie *c = expiry_heap[0];
+		struct c_domain *cd = find_c_domain(c->domain);
+		delete_cookie(c);
+		if (cd && list_empty(cd->cookies))
+			free_c_domain(cd);
+	}
+}
+
 static void
 accept_cookie(struct cookie *c)
 {
-	struct c_domain *cd = NULL;
-	struct list_head *lcd;
+	struct c_domain *cd;
 	struct cookie *d = NULL;
 	struct list_head *ld;
-	size_t sl;
-	foreach (struct cookie, d, ld, all_cookies)
-		if (!casestrcmp(d->name, c->name)
-		    && !casestrcmp(d->domain, c->domain)) {
-			ld = ld->prev;
-			del_from_list(d);
-			free_cookie(d);
-		}
+	if ((cd = find_c_domain(c->domain)))
+		foreach (struct cookie, d, ld, cd->cookies)
+			if (!casestrcmp(d->name, c->name)) {
+				ld = ld->prev;
+				delete_cookie(d);
+			}
 	if (c->value && !casestrcmp(c->value, cast_uchar "deleted")) {
 		free_cookie(c);
+		if (cd && list_empty(cd->cookies))
+			free_c_domain(cd);
 		return;
 	}
-	add_to_list(all_cookies, c);
-	foreach (struct c_domain, cd, lcd, c_domains)
-		if (!casestrcmp(cd->domain, c->domain))
-			return;
-	sl = strlen((const char *)c->domain);
-	if (sl > INT_MAX - sizeof(struct c_domain))
-		overalloc();
-	cd = xmalloc(sizeof(struct c_domain) + sl);
-	strcpy(cast_char cd->domain, cast_const_char c->domain);
-	add_to_list(c_domains, cd);
+	if (!cd)
+		cd = new_c_domain(c->domain);
+	c->path_len = strlen((const char *)c->path);
+	foreach (struct cookie, d, ld, cd->cookies)
+		if (d->path_len < c->path_len)
+			break;
+	add_before_list_entry(ld, &c->list_entry);
+	if (c->expires)
+		heap_insert(c);
 }
 
 int
@@ -184,73 +315,76 @@ is_path_prefix(unsigned char *d, unsigned char *s)
 	       || s[dl] == '?' || s[dl] == '&';
 }
 
-int
-cookie_expired(struct cookie *c)
+static unsigned char *
+next_label(unsigned char *d)
 {
-	time_t t;
-	errno = 0;
-	EINTRLOOPX(t, time(NULL), (time_t)-1);
-	return c->expires && c->expires < t;
+	if ((d = cast_uchar strchr(cast_const_char d, '.')))
+		d++;
+	return d;
 }
 
-size_t
-add_cookies(unsigned char **s, size_t l, unsigned char *url)
+void
+add_cookies(struct string_buf *s, unsigned char *url)
 {
 	int nc = 0;
-	struct c_domain *cd = NULL;
-	struct list_head *lcd;
+	struct c_domain *cd;
 	struct cookie *c = NULL;
 	struct list_head *lc;
-	unsigned char *server = get_host_name(url);
-	unsigned char *data = get_url_data(url);
+	unsigned char *server, *data, *d;
+	size_t data_len;
+	if (list_empty(c_domains))
+		return;
+	prune_cookies();
+	server = get_host_name(url);
+	data = get_url_data(url);
 	if (data > url)
 		data--;
-	foreach (struct c_domain, cd, lcd, c_domains)
-		if (is_in_domain(cd->domain, server))
-			goto ok;
-	free(server);
-	return l;
-ok:
-	foreachback (struct cookie, c, lc, all_cookies)
-		if (is_in_domain(c->domain, server))
-			if (is_path_prefix(c->path, data)) {
-				if (cookie_expired(c)) {
-					lc = lc->prev;
-					del_from_list(c);
-					free_cookie(c);
-					continue;
-				}
-				if (c->secure
-				    && casecmp(url, cast_uchar "https://", 8))
-					continue;
-				if (!nc) {
-					l = add_to_str(s, l,
-					               cast_uchar "Cookie: ");
-					nc = 1;
-				} else
-					l = add_to_str(s, l, cast_uchar "; ");
-				l = add_to_str(s, l, c->name);
-				if (c->value) {
-					l = add_chr_to_str(s, l, '=');
-					l = add_to_str(s, l, c->value);
-				}
+	data_len = strlen((const char *)data);
+	/* cookies for a.b.c can be set for a.b.c, b.c or c */
+	for (d = server; d; d = next_label(d)) {
+		if (!(cd = find_c_domain(d)))
+			continue;
+		foreach (struct cookie, c, lc, cd->cookies) {
+			if (c->path_len > data_len
+			    || !is_path_prefix(c->path, data))
+				continue;
+			if (c->secure && casecmp(url, cast_uchar "https://", 8))
+				continue;
+			if (!nc) {
+				add_to_buf(s, cast_uchar "Cookie: ");
+				nc = 1;
+			} else
+				add_to_buf(s, cast_uchar "; ");
+			add_to_buf(s, c->name);
+			if (c->value) {
+				add_chr_to_buf(s, '=');
+				add_to_buf(s, c->value);
 			}
+		}
+	}
 	if (nc)
-		l = add_to_str(s, l, cast_uchar "\r\n");
+		add_to_buf(s, cast_uchar "\r\n");
 	free(server);
-	return l;
 }
 
 void
 free_cookies(void)
 {
-	free_list(struct c_domain, c_domains);
 	/* !!! FIXME: save cookies */
-	while (!list_empty(all_cookies)) {
-		struct cookie *c = list_struct(all_cookies.next, struct cookie);
-		del_from_list(c);
-		free_cookie(c);
+	while (!list_empty(c_domains)) {
+		struct c_domain *cd =
+		    list_struct(c_domains.next, struct c_domain);
+		while (!list_empty(cd->cookies)) {
+			struct cookie *c =
+			    list_struct(cd->cookies.next, struct cookie);
+			del_from_list(c);
+			free_cookie(c);
+		}
+		free_c_domain(cd);
 	}
+	free(expiry_heap);
+	expiry_heap = NULL;
+	expiry_heap_n = expiry_heap_size = 0;
 }
 
 void
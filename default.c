@@ -754,6 +754,7 @@ term_rd(struct option *o, unsigned char *c)
 {
 	struct term_spec *ts;
 	unsigned char *w;
+	int n;
 	if (!(w = get_token(&c)))
 		goto err;
 	ts = new_term_spec(w);
@@ -772,11 +773,12 @@ term_rd(struct option *o, unsigned char *c)
 	free(w);
 	if (!(w = get_token(&c)))
 		goto err;
-	if (strlen(cast_const_char w) != 1 || w[0] < '0' || w[0] > '7')
+	if (getnum(w, &n, 0, 16))
 		goto err_f;
-	ts->col = (w[0] - '0') & 1;
-	ts->restrict_852 = !!((w[0] - '0') & 2);
-	ts->block_cursor = !!((w[0] - '0') & 4);
+	ts->col = n & 1;
+	ts->restrict_852 = !!(n & 2);
+	ts->block_cursor = !!(n & 4);
+	ts->scroll = !!(n & 8);
 	free(w);
 	if (!(w = get_token(&c)))
 		goto err;
@@ -852,7 +854,8 @@ term_wr(struct option *o, unsigned char **s, size_t l)
 		l = add_chr_to_str(s, l, ' ');
 		l = add_num_to_str(s, l,
 		                   !!ts->col + !!ts->restrict_852 * 2
-		                       + !!ts->block_cursor * 4);
+		                       + !!ts->block_cursor * 4
+		                       + !!ts->scroll * 8);
 		l = add_chr_to_str(s, l, ' ');
 		l = add_to_str(s, l, get_cp_mime_name(ts->character_set));
 		if (ts->left_margin || ts->right_margin || ts->top_margin
@@ -1101,6 +1104,7 @@ int first_use = 0;
 
 int disable_libevent = 0;
 int no_connect = 0;
+int share_instance = 0;
 int base_session = 0;
 int dmp = 0;
 int screen_width = 80;
@@ -1116,6 +1120,10 @@ int timeout_multiple_addresses = 3;
 unsigned char bind_ip_address[16] = "";
 unsigned char bind_ipv6_address[INET6_ADDRSTRLEN] = "";
 int download_utime = 0;
+int download_segments = 1;
+int prefetch = 0;
+int prefetch_pages = 0;
+unsigned char prefetch_pattern[MAX_STR_LEN] = "";
 
 int max_format_cache_entries = 5;
 int memory_cache_size = 4194304;
@@ -1125,8 +1133,8 @@ int aggressive_cache = 1;
 
 struct ipv6_options ipv6_options = { ADDR_PREFERENCE_DEFAULT };
 struct proxies proxies = { "", "", "", "", "", 0 };
-struct ssl_options ssl_options = { SSL_WARN_ON_INVALID_CERTIFICATE, 0, "", "",
-	                           "" };
+struct ssl_options ssl_options = { SSL_WARN_ON_INVALID_CERTIFICATE, 0, 0, 0,
+	                           "", "", "" };
 struct http_options http_options = {
 	0, 1, 0, 0, 0, {0, "", ""}
 };
@@ -1182,6 +1190,7 @@ static struct option links_options[] = {
 	{ 1, printhelp_cmd, NULL,     NULL,    0,        0,                NULL,                                NULL,                  "-help"                                 },
 	{ 1, version_cmd,   NULL,     NULL,    0,        0,                NULL,                                NULL,                  "version"                               },
 	{ 1, set_cmd,       NULL,     NULL,    0,        0,                &no_connect,                         NULL,                  "no-connect"                            },
+	{ 1, gen_cmd,       num_rd,   num_wr,  0,        1,                &share_instance,                     "share_instance",      "share-instance"                        },
 	{ 1, set_cmd,       NULL,     NULL,    0,        0,                &anonymous,                          NULL,                  "anonymous"                             },
 	{ 1, setstr_cmd,    NULL,     NULL,    0,        MAX_STR_LEN,      default_target,                      NULL,
          "target"																			      },
@@ -1190,6 +1199,7 @@ static struct option links_options[] = {
 	{ 1, set_cmd,       NULL,     NULL,    0,        0,                &force_html,                         NULL,                  "force-html"                            },
 	{ 1, dump_cmd,      NULL,     NULL,    D_SOURCE, 0,                NULL,                                NULL,                  "source"                                },
 	{ 1, dump_cmd,      NULL,     NULL,    D_DUMP,   0,                NULL,                                NULL,                  "dump"                                  },
+	{ 1, set_cmd,       NULL,     NULL,    0,        0,                &perf_stats,                         NULL,                  "perf-stats"                            },
 	{ 1, gen_cmd,       num_rd,   NULL,    10,       512,              &screen_width,                       "dump_width",
          "width"																			       },
 	{ 1, gen_cmd,       cp_rd,    NULL,    1,        0,                &dump_codepage,                      "dump_codepage",
@@ -1215,6 +1225,12 @@ static struct option links_options[] = {
          "no-libevent"																			 },
 	{ 1, gen_cmd,       num_rd,   num_wr,  0,        1,                &download_utime,                     "download_utime",
          "download-utime"																		      },
+	{ 1, gen_cmd,       num_rd,   num_wr,  1,        16,               &download_segments,                  "download_segments",
+         "download-segments"																		      },
+	{ 1, gen_cmd,       num_rd,   num_wr,  0,        2,                &prefetch,                           "prefetch",            "prefetch"                              },
+	{ 1, gen_cmd,       num_rd,   num_wr,  0,        1,                &prefetch_pages,                     "prefetch_pages",      "prefetch-pages"                        },
+	{ 1, gen_cmd,       str_rd,   str_wr,  0,        MAX_STR_LEN,      prefetch_pattern,
+         "prefetch_pattern",													   "prefetch-pattern"                      },
 	{ 1, gen_cmd,       num_rd,   num_wr,  0,        999,              &max_format_cache_entries,
          "format_cache_size",													  "format-cache-size"                     },
 	{ 1, gen_cmd,       num_rd,   num_wr,  0,        INT_MAX,          &memory_cache_size,
@@ -1245,6 +1261,10 @@ static struct option links_options[] = {
          "ssl.certificates",													   "ssl.certificates"                      },
 	{ 1, gen_cmd,       num_rd,   num_wr,  0,        1,                &ssl_options.built_in_certificates,
          "ssl.builtin_certificates",												   "ssl.builtin-certificates"              },
+	{ 1, gen_cmd,       num_rd,   num_wr,  0,        1,                &ssl_options.session_store,
+         "ssl.session_store",													   "ssl.session-store"                     },
+	{ 1, gen_cmd,       num_rd,   num_wr,  0,        1,                &ssl_options.early_data,
+         "ssl.early_data",													   "ssl.early-data"                        },
 	{ 1, gen_cmd,       str_rd,   str_wr,  0,        MAX_STR_LEN,
          &ssl_options.client_cert_key,									  "ssl.client_cert_key",
          "ssl.client-cert-key"																		 },
@@ -23,8 +23,20 @@ struct dnsquery {
 	char name[];
 };
 
+/* a speculative lookup running in a child process */
+struct dns_prefetch {
+	list_entry_1st;
+	int h;
+	int addr_preference;
+	size_t got;
+	struct lookup_result addr;
+	char name[1];
+};
+
 static int dns_cache_addr_preference = -1;
 static struct list_head dns_cache = { &dns_cache, &dns_cache };
+static struct list_head dns_prefetches = { &dns_prefetches,
+	                                   &dns_prefetches };
 
 static void end_dns_lookup(struct dnsquery *q, int a);
 static int shrink_dns_cache(int u);
@@ -328,6 +340,18 @@ free_dns_entry(struct dnsentry *dnsentry)
 	free(dnsentry);
 }
 
+static void
+add_dns_entry(char *name, struct lookup_result *addr)
+{
+	struct dnsentry *dnsentry;
+	check_dns_cache_addr_preference();
+	dnsentry = xmalloc(sizeof(struct dnsentry) + strlen(name));
+	strcpy(dnsentry->name, name);
+	memcpy(&dnsentry->addr, addr, sizeof(struct lookup_result));
+	dnsentry->absolute_time = get_absolute_time();
+	add_to_list(dns_cache, dnsentry);
+}
+
 static void
 end_dns_lookup(struct dnsquery *q, int a)
 {
@@ -351,12 +375,7 @@ end_dns_lookup(struct dnsquery *q, int a)
 		goto e;
 	if (q->addr_preference != ipv6_options.addr_preference)
 		goto e;
-	check_dns_cache_addr_preference();
-	dnsentry = xmalloc(sizeof(struct dnsentry) + strlen(q->name));
-	strcpy(dnsentry->name, q->name);
-	memcpy(&dnsentry->addr, q->addr, sizeof(struct lookup_result));
-	dnsentry->absolute_time = get_absolute_time();
-	add_to_list(dns_cache, dnsentry);
+	add_dns_entry(q->name, q->addr);
 e:
 	if (q->s)
 		*q->s = NULL;
@@ -410,6 +429,90 @@ kill_dns_request(void **qp)
 	*qp = NULL;
 }
 
+/*
+ * Lookups are synchronous, so a speculative one is done in a child process
+ * that writes the struct lookup_result to a pipe. The result only lands in
+ * the cache; nobody waits for it.
+ */
+static void
+free_dns_prefetch(struct dns_prefetch *p)
+{
+	int rs;
+	set_handlers(p->h, NULL, NULL, NULL);
+	EINTRLOOP(rs, close(p->h));
+	del_from_list(p);
+	free(p);
+}
+
+static void
+dns_prefetch_thread(void *name, int h)
+{
+	struct lookup_result addr;
+	do_real_lookup(name, ipv6_options.addr_preference, &addr);
+	hard_write(h, (unsigned char *)&addr, sizeof addr);
+}
+
+static void
+dns_prefetch_got(void *p_)
+{
+	struct dns_prefetch *p = p_;
+	struct dnsentry *dnsentry;
+	int r;
+	EINTRLOOP(r, (int)read(p->h, (unsigned char *)&p->addr + p->got,
+	                       sizeof p->addr - p->got));
+	if (r > 0 && (p->got += r) < sizeof p->addr)
+		return;
+	if (r > 0 && p->addr.n
+	    && p->addr_preference == ipv6_options.addr_preference) {
+		if (!find_in_dns_cache(p->name, &dnsentry))
+			free_dns_entry(dnsentry);
+		add_dns_entry(p->name, &p->addr);
+	}
+	free_dns_prefetch(p);
+}
+
+/* Start resolving name in the background unless it is cached, numeric or
+ * already being resolved. Returns -1 if DNS_PREFETCH_MAX lookups are
+ * running. */
+int
+dns_prefetch(char *name)
+{
+	struct dns_prefetch *p = NULL;
+	struct list_head *lp;
+	struct dnsentry *dnsentry;
+	size_t sl;
+	int h;
+	if (!*name || *name == '[' || !numeric_ip_address(name, NULL)
+	    || !numeric_ipv6_address(name, NULL, NULL))
+		return 0;
+	if (!find_in_dns_cache(name, &dnsentry)
+	    && get_absolute_time() - dnsentry->absolute_time <= DNS_TIMEOUT)
+		return 0;
+	foreach (struct dns_prefetch, p, lp, dns_prefetches)
+		if (!strcasecmp(p->name, name))
+			return 0;
+	if (list_size(&dns_prefetches) >= DNS_PREFETCH_MAX)
+		return -1;
+	sl = strlen(name);
+	if ((h = start_thread(dns_prefetch_thread, name, (int)sl + 1, 0)) < 0)
+		return -1;
+	p = mem_calloc(sizeof(struct dns_prefetch) + sl);
+	p->h = h;
+	p->addr_preference = ipv6_options.addr_preference;
+	strcpy(p->name, name);
+	add_to_list(dns_prefetches, p);
+	set_handlers(h, dns_prefetch_got, NULL, p);
+	return 0;
+}
+
+void
+abort_dns_prefetches(void)
+{
+	while (!list_empty(dns_prefetches))
+		free_dns_prefetch(
+		    list_struct(dns_prefetches.next, struct dns_prefetch));
+}
+
 #if MAX_ADDRESSES > 1
 void
 dns_set_priority(char *name, struct host_address *address, int prefer)
@@ -465,6 +568,8 @@ shrink_dns_cache(int u)
 	struct dnsentry *d = NULL;
 	struct list_head *ld;
 	int f = 0;
+	if (u == SH_FREE_ALL)
+		abort_dns_prefetches();
 	if (u == SH_FREE_SOMETHING && !list_empty(dns_cache)) {
 		d = list_struct(dns_cache.prev, struct dnsentry);
 		goto delete_last;
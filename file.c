@@ -45,8 +45,8 @@ setst(unsigned m, unsigned char *p)
 #endif
 }
 
-static size_t
-stat_mode(unsigned char **p, size_t l, struct stat *stp)
+static void
+stat_mode(struct string_buf *p, struct stat *stp)
 {
 	unsigned char c = '?';
 	unsigned char rwx[10] = "---------";
@@ -82,7 +82,7 @@ stat_mode(unsigned char **p, size_t l, struct stat *stp)
 			c = 'n';
 #endif
 	}
-	l = add_chr_to_str(p, l, c);
+	add_chr_to_buf(p, c);
 	if (stp) {
 		unsigned mode = stp->st_mode;
 		setrwx(mode << 0, &rwx[0]);
@@ -90,19 +90,21 @@ stat_mode(unsigned char **p, size_t l, struct stat *stp)
 		setrwx(mode << 6, &rwx[6]);
 		setst(mode, rwx);
 	}
-	l = add_to_str(p, l, rwx);
-	return add_chr_to_str(p, l, ' ');
+	add_to_buf(p, rwx);
+	add_chr_to_buf(p, ' ');
 }
 
-static size_t
-stat_links(unsigned char **p, size_t l, struct stat *stp)
+static void
+stat_links(struct string_buf *p, struct stat *stp)
 {
 	unsigned char lnk[64];
-	if (!stp)
-		return add_to_str(p, l, cast_uchar "    ");
+	if (!stp) {
+		add_to_buf(p, cast_uchar "    ");
+		return;
+	}
 
 	sprintf(cast_char lnk, "%3ld ", (unsigned long)stp->st_nlink);
-	return add_to_str(p, l, lnk);
+	add_to_buf(p, lnk);
 }
 
 static int last_uid = -1;
@@ -111,16 +113,18 @@ static unsigned char last_user[64];
 static int last_gid = -1;
 static unsigned char last_group[64];
 
-static size_t
-stat_user(unsigned char **p, size_t l, struct stat *stp, int g)
+static void
+stat_user(struct string_buf *p, struct stat *stp, int g)
 {
 	struct passwd *pwd;
 	struct group *grp;
 	int id;
 	unsigned char *pp;
 	size_t i;
-	if (!stp)
-		return add_to_str(p, l, cast_uchar "         ");
+	if (!stp) {
+		add_to_buf(p, cast_uchar "         ");
+		return;
+	}
 	id = !g ? stp->st_uid : stp->st_gid;
 	pp = !g ? last_user : last_group;
 	if (!g && id == last_uid && last_uid != -1)
@@ -143,14 +147,14 @@ stat_user(unsigned char **p, size_t l, struct stat *stp, int g)
 		last_gid = id;
 	}
 a:
-	l = add_to_str(p, l, pp);
+	add_to_buf(p, pp);
 	for (i = strlen(cast_const_char pp); i < 8; i++)
-		l = add_chr_to_str(p, l, ' ');
-	return add_chr_to_str(p, l, ' ');
+		add_chr_to_buf(p, ' ');
+	add_chr_to_buf(p, ' ');
 }
 
-static size_t
-stat_size(unsigned char **p, size_t l, struct stat *stp)
+static void
+stat_size(struct string_buf *p, struct stat *stp)
 {
 	unsigned char num[64];
 	const int digits = 8;
@@ -160,13 +164,13 @@ stat_size(unsigned char **p, size_t l, struct stat *stp)
 	else
 		snzprint(num, sizeof num, stp->st_size);
 	for (i = strlen(cast_const_char num); i < digits; i++)
-		l = add_chr_to_str(p, l, ' ');
-	l = add_to_str(p, l, num);
-	return add_chr_to_str(p, l, ' ');
+		add_chr_to_buf(p, ' ');
+	add_to_buf(p, num);
+	add_chr_to_buf(p, ' ');
 }
 
-static size_t
-stat_date(unsigned char **p, size_t l, struct stat *stp)
+static void
+stat_date(struct string_buf *p, struct stat *stp)
 {
 	time_t current_time;
 	time_t when;
@@ -200,8 +204,8 @@ set_empty:
 	while (wr < 12)
 		str[wr++] = ' ';
 	str[12] = 0;
-	l = add_to_str(p, l, str);
-	return add_chr_to_str(p, l, ' ');
+	add_to_buf(p, str);
+	add_chr_to_buf(p, ' ');
 }
 
 static unsigned char *
@@ -336,8 +340,8 @@ dir:
 		fl = add_to_str(&file, fl, cast_uchar "</h2>\n<pre>");
 		while (1) {
 			struct stat stt, *stp;
-			unsigned char **p;
-			int l;
+			unsigned char stack[128];
+			struct string_buf b;
 			unsigned char *n;
 			ENULLLOOP(de, (void *)readdir(d));
 			if (!de)
@@ -355,8 +359,6 @@ dir:
 				overalloc();
 			dir = xrealloc(dir, (dirl + 1) * sizeof(struct dirs));
 			dir[dirl].f = stracpy(cast_uchar de->d_name);
-			*(p = &dir[dirl++].s) = NULL;
-			l = 0;
 			n = stracpy(name);
 			add_to_strn(&n, cast_uchar de->d_name);
 			EINTRLOOP(rs, lstat(cast_const_char n, &stt));
@@ -365,12 +367,14 @@ dir:
 			else
 				stp = &stt;
 			free(n);
-			l = stat_mode(p, l, stp);
-			l = stat_links(p, l, stp);
-			l = stat_user(p, l, stp, 0);
-			l = stat_user(p, l, stp, 1);
-			l = stat_size(p, l, stp);
-			l = stat_date(p, l, stp);
+			init_buf(&b, stack, sizeof stack);
+			stat_mode(&b, stp);
+			stat_links(&b, stp);
+			stat_user(&b, stp, 0);
+			stat_user(&b, stp, 1);
+			stat_size(&b, stp);
+			stat_date(&b, stp);
+			dir[dirl++].s = buf_string(&b);
 		}
 		closedir(d);
 		if (dirl)
@@ -4,6 +4,7 @@
  */
 
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "links.h"
@@ -274,6 +275,16 @@ need_convert:
 	return c;
 }
 
+/* Resolve a link of the document being formatted; tables format their cells
+ * several times, so the results are kept with the document. */
+static unsigned char *
+html_join_urls(unsigned char *base, unsigned char *rel)
+{
+	return join_urls_cached(current_f_data ? &current_f_data->url_joins
+	                                       : NULL,
+	                        base, rel);
+}
+
 static unsigned char *
 get_exact_attr_val(unsigned char *e, unsigned char *name)
 {
@@ -965,7 +976,7 @@ put_link_line(unsigned char *prefix, unsigned char *linkname,
 	format_.form = NULL;
 	put_chrs(prefix, (int)strlen(cast_const_char prefix));
 	html_format_changed = 1;
-	format_.link = join_urls(format_.href_base, link);
+	format_.link = html_join_urls(format_.href_base, link);
 	format_.target = stracpy(target);
 	set_link_attr();
 	put_chrs(linkname, (int)strlen(cast_const_char linkname));
@@ -1037,7 +1048,7 @@ html_a(unsigned char *a)
 		while (all[0] && all[strlen(cast_const_char all) - 1] == ' ')
 			all[strlen(cast_const_char all) - 1] = 0;
 		free(format_.link);
-		format_.link = join_urls(format_.href_base, all);
+		format_.link = html_join_urls(format_.href_base, all);
 		free(al);
 		if ((al = get_target(a))) {
 			free(format_.target);
@@ -1157,7 +1168,7 @@ html_img(unsigned char *a)
 		html_stack_dup();
 		free(format_.link);
 		format_.form = NULL;
-		u = join_urls(*al == '#' ? top_href_base() : format_.href_base,
+		u = html_join_urls(*al == '#' ? top_href_base() : format_.href_base,
 		              al);
 		format_.link = stracpy(cast_uchar "MAP@");
 		add_to_strn(&format_.link, u);
@@ -1188,7 +1199,7 @@ html_img(unsigned char *a)
 	    || (s = get_url_val(a, cast_uchar "src"))) {
 		if (!s[0])
 			goto skip_img;
-		format_.image = join_urls(format_.href_base, s);
+		format_.image = html_join_urls(format_.href_base, s);
 skip_img:
 		orig_link = s;
 	}
@@ -1251,13 +1262,13 @@ html_obj(unsigned char *a, int obj)
 	unsigned char *type = get_attr_val(a, cast_uchar "type");
 	unsigned char *base;
 	if ((base = get_url_val(a, cast_uchar "codebase")))
-		format_.href_base = join_urls(format_.href_base, base);
+		format_.href_base = html_join_urls(format_.href_base, base);
 	if (!type) {
 		url = get_url_val(a, cast_uchar "src");
 		if (!url)
 			url = get_url_val(a, cast_uchar "data");
 		if (url) {
-			unsigned char *ju = join_urls(format_.href_base, url);
+			unsigned char *ju = html_join_urls(format_.href_base, url);
 			type = get_content_type(NULL, ju);
 			free(url);
 			free(ju);
@@ -1581,7 +1592,7 @@ html_base(unsigned char *a)
 	unsigned char *al;
 	if ((al = get_url_val(a, cast_uchar "href"))) {
 		free(format_.href_base);
-		format_.href_base = join_urls(top_href_base(), al);
+		format_.href_base = html_join_urls(top_href_base(), al);
 		special_f(ff, SP_SET_BASE, format_.href_base);
 		free(al);
 	}
@@ -1773,7 +1784,7 @@ get_html_form(unsigned char *a, struct form *form)
 			all++;
 		while (all[0] && all[strlen(cast_const_char all) - 1] == ' ')
 			all[strlen(cast_const_char all) - 1] = 0;
-		form->action = join_urls(format_.href_base, all);
+		form->action = html_join_urls(format_.href_base, all);
 		free(al);
 	} else {
 		if ((ch = cast_uchar strchr(
@@ -2062,7 +2073,7 @@ xxx:
 		format_.image = NULL;
 		if ((al = get_url_val(a, cast_uchar "src"))
 		    || (al = get_url_val(a, cast_uchar "dynsrc"))) {
-			format_.image = join_urls(format_.href_base, al);
+			format_.image = html_join_urls(format_.href_base, al);
 			free(al);
 		}
 		format_.attr |= AT_BOLD | AT_FIXED;
@@ -2734,7 +2745,7 @@ html_frame(unsigned char *a)
 	if (!(u2 = get_url_val(a, cast_uchar "src"))) {
 		url = stracpy(cast_uchar "");
 	} else {
-		url = join_urls(format_.href_base, u2);
+		url = html_join_urls(format_.href_base, u2);
 		free(u2);
 	}
 	name = get_attr_val(a, cast_uchar "name");
@@ -3012,24 +3023,29 @@ html_link(unsigned char *a)
 	if (!casestrcmp(name, cast_uchar "prefetch")
 	    || !casestrcmp(name, cast_uchar "prerender")
 	    || !casestrcmp(name, cast_uchar "preload")) {
-		unsigned char *pre_url = join_urls(format_.href_base, url);
-		if (!dmp)
-			load_url(pre_url, format_.href_base, NULL, PRI_PRELOAD,
-			         NC_ALWAYS_CACHE, 0, 0, 0);
+		unsigned char *pre_url = html_join_urls(format_.href_base, url);
+		special_f(ff, SP_PREFETCH, pre_url);
 		free(pre_url);
 		goto skip;
 	}
+	if (prefetch_pages && !casestrcmp(name, cast_uchar "next")) {
+		unsigned char *pre_url = html_join_urls(format_.href_base, url);
+		special_f(ff, SP_PREFETCH, pre_url);
+		free(pre_url);
+	}
 	if (!casestrcmp(name, cast_uchar "dns-prefetch")) {
 		unsigned char *pre_url, *host;
 		if (dmp || *proxies.socks_proxy || proxies.only_proxies)
 			goto skip;
-		pre_url = join_urls(format_.href_base, url);
+		pre_url = html_join_urls(format_.href_base, url);
 		if (get_proxy_string(pre_url) || is_noproxy_url(pre_url)) {
 			free(pre_url);
 			goto skip;
 		}
 		host = get_host_name(pre_url);
 		free(pre_url);
+		if (prefetch)
+			dns_prefetch((char *)host);
 		free(host);
 		goto skip;
 	}
@@ -3221,19 +3237,41 @@ qd(unsigned char *html, unsigned char *eof, int *len)
 	return -1;
 }
 
-void
-parse_html(unsigned char *html, unsigned char *eof,
-           void (*put_chars)(void *, unsigned char *, int),
-           void (*line_break)(void *), void *(*special)(void *, int, ...),
-           void *f, unsigned char *head)
+static int
+compare_elements(const void *a, const void *b)
 {
-	unsigned char *lt;
+	return strcmp(((const struct element_info *)a)->name,
+	              ((const struct element_info *)b)->name);
+}
 
-	html_format_changed = 1;
-	putsp = -1;
-	line_breax = table_level ? 2 : 1;
-	pos = 0;
-	was_br = 0;
+static struct element_info *
+find_element(unsigned char *name, int namelen)
+{
+	static int sorted = 0;
+	int l = 0, r = (int)array_elements(elements) - 1;
+	if (!sorted) {
+		qsort(elements, array_elements(elements),
+		      sizeof(struct element_info), compare_elements);
+		sorted = 1;
+	}
+	while (l <= r) {
+		int m = (l + r) / 2;
+		unsigned char *en = cast_uchar elements[m].name;
+		int i, c = 0;
+		for (i = 0; !c; i++) {
+			c = (int)en[i] - (i < namelen ? upcase(name[i]) : 0);
+			if (!en[i])
+				break;
+		}
+		if (!c)
+			return &elements[m];
+		if (c < 0)
+			l = m + 1;
+		else
+			r = m - 1;
+	}
+	return NULL;
+}
 
 #define set_globals                                                            \
 	do {                                                                   \
@@ -3244,15 +3282,25 @@ parse_html(unsigned char *html, unsigned char *eof,
 		eoff = eof;                                                    \
 	} while (0)
 
-	set_globals;
+/* Continue parsing at html with the state left by parse_html. Outside of
+ * tables, special(f, SP_STOP) is asked between lines whether to stop; the
+ * position to resume from is returned then, NULL when eof was reached. */
+unsigned char *
+resume_html(unsigned char *html, unsigned char *eof,
+            void (*put_chars)(void *, unsigned char *, int),
+            void (*line_break)(void *), void *(*special)(void *, int, ...),
+            void *f)
+{
+	unsigned char *lt;
 
-	if (head)
-		process_head(head);
+	set_globals;
 
 set_lt:
 
 	/*set_globals;*/
 
+	if (!table_level && html < eof && special(f, SP_STOP))
+		return html;
 	lt = html;
 	while (html < eof) {
 		unsigned char *name, *attr, *end;
@@ -3405,18 +3453,7 @@ element:
 ng:;
 			}
 		html = end;
-		for (ei = elements; ei != endof(elements); ei++) {
-			if (strlen(cast_const_char ei->name) != (size_t)namelen
-			    || casecmp(cast_uchar ei->name, name, namelen))
-				continue;
-			if (ei - elements > 4) {
-				struct element_info e = *ei;
-				memmove(elements + 1, elements,
-				        (ei - elements)
-				            * sizeof(struct element_info));
-				elements[0] = e;
-				ei = &elements[0];
-			}
+		if ((ei = find_element(name, namelen))) {
 			if (!inv) {
 				int display_none = 0;
 				int noskip = 0;
@@ -3580,7 +3617,7 @@ ng:;
 				int xxx = 0;
 				was_br = 0;
 				if (ei->nopair == 1 || ei->nopair == 3)
-					break;
+					goto unpaired;
 				/*debug_stack();*/
 				foreach (struct html_element, e, le,
 				         html_stack) {
@@ -3621,6 +3658,7 @@ ng:;
 			}
 			goto set_lt;
 		}
+unpaired:
 		if (!inv) {
 			if ((a = get_attr_val(attr, cast_uchar "id"))) {
 				special(f, SP_TAG, a);
@@ -3635,8 +3673,29 @@ ng:;
 	pos = 0;
 	/*line_breax = 1;*/
 	was_br = 0;
-#undef set_globals
+	return NULL;
+}
+
+unsigned char *
+parse_html(unsigned char *html, unsigned char *eof,
+           void (*put_chars)(void *, unsigned char *, int),
+           void (*line_break)(void *), void *(*special)(void *, int, ...),
+           void *f, unsigned char *head)
+{
+	html_format_changed = 1;
+	putsp = -1;
+	line_breax = table_level ? 2 : 1;
+	pos = 0;
+	was_br = 0;
+
+	set_globals;
+
+	if (head)
+		process_head(head);
+
+	return resume_html(html, eof, put_chars, line_break, special, f);
 }
+#undef set_globals
 
 static void
 scan_area_tag(unsigned char *attr, unsigned char *name, unsigned char **ptr,
@@ -3770,7 +3829,7 @@ se4:
 		target = stracpy(cast_uchar "");
 	ld = mem_calloc(sizeof(struct link_def));
 	if (href) {
-		ld->link = join_urls(href_base, href);
+		ld->link = html_join_urls(href_base, href);
 		free(href);
 	}
 	ld->target = target;
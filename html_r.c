@@ -7,6 +7,34 @@
 
 #include "links.h"
 
+static void end_search_index(struct f_data *, int);
+static void end_format_html(struct f_data *);
+static void suspend_format(struct f_data *);
+static void end_lazy_format(int);
+static void lazy_format_timer(void *);
+static void resume_search_index(struct f_data *);
+
+/* A big document is formatted lazily: parsing of the top part stops after
+ * the lines needed for the first screen and continues from a timer. There
+ * is at most one such document as the formatter state is global; anything
+ * else that formats finishes it first. */
+static struct {
+	struct f_data *f;
+	struct part *p;
+	struct html_element *e;
+	int align;
+	unsigned char *start, *pos, *end;
+	int llm;
+	struct list_head *ltm;
+	int lm, ef;
+	int y;           /* stop at a line break below this line */
+	uttime deadline; /* or when this time has passed */
+	int last_y;
+	int x_lines;    /* lines measured into f->x */
+	uttime suspend; /* how long indexing the lines took last time */
+	struct timer *timer;
+} lazy;
+
 struct f_data *
 init_formatted(struct document_options *opt)
 {
@@ -108,10 +136,14 @@ clear_formatted(struct f_data *scr)
 	if (!scr)
 		return;
 
+	if (scr == lazy.f)
+		end_lazy_format(0);
+	if (scr->search_index)
+		end_search_index(scr, -1);
 	free(scr->search_chr);
 	free(scr->search_pos);
-	free(scr->slines1);
-	free(scr->slines2);
+	free(scr->search_word);
+	free(scr->search_match);
 
 	release_object(&scr->rq);
 	free_additional_files(&scr->af);
@@ -133,6 +165,8 @@ clear_formatted(struct f_data *scr)
 	free(scr->data);
 	free(scr->lines1);
 	free(scr->lines2);
+	free(scr->link_rows);
+	free(scr->link_cells);
 	free(scr->opt.framename);
 	foreach (struct form_control, fc, lfc, scr->forms) {
 		destroy_fc(fc);
@@ -140,7 +174,11 @@ clear_formatted(struct f_data *scr)
 	free_list(struct form_control, scr->forms);
 	free_list(struct tag, scr->tags);
 	free_list(struct node, scr->nodes);
+	free_url_joins(&scr->url_joins);
 	free(scr->refresh);
+	for (n = 0; n < scr->nprefetch; n++)
+		free(scr->prefetch[n]);
+	free(scr->prefetch);
 }
 
 void
@@ -1108,6 +1146,34 @@ html_process_refresh(struct f_data *f, unsigned char *url, int time)
 	f->refresh_seconds = time;
 }
 
+static int
+stop_format(struct part *p)
+{
+	if (!lazy.f || p->data != lazy.f || p->cx >= 0 || format_.link
+	    || format_.image || format_.form)
+		return 0;
+	if (p->y >= lazy.y)
+		return 1;
+	if (!lazy.deadline || p->y == lazy.last_y)
+		return 0;
+	lazy.last_y = p->y;
+	return get_time() >= lazy.deadline;
+}
+
+static void
+html_process_prefetch(struct f_data *f, unsigned char *url)
+{
+	int i;
+	if (!f || f->nprefetch >= PREFETCH_HINTS)
+		return;
+	for (i = 0; i < f->nprefetch; i++)
+		if (!strcmp(cast_const_char f->prefetch[i], cast_const_char url))
+			return;
+	if (!f->prefetch)
+		f->prefetch = xmalloc(PREFETCH_HINTS * sizeof(unsigned char *));
+	f->prefetch[f->nprefetch++] = stracpy(url);
+}
+
 static void *
 html_special(void *p_, int c, ...)
 {
@@ -1160,12 +1226,20 @@ html_special(void *p_, int c, ...)
 		va_end(l);
 		html_process_refresh(p->data, rp->url, rp->time);
 		break;
+	case SP_PREFETCH:
+		t = va_arg(l, unsigned char *);
+		va_end(l);
+		html_process_prefetch(p->data, t);
+		break;
 	case SP_SET_BASE:
 		t = va_arg(l, unsigned char *);
 		va_end(l);
 		if (p->data)
 			set_base(p->data, t);
 		break;
+	case SP_STOP:
+		va_end(l);
+		return stop_format(p) ? p : NULL;
 	default:
 		va_end(l);
 		internal("html_special: unknown code %d", c);
@@ -1173,16 +1247,55 @@ html_special(void *p_, int c, ...)
 	return NULL;
 }
 
-static void
+static unsigned char *
 do_format(unsigned char *start, unsigned char *end, struct part *part,
           unsigned char *head)
 {
-	pr(parse_html(start, end, put_chars, line_break, html_special, part,
-	              head);){};
+	unsigned char *rest = NULL;
+	pr(rest = parse_html(start, end, put_chars, line_break, html_special,
+	                     part, head);){};
+	return rest;
 }
 
 int margin;
 
+static void
+end_format_part(struct part *p, struct html_element *e, int align, int ys)
+{
+	struct form_control *fc = NULL;
+	struct list_head *lfc;
+	struct f_data *data = p->data;
+
+	if (p->xmax < p->x)
+		p->xmax = p->x;
+	if (align == AL_NO || align == AL_NO_BREAKABLE) {
+		if (p->cy > p->y)
+			p->y = p->cy;
+	}
+	nobreak = 0;
+	line_breax = 1;
+	free(last_link);
+	free(last_image);
+	free(last_target);
+	while (&html_top != e) {
+		kill_html_stack_item(&html_top);
+		if (!&html_top || (void *)&html_top == (void *)&html_stack) {
+			internal("html stack trashed");
+			break;
+		}
+	}
+	html_top.dontkill = 0;
+	kill_html_stack_item(&html_top);
+	free(p->spaces);
+	if (data) {
+		struct node *n = list_struct(data->nodes.next, struct node);
+		n->yw = ys - n->y + p->y;
+	}
+	foreach (struct form_control, fc, lfc, p->uf)
+		destroy_fc(fc);
+	free_list(struct form_control, p->uf);
+}
+
 struct part *
 format_html_part(unsigned char *start, unsigned char *end, int align, int m,
                  int width, struct f_data *data, int xs, int ys,
@@ -1194,8 +1307,6 @@ format_html_part(unsigned char *start, unsigned char *end, int align, int m,
 	struct list_head *ltm = last_tag_to_move;
 	int lm = margin;
 	int ef = empty_format;
-	struct form_control *fc = NULL;
-	struct list_head *lfc;
 
 	if (par_format.implicit_pre_wrap) {
 		if (width > d_opt->xw)
@@ -1260,35 +1371,20 @@ format_html_part(unsigned char *start, unsigned char *end, int align, int m,
 		format_.attr |= AT_FIXED;
 	p->cx = -1;
 	p->cy = 0;
-	do_format(start, end, p, head);
-	if (p->xmax < p->x)
-		p->xmax = p->x;
-	if (align == AL_NO || align == AL_NO_BREAKABLE) {
-		if (p->cy > p->y)
-			p->y = p->cy;
-	}
-	nobreak = 0;
-	line_breax = 1;
-	free(last_link);
-	free(last_image);
-	free(last_target);
-	while (&html_top != e) {
-		kill_html_stack_item(&html_top);
-		if (!&html_top || (void *)&html_top == (void *)&html_stack) {
-			internal("html stack trashed");
-			break;
+	if (data && data == lazy.f && !table_level) {
+		if ((lazy.pos = do_format(start, end, p, head))) {
+			lazy.p = p;
+			lazy.e = e;
+			lazy.align = align;
+			lazy.llm = llm;
+			lazy.ltm = ltm;
+			lazy.lm = lm;
+			lazy.ef = ef;
+			return NULL;
 		}
-	}
-	html_top.dontkill = 0;
-	kill_html_stack_item(&html_top);
-	free(p->spaces);
-	if (data) {
-		struct node *n = list_struct(data->nodes.next, struct node);
-		n->yw = ys - n->y + p->y;
-	}
-	foreach (struct form_control, fc, lfc, p->uf)
-		destroy_fc(fc);
-	free_list(struct form_control, p->uf);
+	} else
+		do_format(start, end, p, head);
+	end_format_part(p, e, align, ys);
 	last_link_to_move = llm;
 	last_tag_to_move = ltm;
 	margin = lm;
@@ -1389,9 +1485,10 @@ really_format_html(struct cache_entry *ce, unsigned char *start,
 	int i;
 	unsigned char *bg = NULL, *bgcolor = NULL;
 	int implicit_pre_wrap;
-	int bg_col, fg_col;
 	struct part *rp;
 
+	if (lazy.f)
+		format_lines(lazy.f, INT_MAX);
 	current_f_data = screen;
 	d_opt = &screen->opt;
 	screen->use_tag = ce->count;
@@ -1431,6 +1528,13 @@ really_format_html(struct cache_entry *ce, unsigned char *start,
 	last_form_tag = NULL;
 	last_form_attr = NULL;
 	last_input_tag = NULL;
+	if (!frame && screen->ses && screen->opt.plain != 2
+	    && end - start >= FORMAT_LAZY_SIZE) {
+		lazy.f = screen;
+		lazy.start = start;
+		lazy.end = end;
+		lazy.y = screen->opt.yw * 2;
+	}
 	if ((rp = format_html_part(start, end, par_format.align,
 	                           par_format.leftmargin, screen->opt.xw,
 	                           screen, 0, 0, head, 1)))
@@ -1438,6 +1542,22 @@ really_format_html(struct cache_entry *ce, unsigned char *start,
 	free(head);
 	free(bg);
 	free(bgcolor);
+	if (lazy.f == screen) {
+		if (lazy.pos) {
+			suspend_format(screen);
+			return;
+		}
+		lazy.f = NULL;
+	}
+	end_format_html(screen);
+}
+
+static void
+end_format_html(struct f_data *screen)
+{
+	int i;
+	int bg_col, fg_col;
+
 	screen->x = 0;
 	for (i = screen->y - 1; i >= 0; i--) {
 		if (!screen->data[i].l) {
@@ -1467,11 +1587,126 @@ really_format_html(struct cache_entry *ce, unsigned char *start,
 		internal("html stack not empty after operation");
 		init_list(html_stack);
 	}
+	free(screen->lines1);
+	free(screen->lines2);
+	free(screen->link_rows);
+	free(screen->link_cells);
 	sort_links(screen);
 	current_f_data = NULL;
 	d_opt = &dd_opt;
 }
 
+/* Make the lines formatted so far usable while the rest waits: the links
+ * are indexed and the state that refers to the document is put aside. */
+static void
+suspend_format(struct f_data *f)
+{
+	struct html_element *base =
+	    list_struct(html_stack.prev, struct html_element);
+	int i;
+	int bg_col, fg_col;
+	uttime t = get_time();
+
+	free(last_link);
+	free(last_image);
+	free(last_target);
+	last_link = last_image = last_target = NULL;
+	last_form = NULL;
+	for (i = lazy.x_lines; i < f->y; i++)
+		if (f->data[i].l > f->x)
+			f->x = f->data[i].l;
+	lazy.x_lines = lazy.p->cy;
+	bg_col = find_nearest_color(&base->attr.bg, 8);
+	fg_col = find_nearest_color(&base->attr.fg, 16);
+	fg_col = fg_color(fg_col, bg_col);
+	f->bg = get_attribute(fg_col, bg_col);
+	free(f->lines1);
+	free(f->lines2);
+	free(f->link_rows);
+	free(f->link_cells);
+	sort_links(f);
+	current_f_data = NULL;
+	d_opt = &dd_opt;
+	lazy.suspend = get_time() - t;
+	lazy.timer = install_timer(0, lazy_format_timer, NULL);
+	resume_search_index(f);
+}
+
+static void
+end_lazy_format(int done)
+{
+	struct f_data *f = lazy.f;
+
+	if (lazy.timer)
+		kill_timer(lazy.timer);
+	current_f_data = f;
+	d_opt = &f->opt;
+	end_format_part(lazy.p, lazy.e, lazy.align, 0);
+	free(lazy.p);
+	last_link_to_move = lazy.llm;
+	last_tag_to_move = lazy.ltm;
+	margin = lazy.lm;
+	empty_format = lazy.ef;
+	last_link = last_image = last_target = NULL;
+	last_form = NULL;
+	memset(&lazy, 0, sizeof lazy);
+	end_format_html(f);
+	resume_search_index(f);
+}
+
+static void
+format_step(int y, uttime deadline)
+{
+	struct f_data *f = lazy.f;
+
+	if (lazy.timer) {
+		kill_timer(lazy.timer);
+		lazy.timer = NULL;
+	}
+	/* the source is gone if the entry changed, keep what we have */
+	if (f->rq->ce->count != f->use_tag) {
+		end_lazy_format(0);
+		return;
+	}
+	current_f_data = f;
+	d_opt = &f->opt;
+	startf = lazy.start;
+	eofff = lazy.end;
+	last_link_to_move = f->nlinks;
+	lazy.y = y;
+	lazy.deadline = deadline;
+	lazy.last_y = lazy.p->y;
+	if ((lazy.pos = resume_html(lazy.pos, lazy.end, put_chars, line_break,
+	                            html_special, lazy.p))) {
+		suspend_format(f);
+		return;
+	}
+	end_lazy_format(1);
+}
+
+static void
+lazy_format_timer(void *dummy)
+{
+	struct f_data *f = lazy.f;
+	uttime t = FORMAT_STEP_TIME;
+	lazy.timer = NULL;
+	/* indexing grows with the document, keep it a small part of a step */
+	if (t < lazy.suspend * 16)
+		t = lazy.suspend * 16;
+	format_step(INT_MAX, get_time() + t);
+	if (f != lazy.f && f->fd)
+		draw_fd(f->fd);
+}
+
+/* Format a lazily formatted document at least down to line y; INT_MAX
+ * formats all of it. */
+void
+format_lines(struct f_data *f, int y)
+{
+	if (f && f == lazy.f && (y == INT_MAX || y >= f->y))
+		format_step(y, 0);
+}
+
 int
 compare_opt(struct document_options *o1, struct document_options *o2)
 {
@@ -1509,72 +1744,31 @@ copy_opt(struct document_options *o1, struct document_options *o2)
 	o1->framename = stracpy(o2->framename);
 }
 
-struct link *
-get_link_at_location(struct f_data *f, int x, int y)
+/* index of the first cell of line y at column x or right of it */
+int
+first_link_cell(struct f_data *f, int y, int x)
 {
-	struct link *l1, *l2, *l;
-	if (y < 0 || y >= f->y)
-		return NULL;
-	l1 = f->lines1[y];
-	l2 = f->lines2[y];
-	if (!l1 || !l2)
-		return NULL;
-	for (l = l1; l <= l2; l++) {
-		int i;
-		for (i = 0; i < l->n; i++)
-			if (l->pos[i].x == x && l->pos[i].y == y)
-				return l;
+	int s = f->link_rows[y], e = f->link_rows[y + 1];
+	while (s < e) {
+		int m = (int)(((unsigned)s + (unsigned)e) / 2);
+		if (f->link_cells[m].x < x)
+			s = m + 1;
+		else
+			e = m;
 	}
-	return NULL;
+	return s;
 }
 
-static int
-sort_srch(struct f_data *f)
+struct link *
+get_link_at_location(struct f_data *f, int x, int y)
 {
-	int i;
-	int *min, *max;
-	if ((unsigned)f->y > INT_MAX / sizeof(struct search *))
-		overalloc();
-	if ((unsigned)f->y > INT_MAX / sizeof(int))
-		overalloc();
-	f->slines1 = xmalloc(f->y * sizeof(int));
-	f->slines2 = xmalloc(f->y * sizeof(int));
-	min = xmalloc(f->y * sizeof(int));
-	max = xmalloc(f->y * sizeof(int));
-	if (!f->slines1 || !f->slines2 || !min || !max) {
-		free(f->slines1);
-		free(f->slines2);
-		f->slines1 = NULL;
-		f->slines2 = NULL;
-		free(min);
-		free(max);
-		return -1;
-	}
-	for (i = 0; i < f->y; i++)
-		f->slines1[i] = f->slines2[i] = -1;
-	for (i = 0; i < f->y; i++) {
-		min[i] = INT_MAX;
-		max[i] = 0;
-	}
-	for (i = 0; i < f->nsearch_pos; i++) {
-		struct search *s = &f->search_pos[i];
-		int xe;
-		if (s->x < min[s->y]) {
-			min[s->y] = s->x;
-			f->slines1[s->y] = s->idx;
-		}
-		if (s->n == 1)
-			xe = safe_add(s->x, s->co);
-		else
-			xe = safe_add(s->x, s->n);
-		if (xe > max[s->y]) {
-			max[s->y] = xe;
-			f->slines2[s->y] = s->idx + s->co - 1;
-		}
-	}
-	free(min);
-	free(max);
-	return 0;
+	int c;
+	if (y < 0 || y >= f->y || !f->link_rows)
+		return NULL;
+	c = first_link_cell(f, y, x);
+	if (c == f->link_rows[y + 1] || f->link_cells[c].x != x)
+		return NULL;
+	return &f->links[f->link_cells[c].link];
 }
 
 static inline int
@@ -1583,24 +1777,75 @@ is_spc(chr *cc)
 	return cc->ch <= ' ' || cc->at & ATTR_FRAME;
 }
 
-static int n_chr, n_pos;
-static char_t srch_last_chr;
-static int srch_last_x, srch_last_y;
-static int srch_cont;
+/* The search data are built in the background a few lines at a time, in the
+ * order in which the nodes were formatted. */
+struct search_index {
+	struct list_head *node; /* node being indexed */
+	int y;                  /* its next line */
+	int chr_size, pos_size;
+	char_t last_chr;
+	int last_x, last_y;
+	int cont;
+	struct timer *timer;
+};
+
+static void
+end_search_index(struct f_data *f, int done)
+{
+	struct search_index *si = f->search_index;
+	if (si->timer)
+		kill_timer(si->timer);
+	free(si);
+	f->search_index = NULL;
+	f->search_done = done;
+	if (done < 0) {
+		free(f->search_chr);
+		f->search_chr = NULL;
+		free(f->search_pos);
+		f->search_pos = NULL;
+		f->nsearch_chr = f->nsearch_pos = 0;
+		return;
+	}
+	while (f->nsearch_chr
+	       && search_chr_at(f->search_chr, f->search_chr_width,
+	                        f->nsearch_chr - 1)
+	              == ' ')
+		f->nsearch_chr--;
+	f->search_chr =
+	    xreallocarray(f->search_chr, f->nsearch_chr ? f->nsearch_chr : 1,
+	                  f->search_chr_width);
+	f->search_pos = xreallocarray(f->search_pos,
+	                              f->nsearch_pos ? f->nsearch_pos : 1,
+	                              sizeof(struct search));
+}
 
+/* Characters are stored with the smallest width that holds all of them;
+ * switch to a larger one when the first character that needs it arrives. */
 static void
-get_srch_reset(void)
+widen_search_chr(struct f_data *f, int width)
 {
-	n_chr = n_pos = 0;
-	srch_last_chr = ' ';
-	srch_last_x = srch_last_y = -1;
-	srch_cont = 0;
+	struct search_index *si = f->search_index;
+	unsigned char *w;
+	int i;
+	w = xreallocarray(NULL, si->chr_size, width);
+	for (i = 0; i < f->nsearch_chr; i++) {
+		char_t c = search_chr_at(f->search_chr, f->search_chr_width, i);
+		if (width == 2)
+			((unsigned short *)w)[i] = (unsigned short)c;
+		else
+			((char_t *)w)[i] = c;
+	}
+	free(f->search_chr);
+	f->search_chr = w;
+	f->search_chr_width = width;
 }
 
 static int
-add_srch_chr(struct f_data *f, unsigned c, int x, int y, int nn)
+add_srch_chr(struct f_data *f, char_t c, int x, int y, int nn)
 {
-	if (c == ' ' && srch_last_chr == ' ')
+	struct search_index *si = f->search_index;
+	int width;
+	if (c == ' ' && si->last_chr == ' ')
 		return 0;
 	if (c == '_') {
 		struct link *l = get_link_at_location(f, x, y);
@@ -1609,131 +1854,239 @@ add_srch_chr(struct f_data *f, unsigned c, int x, int y, int nn)
 		        || l->type == L_AREA))
 			return 0;
 	}
-	srch_last_chr = c;
-	if (f->search_chr)
-		f->search_chr[n_chr] = c;
-	if (n_chr == INT_MAX)
-		return -1;
-	n_chr++;
-	if (srch_cont < 0xffff && x == srch_last_x + 1 && y == srch_last_y
+	si->last_chr = c;
+	if (f->nsearch_chr == si->chr_size) {
+		if (si->chr_size == INT_MAX)
+			return -1;
+		si->chr_size = si->chr_size > INT_MAX / 2 ? INT_MAX
+		                                          : si->chr_size * 2;
+		f->search_chr = xreallocarray(f->search_chr, si->chr_size,
+		                              f->search_chr_width);
+	}
+	width = c < 0x100 ? 1 : c < 0x10000 ? 2 : 4;
+	if (width > f->search_chr_width)
+		widen_search_chr(f, width);
+	if (f->search_chr_width == 1)
+		f->search_chr[f->nsearch_chr] = (unsigned char)c;
+	else if (f->search_chr_width == 2)
+		((unsigned short *)f->search_chr)[f->nsearch_chr] =
+		    (unsigned short)c;
+	else
+		((char_t *)f->search_chr)[f->nsearch_chr] = c;
+	f->nsearch_chr++;
+	if (si->cont < 0xffff && x == si->last_x + 1 && y == si->last_y
 	    && nn == 1) {
-		srch_cont++;
-		if (f->search_pos)
-			f->search_pos[n_pos - 1].co = (unsigned short)srch_cont;
+		si->cont++;
+		f->search_pos[f->nsearch_pos - 1].co = (unsigned short)si->cont;
 	} else {
-		if (f->search_pos) {
-			f->search_pos[n_pos].idx = n_chr - 1;
-			f->search_pos[n_pos].x = x;
-			f->search_pos[n_pos].y = y;
-			f->search_pos[n_pos].n = (unsigned short)nn;
-			if (f->search_pos[n_pos].n != nn)
-				f->search_pos[n_pos].n = (unsigned short)~0U;
-			f->search_pos[n_pos].co = 1;
+		struct search *sr;
+		if (f->nsearch_pos == si->pos_size) {
+			if (si->pos_size == INT_MAX)
+				return -1;
+			si->pos_size = si->pos_size > INT_MAX / 2
+			                   ? INT_MAX
+			                   : si->pos_size * 2;
+			f->search_pos =
+			    xreallocarray(f->search_pos, si->pos_size,
+			                  sizeof(struct search));
 		}
-		srch_cont = 1;
-		if (n_pos == INT_MAX)
-			return -1;
-		n_pos++;
+		sr = &f->search_pos[f->nsearch_pos++];
+		sr->idx = f->nsearch_chr - 1;
+		sr->x = x;
+		sr->y = y;
+		sr->n = (unsigned short)nn;
+		if (sr->n != nn)
+			sr->n = (unsigned short)~0U;
+		sr->co = 1;
+		si->cont = 1;
 	}
 	if (nn == 1) {
-		srch_last_x = x;
-		srch_last_y = y;
+		si->last_x = x;
+		si->last_y = y;
 	} else {
-		srch_last_x = -1;
-		srch_last_y = -1;
+		si->last_x = -1;
+		si->last_y = -1;
 	}
 	return 0;
 }
 
 static int
-get_srch(struct f_data *f)
+get_srch_line(struct f_data *f, struct node *n, int y)
 {
-	struct node *n = NULL;
-	struct list_head *ln;
-	get_srch_reset();
+	int x;
+	int xm = safe_add(n->x, n->xw);
+	int ns = 1;
 #define add_srch(c_, x_, y_, n_)                                               \
 	do {                                                                   \
 		if (add_srch_chr(f, c_, x_, y_, n_))                           \
 			return -1;                                             \
 	} while (0)
-	foreachback (struct node, n, ln, f->nodes) {
-		int x, y;
-		int xm = safe_add(n->x, n->xw), ym = safe_add(n->y, n->yw);
-		/*printf("%d %d - %d %d\n", n->x, n->y, xm, ym);
-		fflush(stdout);*/
-		for (y = n->y; y < ym && y < f->y; y++) {
-			int ns = 1;
-			for (x = n->x; x < xm && x < f->data[y].l; x++) {
-				unsigned c = f->data[y].d[x].ch;
-				if (is_spc(&f->data[y].d[x]))
-					c = ' ';
-				if (c == ' ' && ns)
-					continue;
-				c = charset_upcase(c, f->opt.cp);
-				if (ns) {
-					add_srch(c, x, y, 1);
-					ns = 0;
-					continue;
-				}
-				if (c != ' ') {
-					add_srch(c, x, y, 1);
-				} else {
-					int xx;
-					for (xx = safe_add(x, 1);
-					     xx < xm && xx < f->data[y].l; xx++)
-						if (!is_spc(&f->data[y].d[xx]))
-							goto ja_uz_z_toho_programovani_asi_zcvoknu;
-					xx = x;
+	for (x = n->x; x < xm && x < f->data[y].l; x++) {
+		unsigned c = f->data[y].d[x].ch;
+		if (is_spc(&f->data[y].d[x]))
+			c = ' ';
+		if (c == ' ' && ns)
+			continue;
+		c = charset_upcase(c, f->opt.cp);
+		if (ns) {
+			add_srch(c, x, y, 1);
+			ns = 0;
+			continue;
+		}
+		if (c != ' ') {
+			add_srch(c, x, y, 1);
+		} else {
+			int xx;
+			for (xx = safe_add(x, 1); xx < xm && xx < f->data[y].l;
+			     xx++)
+				if (!is_spc(&f->data[y].d[xx]))
+					goto ja_uz_z_toho_programovani_asi_zcvoknu;
+			xx = x;
 ja_uz_z_toho_programovani_asi_zcvoknu:
-					/* uz jsem zcvoknul, trpim poruchou
-					 * osobnosti */
-					add_srch(' ', x, y, xx - x);
-					if (xx == x)
-						goto uz_jsem_zcvoknul__jsem_psychopat__trpim_poruchou_osobnosti;
-					x = xx - 1;
-				}
-			}
-uz_jsem_zcvoknul__jsem_psychopat__trpim_poruchou_osobnosti:
-			add_srch(' ', x, y, 0);
+			/* uz jsem zcvoknul, trpim poruchou osobnosti */
+			add_srch(' ', x, y, xx - x);
+			if (xx == x)
+				goto uz_jsem_zcvoknul__jsem_psychopat__trpim_poruchou_osobnosti;
+			x = xx - 1;
 		}
 	}
+uz_jsem_zcvoknul__jsem_psychopat__trpim_poruchou_osobnosti:
+	add_srch(' ', x, y, 0);
 #undef add_srch
 	return 0;
 }
 
-int
-get_search_data(struct f_data *f)
+/* The top node of a document that is being formatted lazily ends with the
+ * lines formatted so far. */
+static int
+srch_node_end(struct f_data *f, struct node *n)
 {
-	if (f->search_pos)
-		return 0;
-	if (get_srch(f))
-		return -1;
-	if ((size_t)n_chr > ((size_t)-1) / sizeof(char_t)
-	    || (size_t)n_pos > ((size_t)-1) / sizeof(struct search))
-		return -1;
-	f->search_chr = xmalloc(n_chr * sizeof(char_t));
-	if (!f->search_chr)
-		return -1;
-	f->search_pos = xmalloc(n_pos * sizeof(struct search));
-	if (!f->search_pos) {
-		free(f->search_chr);
-		f->search_chr = NULL;
-		return -1;
+	if (f == lazy.f && &n->list_entry == f->nodes.prev)
+		return f->y;
+	return safe_add(n->y, n->yw);
+}
+
+/* Nothing more can be indexed until the next formatting step. */
+static int
+search_index_waits(struct f_data *f)
+{
+	struct search_index *si = f->search_index;
+	return f == lazy.f && si->node == f->nodes.prev && si->y >= f->y;
+}
+
+/* Index lines until the deadline passes, or all of them if it is 0.
+ * Returns 1 when the search data are complete, 0 if there is more to do or
+ * -1 if they are too big. */
+static int
+get_srch(struct f_data *f, uttime deadline)
+{
+	struct search_index *si = f->search_index;
+	int lines = 0;
+	while (si->node != &f->nodes) {
+		struct node *n = list_struct(si->node, struct node);
+		int ym = srch_node_end(f, n);
+		while (si->y < ym && si->y < f->y) {
+			if (get_srch_line(f, n, si->y++))
+				return -1;
+			if (deadline && !(++lines & 15) && get_time() >= deadline)
+				return 0;
+		}
+		if (search_index_waits(f))
+			return 0;
+		si->node = si->node->prev;
+		if (si->node != &f->nodes)
+			si->y = list_struct(si->node, struct node)->y;
 	}
-	if (get_srch(f))
-		internal(
-		    "get_search_data: get_srch should not fail second time");
-	while (n_chr && f->search_chr[n_chr - 1] == ' ')
-		n_chr--;
-	f->nsearch_chr = n_chr;
-	f->nsearch_pos = n_pos;
-	if (sort_srch(f)) {
-		free(f->search_pos);
-		f->search_pos = NULL;
-		free(f->search_chr);
-		f->search_chr = NULL;
-		f->nsearch_chr = f->nsearch_pos = 0;
+	return 1;
+}
+
+static void
+search_index_timer(void *f_)
+{
+	struct f_data *f = (struct f_data *)f_;
+	int r;
+	f->search_index->timer = NULL;
+	r = get_srch(f, get_time() + SEARCH_INDEX_TIME);
+	if (!r) {
+		if (!search_index_waits(f))
+			f->search_index->timer =
+			    install_timer(0, search_index_timer, f);
+		return;
+	}
+	end_search_index(f, r);
+	/* matches found in the partial data are shown, update them */
+	if (f->fd && f->search_word)
+		draw_fd(f->fd);
+}
+
+/* Go on indexing the lines a formatting step has added. */
+static void
+resume_search_index(struct f_data *f)
+{
+	struct search_index *si = f->search_index;
+	if (si && !si->timer)
+		si->timer = install_timer(0, search_index_timer, f);
+}
+
+/* The search data are built on the first search, the part formatted so far
+ * from a timer. */
+static void
+start_search_data(struct f_data *f)
+{
+	struct search_index *si;
+	if (f->search_index || f->search_done)
+		return;
+	si = mem_calloc(sizeof(struct search_index));
+	si->node = f->nodes.prev;
+	if (si->node != &f->nodes)
+		si->y = list_struct(si->node, struct node)->y;
+	si->chr_size = si->pos_size = ALLOC_GR;
+	si->last_chr = ' ';
+	si->last_x = si->last_y = -1;
+	f->search_chr = xmalloc(si->chr_size);
+	f->search_chr_width = 1;
+	f->search_pos = xreallocarray(NULL, si->pos_size, sizeof(struct search));
+	f->search_index = si;
+	si->timer = install_timer(0, search_index_timer, f);
+}
+
+/* Make the search data available. If all is 0, they may cover only the part
+ * of the document that has been indexed so far, if it is 1 the part that has
+ * been formatted. 2 formats and indexes all of it. */
+int
+get_search_data(struct f_data *f, int all)
+{
+	int r;
+	if (all > 1)
+		format_lines(f, INT_MAX);
+	start_search_data(f);
+	if (f->search_done < 0)
 		return -1;
+	if (all && f->search_index) {
+		if (!(r = get_srch(f, 0)))
+			return 0;
+		end_search_index(f, r);
+		if (r < 0)
+			return -1;
 	}
 	return 0;
 }
+
+/* Lines above the returned one are indexed completely. */
+int
+get_search_data_lines(struct f_data *f)
+{
+	struct search_index *si = f->search_index;
+	struct list_head *ln;
+	int y;
+	if (!si)
+		return f->y;
+	y = f->y;
+	for (ln = si->node; ln != &f->nodes; ln = ln->prev) {
+		struct node *n = list_struct(ln, struct node);
+		int ny = ln == si->node ? si->y : n->y;
+		if (ny < srch_node_end(f, n) && ny < y)
+			y = ny;
+	}
+	return y;
+}
@@ -19,30 +19,50 @@ struct http_connection_info {
 	off_t length;
 	int version;
 	int chunk_remaining;
+	uttime sent;     /* when the request was written */
+	uttime received; /* when the response header arrived */
+	unsigned char *post; /* POST data not yet written */
+	off_t post_left;     /* bytes left of the file being sent */
+	int end_notrunc, end_nokeepalive, end_state; /* see http_end_sink */
 };
 
+#define POST_BLOCK 65536
+
+struct post_file_name {
+	list_entry_1st;
+	unsigned char name[1];
+};
+
+/* Files the user has chosen to upload. A POST url can come from elsewhere,
+ * e.g. a redirect, so a file reference in it is only honoured if the file
+ * is on this list. */
+static struct list_head post_file_names = { &post_file_names,
+	                                    &post_file_names };
+
 /* prototypes */
 static void http_send_header(struct connection *c);
+static void http_send_post(struct connection *c);
 static void http_get_header(struct connection *c);
+static void http_end_request(struct connection *c, int notrunc,
+                             int nokeepalive, int state);
 static void test_restart(struct connection *c);
-static size_t add_user_agent(unsigned char **, size_t, const char *);
-static size_t add_referer(unsigned char **, size_t, unsigned char *,
-                          unsigned char *);
-static size_t add_accept(unsigned char **, size_t);
-static size_t add_accept_encoding(unsigned char **, size_t, unsigned char *,
-                                  struct connection *);
-static size_t add_accept_charset(unsigned char **, size_t,
-                                 struct http_connection_info *);
-static size_t add_connection(unsigned char **, size_t, int, int, int);
-static size_t add_upgrade(unsigned char **, size_t);
-static size_t add_if_modified(unsigned char **, size_t, struct connection *);
-static size_t add_range(unsigned char **, size_t, unsigned char *,
-                        struct connection *);
-static size_t add_pragma_no_cache(unsigned char **, size_t, int);
-static size_t add_proxy_auth_string(unsigned char **, size_t, unsigned char *);
-static size_t add_auth_string(unsigned char **, size_t, unsigned char *);
-static size_t add_post_header(unsigned char **, size_t, unsigned char **);
-static size_t add_extra_options(unsigned char **, size_t);
+static void add_user_agent(struct string_buf *, const char *);
+static void add_referer(struct string_buf *, unsigned char *, unsigned char *);
+static void add_accept(struct string_buf *);
+static void add_accept_encoding(struct string_buf *, unsigned char *,
+                                struct connection *);
+static void add_accept_charset(struct string_buf *,
+                               struct http_connection_info *);
+static void add_connection(struct string_buf *, int, int, int);
+static void add_upgrade(struct string_buf *);
+static void add_if_modified(struct string_buf *, struct connection *);
+static void add_range(struct string_buf *, unsigned char *,
+                      struct connection *);
+static void add_pragma_no_cache(struct string_buf *, int);
+static void add_proxy_auth_string(struct string_buf *, unsigned char *);
+static void add_auth_string(struct string_buf *, unsigned char *);
+static void add_post_header(struct string_buf *, unsigned char **);
+static void add_extra_options(struct string_buf *);
 
 /* Returns a string pointer with value of the item.
  * The string must be destroyed after usage with mem_free.
@@ -182,10 +202,140 @@ check_http_server_bugs(unsigned char *url, struct http_connection_info *info,
 	return 0;
 }
 
+void
+allow_post_file(unsigned char *name)
+{
+	struct post_file_name *pf = NULL;
+	struct list_head *lpf;
+	size_t sl;
+	foreach (struct post_file_name, pf, lpf, post_file_names)
+		if (!strcmp(cast_const_char pf->name, cast_const_char name))
+			return;
+	sl = strlen(cast_const_char name);
+	if (sl > INT_MAX - sizeof(struct post_file_name))
+		overalloc();
+	pf = xmalloc(sizeof(struct post_file_name) + sl);
+	strcpy(cast_char pf->name, cast_const_char name);
+	add_to_list(post_file_names, pf);
+}
+
+void
+free_post_file_names(void)
+{
+	free_list(struct post_file_name, post_file_names);
+}
+
+static int
+post_file_allowed(unsigned char *name)
+{
+	struct post_file_name *pf = NULL;
+	struct list_head *lpf;
+	foreach (struct post_file_name, pf, lpf, post_file_names)
+		if (!strcmp(cast_const_char pf->name, cast_const_char name))
+			return 1;
+	return 0;
+}
+
+static int
+hex_value(unsigned char c)
+{
+	int h = c <= '9'   ? (unsigned)c - '0'
+	        : c >= 'A' ? upcase(c) - 'A' + 10
+	                   : 0;
+	if (h < 0 || h >= 16)
+		h = 0;
+	return h;
+}
+
+/* Parse a file reference in POST data (see POST_FILE_START) and return the
+ * position after it, or NULL if it is malformed. */
+static unsigned char *
+parse_post_file(unsigned char *post, unsigned char **name, off_t *size,
+                time_t *mtime)
+{
+	unsigned char *end;
+	size_t l = 0;
+	if (name)
+		*name = NULL;
+	for (post++; post[0] && post[0] != ':' && post[1]; post += 2)
+		if (name)
+			l = add_chr_to_str(name, l,
+			                   hex_value(post[0]) * 16
+			                       + hex_value(post[1]));
+	if (*post != ':')
+		goto bad;
+	errno = 0;
+	*size = (off_t)strtoll(cast_const_char(post + 1), (char **)&end, 10);
+	if (errno || *size < 0 || end == post + 1 || *end != ':')
+		goto bad;
+	post = end + 1;
+	*mtime = (time_t)strtoll(cast_const_char post, (char **)&end, 10);
+	if (end == post || *end != POST_FILE_END)
+		goto bad;
+	return end + 1;
+bad:
+	if (name) {
+		free(*name);
+		*name = NULL;
+	}
+	return NULL;
+}
+
+static off_t
+post_length(unsigned char *post)
+{
+	off_t l = 0, size;
+	time_t mtime;
+	while (*post) {
+		if (*post == POST_FILE_START) {
+			if (!(post = parse_post_file(post, NULL, &size, &mtime)))
+				return -1;
+			l += size;
+		} else if (post[1]) {
+			l++;
+			post += 2;
+		} else
+			break;
+	}
+	return l;
+}
+
+/* Decode the POST data up to the next file reference */
+static void
+add_post_data(struct string_buf *s, unsigned char **post)
+{
+	unsigned char *p = *post;
+	while (p[0] && p[0] != POST_FILE_START && p[1]) {
+		add_chr_to_buf(s, hex_value(p[0]) * 16 + hex_value(p[1]));
+		p += 2;
+	}
+	if (*p != POST_FILE_START)
+		p += strlen(cast_const_char p);
+	*post = p;
+}
+
+static void
+http_end_sink(struct connection *c)
+{
+	struct http_connection_info *info = c->info;
+	http_end_request(c, info->end_notrunc, info->end_nokeepalive,
+	                 info->end_state);
+}
+
 static void
 http_end_request(struct connection *c, int notrunc, int nokeepalive, int state)
 {
 	struct http_connection_info *info = c->info;
+	if (c->sink_buf_len && info) {
+		/* the request is over when the sink has all of it */
+		info->end_notrunc = notrunc;
+		info->end_nokeepalive = nokeepalive;
+		info->end_state = state;
+		wait_for_sink(c, http_end_sink);
+		return;
+	}
+	if (state == S__OK && info && info->received)
+		perf_add(PERF_DOWNLOAD, get_time() - info->received);
 	if (state == S__OK && c->cache) {
 		if (!notrunc)
 			truncate_entry(c->cache, c->from, 1);
@@ -210,8 +360,11 @@ http_func(struct connection *c)
 			abort_connection(c);
 			return;
 		}
-		make_connection(c, p, &c->sock1, http_send_header);
-	} else
+		make_connection(c, p, &c->sock1,
+		                c->preconnect ? preconnected : http_send_header);
+	} else if (c->preconnect)
+		preconnected(c);
+	else
 		http_send_header(c);
 }
 
@@ -221,19 +374,18 @@ proxy_func(struct connection *c)
 	http_func(c);
 }
 
-static size_t
-add_url_to_str(unsigned char **str, size_t l, unsigned char *url)
+static void
+add_url_to_buf(struct string_buf *str, unsigned char *url)
 {
 	unsigned char *sp;
 	for (sp = url; *sp && *sp != POST_CHAR; sp++) {
 		if (*sp <= ' ' || *sp >= 127) {
 			unsigned char esc[4];
 			sprintf((char *)esc, "%%%02X", (int)*sp);
-			l = add_to_str(str, l, esc);
+			add_to_buf(str, esc);
 		} else
-			l = add_chr_to_str(str, l, *sp);
+			add_chr_to_buf(str, *sp);
 	}
-	return l;
 }
 
 static void
@@ -242,10 +394,10 @@ http_send_header(struct connection *c)
 	struct http_connection_info *info;
 	int http10 = http_options.http10;
 	int proxy;
-	unsigned char *hdr;
+	unsigned char stack[2048];
+	struct string_buf hdr;
 	unsigned char *h, *u;
 	unsigned char *u2;
-	size_t l = 0;
 	unsigned char *post = NULL;
 	unsigned char *host;
 
@@ -262,10 +414,10 @@ http_send_header(struct connection *c)
 	                      && !casecmp(host, cast_uchar "https://", 8);
 	if (c->ssl)
 		proxy = 0;
-	hdr = NULL;
+	init_buf(&hdr, stack, sizeof stack);
 	if (!host) {
 http_bad_url:
-		free(hdr);
+		free_buf(&hdr);
 		http_end_request(c, 0, 1, S_BAD_URL);
 		return;
 	}
@@ -283,27 +435,27 @@ http_bad_url:
 	}
 	info->send_close = info->https_forward || http10;
 	if (info->https_forward) {
-		l = add_to_str(&hdr, l, cast_uchar "CONNECT ");
+		add_to_buf(&hdr, cast_uchar "CONNECT ");
 		h = get_host_name(host);
 		if (!h)
 			goto http_bad_url;
-		l = add_to_str(&hdr, l, h);
+		add_to_buf(&hdr, h);
 		free(h);
 		h = get_port_str(host);
 		if (!h)
 			h = stracpy(cast_uchar "443");
-		l = add_chr_to_str(&hdr, l, ':');
-		l = add_to_str(&hdr, l, h);
+		add_chr_to_buf(&hdr, ':');
+		add_to_buf(&hdr, h);
 		free(h);
 		goto added_connect;
 	} else if (!post)
-		l = add_to_str(&hdr, l, cast_uchar "GET ");
+		add_to_buf(&hdr, cast_uchar "GET ");
 	else {
-		l = add_to_str(&hdr, l, cast_uchar "POST ");
+		add_to_buf(&hdr, cast_uchar "POST ");
 		c->unrestartable = 2;
 	}
 	if (!proxy) {
-		l = add_chr_to_str(&hdr, l, '/');
+		add_chr_to_buf(&hdr, '/');
 		u = get_url_data(host);
 	} else
 		u = host;
@@ -325,16 +477,16 @@ http_bad_url:
 		u2_len = add_to_str(&u2, u2_len, proxies.dns_append);
 		u2_len = add_to_str(&u2, u2_len, u_host + u_host_len);
 	}
-	l = add_url_to_str(&hdr, l, u2);
+	add_url_to_buf(&hdr, u2);
 	if (u2 != u)
 		free(u2);
 added_connect:
 	if (!http10)
-		l = add_to_str(&hdr, l, cast_uchar " HTTP/1.1\r\n");
+		add_to_buf(&hdr, cast_uchar " HTTP/1.1\r\n");
 	else
-		l = add_to_str(&hdr, l, cast_uchar " HTTP/1.0\r\n");
+		add_to_buf(&hdr, cast_uchar " HTTP/1.0\r\n");
 	if (!info->https_forward && (h = get_host_name(host))) {
-		l = add_to_str(&hdr, l, cast_uchar "Host: ");
+		add_to_buf(&hdr, cast_uchar "Host: ");
 		if (*h && h[strlen((char *)h) - 1] == '.') {
 			h[strlen((char *)h) - 1] = 0;
 		}
@@ -345,60 +497,135 @@ added_connect:
 				pc[1] = 0;
 			}
 		}
-		l = add_to_str(&hdr, l, h);
+		add_to_buf(&hdr, h);
 		free(h);
 		if ((h = get_port_str(host))) {
 			if (strcmp(cast_char h, c->ssl ? "443" : "80")) {
-				l = add_chr_to_str(&hdr, l, ':');
-				l = add_to_str(&hdr, l, h);
+				add_chr_to_buf(&hdr, ':');
+				add_to_buf(&hdr, h);
 			}
 			free(h);
 		}
-		l = add_to_str(&hdr, l, cast_uchar "\r\n");
+		add_to_buf(&hdr, cast_uchar "\r\n");
 	}
-	l = add_user_agent(&hdr, l,
-	                   info->https_forward ? NULL : cast_char host);
+	add_user_agent(&hdr, info->https_forward ? NULL : cast_char host);
 	if (proxy)
-		l = add_proxy_auth_string(&hdr, l, c->url);
+		add_proxy_auth_string(&hdr, c->url);
 	if (!info->https_forward) {
 		test_restart(c);
-		l = add_referer(&hdr, l, host, c->prev_url);
-		l = add_accept(&hdr, l);
-		l = add_accept_encoding(&hdr, l, host, c);
-		l = add_accept_charset(&hdr, l, info);
-		l = add_connection(&hdr, l, http10, proxy, !info->send_close);
-		l = add_upgrade(&hdr, l);
-		l = add_if_modified(&hdr, l, c);
-		l = add_range(&hdr, l, host, c);
-		l = add_pragma_no_cache(&hdr, l, c->no_cache);
-		l = add_auth_string(&hdr, l, host);
-		l = add_post_header(&hdr, l, &post);
-		l = add_cookies(&hdr, l, host);
-		l = add_extra_options(&hdr, l);
-	}
-	l = add_to_str(&hdr, l, cast_uchar "\r\n");
+		add_referer(&hdr, host, c->prev_url);
+		add_accept(&hdr);
+		add_accept_encoding(&hdr, host, c);
+		add_accept_charset(&hdr, info);
+		add_connection(&hdr, http10, proxy, !info->send_close);
+		add_upgrade(&hdr);
+		add_if_modified(&hdr, c);
+		add_range(&hdr, host, c);
+		add_pragma_no_cache(&hdr, c->no_cache);
+		add_auth_string(&hdr, host);
+		add_post_header(&hdr, &post);
+		add_cookies(&hdr, host);
+		add_extra_options(&hdr);
+	}
+	add_to_buf(&hdr, cast_uchar "\r\n");
 	if (post) {
-		while (post[0] && post[1]) {
-			int h1, h2;
-			h1 = post[0] <= '9'   ? (unsigned)post[0] - '0'
-			     : post[0] >= 'A' ? upcase(post[0]) - 'A' + 10
-			                      : 0;
-			if (h1 < 0 || h1 >= 16)
-				h1 = 0;
-			h2 = post[1] <= '9'   ? (unsigned)post[1] - '0'
-			     : post[1] >= 'A' ? upcase(post[1]) - 'A' + 10
-			                      : 0;
-			if (h2 < 0 || h2 >= 16)
-				h2 = 0;
-			l = add_chr_to_str(&hdr, l, h1 * 16 + h2);
-			post += 2;
+		size_t hl = hdr.l;
+		if (post_length(post) < 0)
+			goto http_bad_url;
+		info->post = post;
+		add_post_data(&hdr, &info->post);
+		if (*info->post) {
+			c->prg.size = post_length(post);
+			c->prg.pos = hdr.l - hl;
 		}
 	}
-	write_to_socket(c, c->sock1, hdr, l, http_get_header);
-	free(hdr);
+	write_to_socket(c, c->sock1, hdr.s, hdr.l, http_send_post);
+	free_buf(&hdr);
 	setcstate(c, S_SENT);
 }
 
+/* Stream the files in the POST data from the disk, one block at a time,
+ * each after the previous one has been written to the socket. */
+static void
+http_send_post(struct connection *c)
+{
+	struct http_connection_info *info = c->info;
+	unsigned char *data = NULL;
+	struct string_buf b;
+	init_buf(&b, NULL, 0);
+	while (info->post && *info->post) {
+		if (*info->post == POST_FILE_START) {
+			unsigned char *name, *end;
+			off_t size;
+			time_t mtime;
+			int rd;
+			if (c->sock2 == -1) {
+				struct stat st;
+				int rs;
+				end = parse_post_file(info->post, &name, &size,
+				                      &mtime);
+				if (!end || !post_file_allowed(name)) {
+					free(name);
+					setcstate(c, S_BAD_URL);
+					abort_connection(c);
+					return;
+				}
+				c->sock2 = c_open(name, O_RDONLY | O_NOCTTY);
+				free(name);
+				if (c->sock2 == -1) {
+					setcstate(c, get_error_from_errno(errno));
+					abort_connection(c);
+					return;
+				}
+				EINTRLOOP(rs, fstat(c->sock2, &st));
+				if (rs || st.st_size != size
+				    || st.st_mtime != mtime) {
+					setcstate(c, S_MODIFIED);
+					abort_connection(c);
+					return;
+				}
+				info->post_left = size;
+			}
+			if (info->post_left) {
+				data = xmalloc(POST_BLOCK);
+				rd = hard_read(c->sock2, data,
+				               info->post_left < POST_BLOCK
+				                   ? (int)info->post_left
+				                   : POST_BLOCK);
+				if (rd <= 0) {
+					free(data);
+					setcstate(c, rd ? get_error_from_errno(errno)
+					                : S_MODIFIED);
+					abort_connection(c);
+					return;
+				}
+				info->post_left -= rd;
+				c->prg.pos += rd;
+				write_to_socket(c, c->sock1, data, rd,
+				                http_send_post);
+				free(data);
+				setcstate(c, S_SENDING);
+				return;
+			}
+			close_socket(&c->sock2);
+			info->post = cast_uchar strchr(cast_const_char info->post,
+			                               POST_FILE_END)
+			             + 1;
+		}
+		add_post_data(&b, &info->post);
+		if (b.l) {
+			c->prg.pos += b.l;
+			write_to_socket(c, c->sock1, b.s, (int)b.l,
+			                http_send_post);
+			free_buf(&b);
+			return;
+		}
+	}
+	if (c->state == S_SENDING)
+		setcstate(c, S_SENT);
+	http_get_header(c);
+}
+
 static void
 test_restart(struct connection *c)
 {
@@ -424,15 +651,14 @@ test_restart(struct connection *c)
 	}
 }
 
-static size_t
-add_user_agent(unsigned char **hdr, size_t l, const char *url)
+static void
+add_user_agent(struct string_buf *hdr, const char *url)
 {
-	l = add_to_str(hdr, l, cast_uchar "User-Agent: ");
+	add_to_buf(hdr, cast_uchar "User-Agent: ");
 	if (SCRUB_HEADERS)
-		l = add_to_str(hdr, l,
-		               cast_uchar
-		               "Mozilla/5.0 (Windows NT 6.1; rv:60.0) "
-		               "Gecko/20100101 Firefox/60.0\r\n");
+		add_to_buf(hdr, cast_uchar
+		           "Mozilla/5.0 (Windows NT 6.1; rv:60.0) "
+		           "Gecko/20100101 Firefox/60.0\r\n");
 	else if (!(*http_options.header.fake_useragent)) {
 		/*
 		 * Google started to return css-styled page for searches.
@@ -444,44 +670,42 @@ add_user_agent(unsigned char **hdr, size_t l, const char *url)
 		    && strstr(url, "/search?")
 		    && (strstr(url, "?q=") || strstr(url, "&q="))
 		    && !strstr(url, "?tbm=isch") && !strstr(url, "&tbm=isch"))
-			l = add_to_str(hdr, l, cast_uchar("Lynx/"));
+			add_to_buf(hdr, cast_uchar("Lynx/"));
 
-		l = add_to_str(hdr, l, cast_uchar("Links (" VERSION "; "));
-		l = add_to_str(hdr, l, system_name);
-		l = add_to_str(hdr, l, cast_uchar "; ");
+		add_to_buf(hdr, cast_uchar("Links (" VERSION "; "));
+		add_to_buf(hdr, system_name);
+		add_to_buf(hdr, cast_uchar "; ");
 		if (!list_empty(terminals)) {
 			unsigned char *t = cast_uchar "text";
-			l = add_to_str(hdr, l, t);
+			add_to_buf(hdr, t);
 		} else {
-			l = add_to_str(hdr, l, cast_uchar "dump");
+			add_to_buf(hdr, cast_uchar "dump");
 		}
-		l = add_to_str(hdr, l, cast_uchar ")\r\n");
+		add_to_buf(hdr, cast_uchar ")\r\n");
 	} else {
-		l = add_to_str(hdr, l, http_options.header.fake_useragent);
-		l = add_to_str(hdr, l, cast_uchar "\r\n");
+		add_to_buf(hdr, http_options.header.fake_useragent);
+		add_to_buf(hdr, cast_uchar "\r\n");
 	}
-	return l;
 }
 
-static size_t
-add_referer(unsigned char **hdr, size_t l, unsigned char *url,
-            unsigned char *prev_url)
+static void
+add_referer(struct string_buf *hdr, unsigned char *url, unsigned char *prev_url)
 {
-	l = add_to_str(hdr, l, cast_uchar "Referer: ");
-	l = add_url_to_str(hdr, l, url);
-	return add_to_str(hdr, l, cast_uchar "\r\n");
+	add_to_buf(hdr, cast_uchar "Referer: ");
+	add_url_to_buf(hdr, url);
+	add_to_buf(hdr, cast_uchar "\r\n");
 }
 
-static size_t
-add_accept(unsigned char **hdr, size_t l)
+static void
+add_accept(struct string_buf *hdr)
 {
 	if (SCRUB_HEADERS)
-		return add_to_str(hdr, l,
-		                  cast_uchar
-		                  "Accept: "
-		                  "text/html,application/xhtml+xml,application/"
-		                  "xml;q=0.9,*/*;q=0.8\r\n");
-	return add_to_str(hdr, l, cast_uchar "Accept: */*\r\n");
+		add_to_buf(hdr, cast_uchar
+		           "Accept: "
+		           "text/html,application/xhtml+xml,application/"
+		           "xml;q=0.9,*/*;q=0.8\r\n");
+	else
+		add_to_buf(hdr, cast_uchar "Accept: */*\r\n");
 }
 
 static int
@@ -504,34 +728,31 @@ advertise_compression(unsigned char *url, struct connection *c)
 	return 1;
 }
 
-static size_t
-add_accept_encoding(unsigned char **hdr, size_t l, unsigned char *url,
+static void
+add_accept_encoding(struct string_buf *hdr, unsigned char *url,
                     struct connection *c)
 {
 	if (advertise_compression(url, c)) {
-		size_t orig_l = l;
+		size_t orig_l = hdr->l;
 		size_t l1;
-		l = add_to_str(hdr, l, cast_uchar "Accept-Encoding: ");
-		l1 = l;
-		l = add_to_str(hdr, l, cast_uchar "gzip, deflate");
-		if (l != l1)
-			l = add_to_str(hdr, l, cast_uchar "\r\n");
+		add_to_buf(hdr, cast_uchar "Accept-Encoding: ");
+		l1 = hdr->l;
+		add_to_buf(hdr, cast_uchar "gzip, deflate");
+		if (hdr->l != l1)
+			add_to_buf(hdr, cast_uchar "\r\n");
 		else
-			l = orig_l;
+			hdr->s[hdr->l = orig_l] = 0;
 	}
-
-	return l;
 }
 
-static size_t
-add_accept_charset(unsigned char **hdr, size_t l,
-                   struct http_connection_info *info)
+static void
+add_accept_charset(struct string_buf *hdr, struct http_connection_info *info)
 {
 	static unsigned char *accept_charset = NULL;
 
 	if (SCRUB_HEADERS || info->bl_flags & BL_NO_CHARSET
 	    || http_options.no_accept_charset)
-		return l;
+		return;
 
 	if (!accept_charset) {
 		unsigned char *cs, *ac;
@@ -547,48 +768,45 @@ add_accept_charset(unsigned char **hdr, size_t l,
 		if (aclen)
 			aclen = add_to_str(&ac, aclen, cast_uchar "\r\n");
 		if (!(accept_charset = cast_uchar strdup((char *)ac))) {
-			l = add_to_str(hdr, l, ac);
+			add_to_buf(hdr, ac);
 			free(ac);
-			return l;
+			return;
 		}
 		free(ac);
 	}
-	return add_to_str(hdr, l, accept_charset);
+	add_to_buf(hdr, accept_charset);
 }
 
-static size_t
-add_connection(unsigned char **hdr, size_t l, int http10, int proxy, int alive)
+static void
+add_connection(struct string_buf *hdr, int http10, int proxy, int alive)
 {
 	if (!http10) {
 		if (!proxy)
-			l = add_to_str(hdr, l, cast_uchar "Connection: ");
+			add_to_buf(hdr, cast_uchar "Connection: ");
 		else
-			l = add_to_str(hdr, l, cast_uchar "Proxy-Connection: ");
+			add_to_buf(hdr, cast_uchar "Proxy-Connection: ");
 		if (alive)
-			l = add_to_str(hdr, l, cast_uchar "keep-alive\r\n");
+			add_to_buf(hdr, cast_uchar "keep-alive\r\n");
 		else
-			l = add_to_str(hdr, l, cast_uchar "close\r\n");
+			add_to_buf(hdr, cast_uchar "close\r\n");
 	}
-	return l;
 }
 
-static size_t
-add_upgrade(unsigned char **hdr, size_t l)
+static void
+add_upgrade(struct string_buf *hdr)
 {
 	if (proxies.only_proxies)
-		return add_to_str(
-		    hdr, l, cast_uchar "Upgrade-Insecure-Requests: 1\r\n");
-	return l;
+		add_to_buf(hdr, cast_uchar "Upgrade-Insecure-Requests: 1\r\n");
 }
 
-static size_t
-add_if_modified(unsigned char **hdr, size_t l, struct connection *c)
+static void
+add_if_modified(struct string_buf *hdr, struct connection *c)
 {
 	struct cache_entry *e;
 	if ((e = c->cache)) {
 		int code = 0;
 		if (get_http_code(e->head, &code, NULL) || code >= 400)
-			return l;
+			return;
 		if (!e->incomplete && e->head && c->no_cache <= NC_IF_MOD) {
 			unsigned char *m;
 			if (e->last_modified)
@@ -600,91 +818,84 @@ add_if_modified(unsigned char **hdr, size_t l, struct connection *c)
 				      e->head, cast_uchar "Expires", NULL)))
 				;
 			else
-				return l;
-			l = add_to_str(hdr, l,
-			               cast_uchar "If-Modified-Since: ");
-			l = add_to_str(hdr, l, m);
-			l = add_to_str(hdr, l, cast_uchar "\r\n");
+				return;
+			add_to_buf(hdr, cast_uchar "If-Modified-Since: ");
+			add_to_buf(hdr, m);
+			add_to_buf(hdr, cast_uchar "\r\n");
 			free(m);
 		}
 	}
-
-	return l;
 }
 
-static size_t
-add_range(unsigned char **hdr, size_t l, unsigned char *url,
-          struct connection *c)
+static void
+add_range(struct string_buf *hdr, unsigned char *url, struct connection *c)
 {
 	struct cache_entry *e;
 	struct http_connection_info *info = c->info;
 	if ((e = c->cache)) {
 		int code = 0;
 		if (!get_http_code(e->head, &code, NULL) && code >= 300)
-			return l;
+			return;
 	}
 	if (c->from && c->no_cache < NC_IF_MOD
 	    && !(info->bl_flags & BL_NO_RANGE)) {
-		l = add_to_str(hdr, l, cast_uchar "Range: bytes=");
-		l = add_num_to_str(hdr, l, c->from);
-		l = add_to_str(hdr, l, cast_uchar "-\r\n");
+		add_to_buf(hdr, cast_uchar "Range: bytes=");
+		add_num_to_buf(hdr, c->from);
+		add_chr_to_buf(hdr, '-');
+		if (c->range_end > c->from)
+			add_num_to_buf(hdr, c->range_end - 1);
+		add_to_buf(hdr, cast_uchar "\r\n");
 	}
-	return l;
 }
 
-static size_t
-add_pragma_no_cache(unsigned char **hdr, size_t l, int no_cache)
+static void
+add_pragma_no_cache(struct string_buf *hdr, int no_cache)
 {
 	if (no_cache >= NC_PR_NO_CACHE)
-		return add_to_str(
-		    hdr, l,
-		    cast_uchar
-		    "Pragma: no-cache\r\nCache-Control: no-cache\r\n");
-	return l;
+		add_to_buf(hdr, cast_uchar "Pragma: no-cache\r\n"
+		                           "Cache-Control: no-cache\r\n");
 }
 
-static size_t
-add_proxy_auth_string(unsigned char **hdr, size_t l, unsigned char *url)
+static void
+add_proxy_auth_string(struct string_buf *hdr, unsigned char *url)
 {
 	unsigned char *h;
 	if ((h = get_auth_string(url, 1))) {
-		l = add_to_str(hdr, l, h);
+		add_to_buf(hdr, h);
 		free(h);
 	}
-	return l;
 }
 
-static size_t
-add_auth_string(unsigned char **hdr, size_t l, unsigned char *url)
+static void
+add_auth_string(struct string_buf *hdr, unsigned char *url)
 {
 	unsigned char *h;
 	if ((h = get_auth_string(url, 0))) {
-		l = add_to_str(hdr, l, h);
+		add_to_buf(hdr, h);
 		free(h);
 	}
-	return l;
 }
 
-static size_t
-add_post_header(unsigned char **hdr, size_t l, unsigned char **post)
+static void
+add_post_header(struct string_buf *hdr, unsigned char **post)
 {
 	if (!*post)
-		return l;
+		return;
 
 	unsigned char *pd = cast_uchar strchr((char *)*post, '\n');
 	if (pd) {
-		l = add_to_str(hdr, l, cast_uchar "Content-Type: ");
-		l = add_bytes_to_str(hdr, l, *post, pd - *post);
-		l = add_to_str(hdr, l, cast_uchar "\r\n");
+		add_to_buf(hdr, cast_uchar "Content-Type: ");
+		add_bytes_to_buf(hdr, *post, pd - *post);
+		add_to_buf(hdr, cast_uchar "\r\n");
 		*post = pd + 1;
 	}
-	l = add_to_str(hdr, l, cast_uchar "Content-Length: ");
-	l = add_num_to_str(hdr, l, strlen((char *)*post) / 2);
-	return add_to_str(hdr, l, cast_uchar "\r\n");
+	add_to_buf(hdr, cast_uchar "Content-Length: ");
+	add_num_to_buf(hdr, post_length(*post));
+	add_to_buf(hdr, cast_uchar "\r\n");
 }
 
-static size_t
-add_extra_options(unsigned char **hdr, size_t l)
+static void
+add_extra_options(struct string_buf *hdr)
 {
 	unsigned char *p = http_options.header.extra_header;
 	while (1) {
@@ -697,29 +908,24 @@ add_extra_options(unsigned char **hdr, size_t l)
 				unsigned char *v = NULL;
 				unsigned char *cc = memacpy(s, c - s);
 				unsigned char *x =
-				    parse_http_header(*hdr, cc, &v);
+				    parse_http_header(hdr->s, cc, &v);
 				free(cc);
 				if (x) {
-					unsigned char *new_hdr;
-					size_t new_l;
+					unsigned char *rest;
 					free(x);
-					new_hdr = NULL;
-					new_l = add_bytes_to_str(
-					    &new_hdr, 0, *hdr, v - *hdr);
+					rest = stracpy(
+					    v + strcspn((char *)v, "\r\n"));
+					hdr->l = v - hdr->s;
 					while (*++c == ' ')
 						;
-					new_l = add_to_str(&new_hdr, new_l, c);
-					new_l = add_to_str(
-					    &new_hdr, new_l,
-					    v + strcspn((char *)v, "\r\n"));
-					free(*hdr);
-					*hdr = new_hdr;
-					l = new_l;
+					add_to_buf(hdr, c);
+					add_to_buf(hdr, rest);
+					free(rest);
 					goto already_added;
 				}
 			}
-			l = add_to_str(hdr, l, s);
-			l = add_to_str(hdr, l, cast_uchar "\r\n");
+			add_to_buf(hdr, s);
+			add_to_buf(hdr, cast_uchar "\r\n");
 already_added:
 			free(s);
 		}
@@ -727,8 +933,6 @@ already_added:
 			break;
 		p = q + 1;
 	}
-
-	return l;
 }
 
 static int
@@ -749,6 +953,32 @@ is_line_in_buffer(struct read_buffer *rb)
 	return 0;
 }
 
+/* Store body data in the sink of the connection or in the cache. Data the
+ * sink already has (the server restarted without a range) are skipped. If
+ * the sink fails, it is dropped and the data go to the cache, so that the
+ * user can deal with the error. */
+static int
+http_store_data(struct connection *c, unsigned char *data, int l)
+{
+	off_t skip;
+	int a;
+	if (c->sink == -1)
+		return add_fragment(c->cache, c->from, data, l);
+	skip = *c->sink_pos + c->sink_buf_len - c->from;
+	if (skip >= l)
+		return 0;
+	if (skip < 0)
+		skip = 0;
+	if (!write_to_sink(c, data + skip, l - (int)skip))
+		return 1;
+	/* it took everything before *c->sink_pos */
+	skip = *c->sink_pos - c->from;
+	if ((a = drop_connection_sink(c)) < 0)
+		return a;
+	return add_fragment(c->cache, c->from + skip, data + skip,
+	                    l - (int)skip);
+}
+
 static void
 read_http_data(struct connection *c, struct read_buffer *rb)
 {
@@ -760,7 +990,17 @@ read_http_data(struct connection *c, struct read_buffer *rb)
 		return;
 	}
 	if (info->length != -2) {
-		int l = rb->len;
+		int l;
+		if (rb->spliced) {
+			c->received += rb->spliced;
+			c->from += rb->spliced;
+			*c->sink_pos += rb->spliced;
+			if (info->length >= 0)
+				info->length -= rb->spliced;
+			rb->spliced = 0;
+			c->tries = 0;
+		}
+		l = rb->len;
 		if (info->length >= 0 && info->length < l)
 			l = (int)info->length;
 		if ((off_t)(0UL + c->from + l) < 0) {
@@ -769,7 +1009,7 @@ read_http_data(struct connection *c, struct read_buffer *rb)
 			return;
 		}
 		c->received += l;
-		a = add_fragment(c->cache, c->from, rb->data, l);
+		a = http_store_data(c, rb->data, l);
 		if (a < 0) {
 			setcstate(c, a);
 			abort_connection(c);
@@ -831,7 +1071,7 @@ next_chunk:
 				return;
 			}
 			c->received += l;
-			a = add_fragment(c->cache, c->from, rb->data, l);
+			a = http_store_data(c, rb->data, l);
 			if (a < 0) {
 				setcstate(c, a);
 				abort_connection(c);
@@ -865,6 +1105,10 @@ next_chunk:
 		}
 	}
 read_more:
+	rb->splice = 0;
+	if (info->length != -2 && c->sink != -1 && !c->sink_no_splice
+	    && c->from == *c->sink_pos && !rb->len)
+		rb->splice = info->length;
 	read_from_socket(c, c->sock1, rb, read_http_data);
 	setcstate(c, S_TRANS);
 }
@@ -949,6 +1193,11 @@ again:
 		setcstate(c, state);
 		return;
 	}
+	if (info->sent) {
+		info->received = get_time();
+		perf_add(PERF_RESPONSE, info->received - info->sent);
+		info->sent = 0;
+	}
 	if (a != -2) {
 		head = memacpy(rb->data, a);
 		kill_buffer_data(rb, a);
@@ -1194,6 +1443,7 @@ again:
 		}
 		free(d);
 	}
+	e->expected_length = c->est_length > 0 ? c->est_length : 0;
 	if ((d = parse_http_header(e->head, cast_uchar "Accept-Ranges",
 	                           NULL))) {
 		if (!casestrcmp(d, cast_uchar "none") && !c->unrestartable)
@@ -1262,7 +1512,10 @@ static void
 http_get_header(struct connection *c)
 {
 	struct read_buffer *rb;
+	struct http_connection_info *info = c->info;
 	set_connection_timeout_keepal(c);
+	info->sent = get_time();
+	info->received = 0;
 	rb = alloc_read_buffer();
 	rb->close = 1;
 	read_from_socket(c, c->sock1, rb, http_got_header);
@@ -21,21 +21,53 @@
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
 #include <string.h>
+#include <sys/file.h>
 
 #include "links.h"
 
 static SSL_CTX *contexts = NULL;
 
+#define SC_HASH_SIZE 64
+
 struct session_cache_entry {
 	list_entry_1st;
+	struct session_cache_entry *hash_next;
 	uttime absolute_time;
 	SSL_CTX *ctx;
-	SSL_SESSION *session;
+	SSL_SESSION *session; /* NULL if it was dropped, see load_session_store */
 	int port;
 	char host;
 };
 
 static struct list_head session_cache = { &session_cache, &session_cache };
+static struct session_cache_entry *session_cache_hash[SC_HASH_SIZE];
+
+static int session_store_dirty = 0;
+
+/*
+ * Certificates that were verified recently. OpenSSL would check the whole
+ * chain again on every full handshake with the server; a leaf certificate
+ * that is on the list, identified by its SHA-256 digest, is accepted
+ * without that and the host name check is skipped for the host it was
+ * checked for. Entries expire after VERIFY_CACHE_TIMEOUT.
+ */
+#define VERIFY_CACHE_SIZE 64
+
+struct verify_cache_entry {
+	list_entry_1st;
+	uttime absolute_time;
+	unsigned char md[EVP_MAX_MD_SIZE];
+	char host[1];
+};
+
+static struct list_head verify_cache = { &verify_cache, &verify_cache };
+static int verify_cache_count = 0;
+
+static struct timer *ssl_preload_timer = NULL;
+
+static void load_session_store(SSL_CTX *ctx);
+static int ssl_new_session(SSL *s, SSL_SESSION *ses);
+static int ssl_verify_chain(X509_STORE_CTX *ctx, void *arg);
 
 static int
 ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
@@ -47,24 +79,57 @@ ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
 	return size;
 }
 
+/*
+ * Parsing the CA certificates takes tens of milliseconds. Rather than in
+ * the middle of the first handshake, the context is made while the first
+ * HTTPS connection waits for the TCP handshake, or when the browser has
+ * been idle for SSL_PRELOAD_TIME after startup.
+ */
+void
+ssl_preload(void)
+{
+	SSL_CTX *ctx;
+	const SSL_METHOD *m;
+
+	if (contexts)
+		return;
+	if (!(m = TLS_client_method()))
+		return;
+	contexts = ctx = SSL_CTX_new(m);
+	if (!ctx)
+		return;
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_default_verify_paths(ctx);
+	SSL_CTX_set_default_passwd_cb(ctx, ssl_password_callback);
+	SSL_CTX_set_session_cache_mode(
+	    ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, ssl_new_session);
+	SSL_CTX_set_cert_verify_callback(ctx, ssl_verify_chain, NULL);
+	load_session_store(ctx);
+}
+
+static void
+ssl_preload_fn(void *data)
+{
+	ssl_preload_timer = NULL;
+	ssl_preload();
+}
+
+void
+init_ssl(void)
+{
+	ssl_preload_timer = install_timer(SSL_PRELOAD_TIME, ssl_preload_fn,
+	                                  NULL);
+}
+
 links_ssl *
 getSSL(void)
 {
 	links_ssl *ssl;
 
-	if (!contexts) {
-		SSL_CTX *ctx;
-		const SSL_METHOD *m;
-
-		if (!(m = TLS_client_method()))
-			return NULL;
-		contexts = ctx = SSL_CTX_new(m);
-		if (!ctx)
-			return NULL;
-		SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
-		SSL_CTX_set_default_verify_paths(ctx);
-		SSL_CTX_set_default_passwd_cb(ctx, ssl_password_callback);
-	}
+	ssl_preload();
+	if (!contexts)
+		return NULL;
 	ssl = xmalloc(sizeof(links_ssl));
 	ssl->ctx = contexts;
 	ssl->ssl = SSL_new(ssl->ctx);
@@ -75,10 +140,24 @@ getSSL(void)
 	ssl->bytes_read = ssl->bytes_written = 0;
 	ssl->session_set = 0;
 	ssl->session_retrieved = 0;
+	ssl->early_data = 0;
+	ssl->new_ticket = 0;
 	ssl->ca = NULL;
+	SSL_set_app_data(ssl->ssl, ssl);
 	return ssl;
 }
 
+/* OpenSSL tells us about every new session or ticket; the sessions are
+ * picked up by retrieve_ssl_session */
+static int
+ssl_new_session(SSL *s, SSL_SESSION *ses)
+{
+	links_ssl *ssl = SSL_get_app_data(s);
+	if (ssl)
+		ssl->new_ticket = 1;
+	return 0;
+}
+
 void
 freeSSL(links_ssl *ssl)
 {
@@ -91,9 +170,23 @@ freeSSL(links_ssl *ssl)
 	free(ssl);
 }
 
+static void
+free_verify_cache_entry(struct verify_cache_entry *vce)
+{
+	del_from_list(vce);
+	free(vce);
+	verify_cache_count--;
+}
+
 void
 ssl_finish(void)
 {
+	if (ssl_preload_timer) {
+		kill_timer(ssl_preload_timer);
+		ssl_preload_timer = NULL;
+	}
+	free_list(struct verify_cache_entry, verify_cache);
+	verify_cache_count = 0;
 	SSL_CTX_free(contexts);
 	contexts = NULL;
 }
@@ -157,6 +250,67 @@ extract_ca(const char *str)
 	return (char *)o;
 }
 
+/* With host NULL any entry for the certificate will do */
+static struct verify_cache_entry *
+find_verify_cache_entry(X509 *cert, char *host)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned mdl;
+	uttime now = get_absolute_time();
+	struct verify_cache_entry *vce = NULL;
+	struct list_head *lvce;
+	if (list_empty(verify_cache))
+		return NULL;
+	if (X509_cmp_current_time(X509_get0_notAfter(cert)) <= 0)
+		return NULL;
+	if (!X509_digest(cert, EVP_sha256(), md, &mdl))
+		return NULL;
+	foreach (struct verify_cache_entry, vce, lvce, verify_cache) {
+		if (now - vce->absolute_time > VERIFY_CACHE_TIMEOUT) {
+			lvce = lvce->prev;
+			free_verify_cache_entry(vce);
+			continue;
+		}
+		if (!memcmp(vce->md, md, mdl)
+		    && (!host || !casestrcmp(cast_uchar vce->host,
+		                             cast_uchar host)))
+			return vce;
+	}
+	return NULL;
+}
+
+static void
+add_verify_cache_entry(X509 *cert, char *host)
+{
+	struct verify_cache_entry *vce;
+	size_t sl = strlen(host);
+	if (sl > INT_MAX - sizeof(struct verify_cache_entry))
+		return;
+	vce = mem_calloc(sizeof(struct verify_cache_entry) + sl);
+	if (!X509_digest(cert, EVP_sha256(), vce->md, NULL)) {
+		free(vce);
+		return;
+	}
+	vce->absolute_time = get_absolute_time();
+	strcpy(vce->host, host);
+	add_to_list(verify_cache, vce);
+	if (++verify_cache_count > VERIFY_CACHE_SIZE)
+		free_verify_cache_entry(list_struct(
+		    verify_cache.prev, struct verify_cache_entry));
+}
+
+/* Called by OpenSSL instead of X509_verify_cert for the server's chain */
+static int
+ssl_verify_chain(X509_STORE_CTX *ctx, void *arg)
+{
+	X509 *cert = X509_STORE_CTX_get0_cert(ctx);
+	if (cert && find_verify_cache_entry(cert, NULL)) {
+		X509_STORE_CTX_set_error(ctx, X509_V_OK);
+		return 1;
+	}
+	return X509_verify_cert(ctx);
+}
+
 int
 verify_ssl_certificate(links_ssl *ssl, unsigned char *host)
 {
@@ -173,7 +327,10 @@ verify_ssl_certificate(links_ssl *ssl, unsigned char *host)
 	if (!server_cert)
 		return S_INVALID_CERTIFICATE;
 
-	ret = verify_ssl_host_name(server_cert, (char *)host);
+	if (find_verify_cache_entry(server_cert, (char *)host))
+		ret = 0;
+	else if (!(ret = verify_ssl_host_name(server_cert, (char *)host)))
+		add_verify_cache_entry(server_cert, (char *)host);
 	if (!ret) {
 		STACK_OF(X509) *certs = SSL_get_peer_cert_chain(ssl->ssl);
 		if (certs) {
@@ -266,17 +423,40 @@ get_cipher_string(links_ssl *ssl)
 	return s;
 }
 
+static int
+session_hash(char *host, int port)
+{
+	unsigned h = port;
+	while (*host)
+		h = h * 31 + (unsigned char)*host++;
+	return h & (SC_HASH_SIZE - 1);
+}
+
 static struct session_cache_entry *
 find_session_cache_entry(SSL_CTX *ctx, char *host, int port)
 {
-	struct session_cache_entry *sce = NULL;
-	struct list_head *lsce;
-	foreach (struct session_cache_entry, sce, lsce, session_cache)
-		if (sce->ctx == ctx && !strcmp(&sce->host, host))
+	struct session_cache_entry *sce;
+	for (sce = session_cache_hash[session_hash(host, port)]; sce;
+	     sce = sce->hash_next)
+		if (sce->ctx == ctx && sce->port == port
+		    && !strcmp(&sce->host, host))
 			return sce;
 	return NULL;
 }
 
+static void
+free_session_cache_entry(struct session_cache_entry *sce)
+{
+	struct session_cache_entry **p =
+	    &session_cache_hash[session_hash(&sce->host, sce->port)];
+	while (*p != sce)
+		p = &(*p)->hash_next;
+	*p = sce->hash_next;
+	del_from_list(sce);
+	SSL_SESSION_free(sce->session);
+	free(sce);
+}
+
 SSL_SESSION *
 get_session_cache_entry(SSL_CTX *ctx, unsigned char *host, int port)
 {
@@ -290,33 +470,224 @@ get_session_cache_entry(SSL_CTX *ctx, unsigned char *host, int port)
 }
 
 static void
-set_session_cache_entry(SSL_CTX *ctx, char *host, int port, SSL_SESSION *s)
+add_session_cache_entry(SSL_CTX *ctx, char *host, int port, SSL_SESSION *s,
+                        uttime t)
 {
 	struct session_cache_entry *sce =
 	    find_session_cache_entry(ctx, host, port);
 	size_t sl;
+	int h;
 	if (sce) {
 		SSL_SESSION_free(sce->session);
-		if (s)
-			sce->session = s;
-		else {
-			del_from_list(sce);
-			free(sce);
-		}
+		sce->session = s;
+		sce->absolute_time = t;
+		del_from_list(sce);
+		add_to_list(session_cache, sce);
 		return;
 	}
-	if (!s)
-		return;
 	sl = strlen(host);
-	if (sl > INT_MAX - sizeof(struct session_cache_entry))
+	if (sl > INT_MAX - sizeof(struct session_cache_entry)) {
+		SSL_SESSION_free(s);
 		return;
+	}
 	sce = xmalloc(sizeof(struct session_cache_entry) + sl);
-	sce->absolute_time = get_absolute_time();
+	sce->absolute_time = t;
 	sce->ctx = ctx;
 	sce->session = s;
 	sce->port = port;
 	strcpy(&sce->host, host);
 	add_to_list(session_cache, sce);
+	h = session_hash(host, port);
+	sce->hash_next = session_cache_hash[h];
+	session_cache_hash[h] = sce;
+}
+
+static void
+set_session_cache_entry(SSL_CTX *ctx, char *host, int port, SSL_SESSION *s)
+{
+	struct session_cache_entry *sce;
+	if (s)
+		add_session_cache_entry(ctx, host, port, s,
+		                        get_absolute_time());
+	else if ((sce = find_session_cache_entry(ctx, host, port))
+	         && sce->session) {
+		SSL_SESSION_free(sce->session);
+		sce->session = NULL;
+	} else
+		return;
+	session_store_dirty = 1;
+}
+
+/* A ticket whose early data could be replayed is used only once */
+void
+drop_session_cache_entry(SSL_CTX *ctx, unsigned char *host, int port)
+{
+	set_session_cache_entry(ctx, (char *)host, port, NULL);
+}
+
+/*
+ * The session store keeps the sessions in links_home, so that a new
+ * process can resume the TLS sessions of the previous ones instead of
+ * doing a full handshake. Each line is "host port time session", the time
+ * is the absolute time in milliseconds when the session was made and the
+ * session is DER encoded in hex. The file is replaced by a rename, so the
+ * processes that read it never see it half written, and the processes that
+ * write it take turns by locking links.tls.lock.
+ */
+
+static unsigned char *
+session_store_name(void)
+{
+	unsigned char *name;
+	if (!ssl_options.session_store || anonymous || proxies.only_proxies
+	    || !links_home)
+		return NULL;
+	name = stracpy(links_home);
+	add_to_strn(&name, cast_uchar "links.tls");
+	return name;
+}
+
+/* Returns the locked file or -1, in which case the store is written
+ * without the lock. */
+static int
+lock_session_store(unsigned char *name)
+{
+	unsigned char *lock_name = stracpy(name);
+	int h, rs;
+	add_to_strn(&lock_name, cast_uchar ".lock");
+	h = c_open3(lock_name, O_RDWR | O_CREAT | O_NOCTTY, 0600);
+	free(lock_name);
+	if (h == -1)
+		return -1;
+	EINTRLOOP(rs, flock(h, LOCK_EX));
+	if (rs) {
+		EINTRLOOP(rs, close(h));
+		return -1;
+	}
+	return h;
+}
+
+static int
+unhex(unsigned char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static SSL_SESSION *
+decode_session(unsigned char *hex)
+{
+	size_t i, l = strlen(cast_const_char hex) / 2;
+	unsigned char *der = xmalloc(l + !l);
+	const unsigned char *d = der;
+	SSL_SESSION *s = NULL;
+	for (i = 0; i < l; i++) {
+		int hi = unhex(hex[2 * i]), lo = unhex(hex[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			goto ret;
+		der[i] = hi << 4 | lo;
+	}
+	if (hex[2 * l])
+		goto ret;
+	if ((s = d2i_SSL_SESSION(NULL, &d, l)) && !SSL_SESSION_is_resumable(s)) {
+		SSL_SESSION_free(s);
+		s = NULL;
+	}
+ret:
+	free(der);
+	return s;
+}
+
+/* Read the sessions that other processes saved. They replace ours only when
+ * they are newer; a session we dropped is kept as an entry without one, so
+ * that it is not read back. */
+static void
+load_session_store(SSL_CTX *ctx)
+{
+	unsigned char *name, *data, *p;
+	uttime now = get_absolute_time();
+	name = session_store_name();
+	if (!name)
+		return;
+	data = read_config_file(name);
+	free(name);
+	if (!data)
+		return;
+	for (p = data; *p;) {
+		char *host = cast_char p, *e;
+		struct session_cache_entry *sce;
+		SSL_SESSION *s;
+		long port;
+		uttime t;
+		p += strcspn(cast_const_char p, "\n");
+		if (*p)
+			*p++ = 0;
+		if (!(e = strchr(host, ' ')))
+			continue;
+		*e++ = 0;
+		port = strtol(e, &e, 10);
+		if (*e++ != ' ' || port <= 0 || port > 65535)
+			continue;
+		t = strtoull(e, &e, 10);
+		if (*e++ != ' ' || now - t > SESSION_TIMEOUT)
+			continue;
+		sce = find_session_cache_entry(ctx, host, port);
+		if (sce && sce->absolute_time >= t)
+			continue;
+		if ((s = decode_session(cast_uchar e)))
+			add_session_cache_entry(ctx, host, port, s, t);
+	}
+	free(data);
+}
+
+static void
+save_session_store(void)
+{
+	static const char hex[] = "0123456789abcdef";
+	struct session_cache_entry *sce = NULL;
+	struct list_head *lsce;
+	struct string_buf b;
+	unsigned char *name;
+	uttime now = get_absolute_time();
+	int lock, rs;
+	session_store_dirty = 0;
+	if (!contexts || !(name = session_store_name()))
+		return;
+	lock = lock_session_store(name);
+	load_session_store(contexts);
+	init_buf(&b, NULL, 0);
+	foreachback (struct session_cache_entry, sce, lsce, session_cache) {
+		unsigned char *der, *d;
+		int i, l;
+		if (sce->ctx != contexts || !sce->session
+		    || now - sce->absolute_time > SESSION_TIMEOUT
+		    || strpbrk(&sce->host, " \t\r\n")
+		    || (l = i2d_SSL_SESSION(sce->session, NULL)) <= 0)
+			continue;
+		d = der = xmalloc(l);
+		i2d_SSL_SESSION(sce->session, &d);
+		add_to_buf(&b, cast_uchar &sce->host);
+		add_chr_to_buf(&b, ' ');
+		add_num_to_buf(&b, sce->port);
+		add_chr_to_buf(&b, ' ');
+		add_num_to_buf(&b, sce->absolute_time);
+		add_chr_to_buf(&b, ' ');
+		reserve_buf(&b, 2 * l + 1);
+		for (i = 0; i < l; i++) {
+			add_chr_to_buf(&b, hex[der[i] >> 4]);
+			add_chr_to_buf(&b, hex[der[i] & 15]);
+		}
+		add_chr_to_buf(&b, '\n');
+		free(der);
+	}
+	write_to_config_file(name, b.s ? b.s : cast_uchar "", 0);
+	if (lock != -1)
+		EINTRLOOP(rs, close(lock));
+	free_buf(&b);
+	free(name);
 }
 
 void
@@ -328,14 +699,26 @@ retrieve_ssl_session(struct connection *c)
 		char *h;
 		int p;
 
+		orig_url = remove_proxy_prefix(c->url);
+		h = (char *)get_host_name(orig_url);
+		p = get_port(orig_url);
 		if (c->no_tls) {
 			s = NULL;
 			c->ssl->session_retrieved = 1;
-		} else if ((s = SSL_get1_session(c->ssl->ssl)))
+		} else if ((s = SSL_get1_session(c->ssl->ssl))) {
+			/* TLS 1.3 tickets come after the handshake, even on
+			   a resumed connection, whose old ticket should not
+			   be used again */
+			if (!SSL_SESSION_is_resumable(s)
+			    || (SSL_SESSION_get_protocol_version(s)
+			            == TLS1_3_VERSION
+			        && !c->ssl->new_ticket)) {
+				SSL_SESSION_free(s);
+				free(h);
+				return;
+			}
 			c->ssl->session_retrieved = 1;
-		orig_url = remove_proxy_prefix(c->url);
-		h = (char *)get_host_name(orig_url);
-		p = get_port(orig_url);
+		}
 		set_session_cache_entry(c->ssl->ctx, h, p, s);
 		free(h);
 	}
@@ -348,6 +731,8 @@ shrink_session_cache(int u)
 	struct session_cache_entry *d = NULL;
 	struct list_head *ld;
 	int f = 0;
+	if (u == SH_FREE_ALL && session_store_dirty)
+		save_session_store();
 	if (u == SH_FREE_SOMETHING && !list_empty(session_cache)) {
 		d = list_struct(session_cache.prev, struct session_cache_entry);
 		goto delete_last;
@@ -357,9 +742,7 @@ shrink_session_cache(int u)
 		    || now - d->absolute_time > SESSION_TIMEOUT) {
 delete_last:
 			ld = d->list_entry.prev;
-			del_from_list(d);
-			SSL_SESSION_free(d->session);
-			free(d);
+			free_session_cache_entry(d);
 			f = ST_SOMETHING_FREED;
 		}
 	return f | (list_empty(session_cache) ? ST_CACHE_EMPTY : 0);
@@ -34,10 +34,13 @@ struct itrm {
 	void *mouse_h;
 	unsigned char *orig_title;
 	void (*free_trm)(struct itrm *);
+	unsigned char *squeue;
+	int sqlen;
 };
 
 static void free_trm(struct itrm *);
 static void in_kbd(void *);
+static void in_sock(void *);
 
 static struct itrm *ditrm = NULL;
 
@@ -295,7 +298,7 @@ setcooked(int ctl)
 }
 
 void
-handle_trm(int sock_out, void *init_string, int init_len)
+handle_trm(int sock_in, int sock_out, void *init_string, int init_len)
 {
 	struct itrm *itrm;
 	struct links_event ev = { EV_INIT, 0, 0, 0 };
@@ -307,7 +310,7 @@ handle_trm(int sock_out, void *init_string, int init_len)
 	ditrm = itrm;
 	itrm->std_in = 0;
 	itrm->std_out = 1;
-	itrm->sock_in = 1;
+	itrm->sock_in = sock_in;
 	itrm->sock_out = sock_out;
 	itrm->ctl_in = 0;
 	itrm->blocked = 0;
@@ -315,8 +318,12 @@ handle_trm(int sock_out, void *init_string, int init_len)
 	itrm->tm = NULL;
 	itrm->ev_queue = NULL;
 	itrm->eqlen = 0;
+	itrm->squeue = NULL;
+	itrm->sqlen = 0;
 	setraw(itrm->ctl_in, 1);
 	set_handlers(0, in_kbd, NULL, itrm);
+	if (sock_in != itrm->std_out)
+		set_handlers(sock_in, in_sock, NULL, itrm);
 	handle_terminal_resize(resize_terminal, &ev.x, &ev.y);
 	queue_event(itrm, (unsigned char *)&ev, sizeof(struct links_event));
 	xwin = is_xterm() * ENV_XWIN + is_screen() * ENV_SCREEN;
@@ -412,6 +419,7 @@ free_trm(struct itrm *itrm)
 	if (itrm->tm != NULL)
 		kill_timer(itrm->tm);
 	free(itrm->ev_queue);
+	free(itrm->squeue);
 	free(itrm);
 	if (itrm == ditrm)
 		ditrm = NULL;
@@ -451,6 +459,101 @@ dispatch_special(unsigned char *text)
 	}
 }
 
+static void
+exec_unblock(void *h_)
+{
+	int h = (int)(long)h_;
+	close_socket(&h);
+	if (ditrm)
+		unblock_itrm(ditrm->sock_in);
+}
+
+static void
+exec_close(void *h_)
+{
+	int h = (int)(long)h_;
+	close_socket(&h);
+}
+
+/* Run a program on behalf of the master instance; the counterpart of
+ * exec_on_terminal for a terminal that is attached over a socket. */
+static void
+exec_from_master(struct itrm *itrm, unsigned char fg, unsigned char *path,
+                 unsigned char *delet)
+{
+	unsigned char *param;
+	size_t paraml;
+	int blockh, rs;
+	if (!*path) {
+		dispatch_special(delet);
+		return;
+	}
+	if (is_blocked() && fg) {
+		if (*delet)
+			EINTRLOOP(rs, unlink(cast_const_char delet));
+		return;
+	}
+	param = NULL;
+	paraml = add_chr_to_str(&param, 0, fg);
+	paraml = add_to_str(&param, paraml, path);
+	paraml = add_chr_to_str(&param, paraml, 0);
+	paraml = add_to_str(&param, paraml, delet);
+	if (fg == 1)
+		block_itrm(itrm->sock_in);
+	blockh = start_thread(exec_thread, param, paraml + 1, *delet != 0);
+	free(param);
+	if (blockh == -1) {
+		if (fg == 1)
+			unblock_itrm(itrm->sock_in);
+		return;
+	}
+	set_handlers(blockh, fg == 1 ? exec_unblock : exec_close, NULL,
+	             (void *)(long)blockh);
+}
+
+/* The master instance sends screen contents and, prefixed by a zero byte,
+ * commands in the form fg, path, 0, delet, 0. A command split across reads
+ * is kept in squeue until the rest arrives. */
+static void
+in_sock(void *itrm_)
+{
+	struct itrm *itrm = (struct itrm *)itrm_;
+	unsigned char *p, *z, *end, *path, *delet;
+	int r;
+	if ((unsigned)itrm->sqlen + OUT_BUF_SIZE > INT_MAX)
+		overalloc();
+	itrm->squeue = xrealloc(itrm->squeue, itrm->sqlen + OUT_BUF_SIZE);
+	EINTRLOOP(r, (int)read(itrm->sock_in, itrm->squeue + itrm->sqlen,
+	                       OUT_BUF_SIZE));
+	if (r <= 0) {
+		itrm_error(itrm);
+		return;
+	}
+	itrm->sqlen += r;
+	p = itrm->squeue;
+	end = p + itrm->sqlen;
+	while (p < end) {
+		if (*p) {
+			if (!(z = memchr(p, 0, end - p)))
+				z = end;
+			if (!is_blocked())
+				hard_write(itrm->std_out, p, (int)(z - p));
+			p = z;
+			continue;
+		}
+		if (end - p < 2 || !(z = memchr(p + 2, 0, end - p - 2))
+		    || !memchr(z + 1, 0, end - z - 1))
+			break;
+		path = p + 2;
+		delet = z + 1;
+		z = delet + strlen(cast_const_char delet) + 1;
+		exec_from_master(itrm, p[1], path, delet);
+		p = z;
+	}
+	itrm->sqlen = (int)(end - p);
+	memmove(itrm->squeue, p, itrm->sqlen);
+}
+
 static int process_queue(struct itrm *);
 static int get_esc_code(unsigned char *, int, unsigned char *, int *, int *);
 
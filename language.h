@@ -707,4 +707,30 @@
 #define T_URL_MANUAL    704
 #define T_URL_HOMEPAGE    705
 #define T_URL_CALIBRATION    706
-#define T__N_TEXTS    707
+#define T_USE_SCROLL_REGIONS    707
+#define T_MATCH    708
+#define T_REGEXP    709
+#define T_BAD_REGEXP    710
+#define T_PERFORMANCE    711
+#define T_PERFORMANCE_INFO    712
+#define T_HK_PERFORMANCE_INFO    713
+#define T_DNS_LOOKUP    714
+#define T_TCP_CONNECT    715
+#define T_TLS_HANDSHAKE    716
+#define T_RESPONSE_TIME    717
+#define T_BODY_DOWNLOAD    718
+#define T_DECOMPRESSION    719
+#define T_FORMATTING    720
+#define T_DRAWING    721
+#define T_TIMER_LAG    722
+#define T_SAMPLES    723
+#define T_AVERAGE    724
+#define T_MEDIAN_AT_MOST    725
+#define T_90_PERCENT_AT_MOST    726
+#define T_MAXIMUM    727
+#define T_MS    728
+#define T_SENDING_REQUEST    729
+#define T_SENT    730
+#define T_KEEP_TLS_SESSIONS_ON_DISK    731
+#define T_SEND_REQUESTS_IN_EARLY_DATA    732
+#define T__N_TEXTS    733
@@ -264,6 +264,37 @@ size_t add_num_to_str(unsigned char **s, size_t l, off_t n);
 size_t add_knum_to_str(unsigned char **s, size_t l, off_t n);
 long strtolx(unsigned char *c, unsigned char **end);
 
+/*
+ * A string that knows its allocated size and doubles it when it runs out,
+ * for callers that build a long text from many small pieces. It may start
+ * in storage owned by the caller (usually an array on the stack) and moves
+ * to the heap only when that overflows. s is NULL until the first append,
+ * otherwise s[l] is always 0.
+ */
+struct string_buf {
+	unsigned char *s;
+	size_t l;
+	size_t size;
+	unsigned char *stack;
+};
+
+void init_buf(struct string_buf *, unsigned char *, size_t);
+void reserve_buf(struct string_buf *, size_t);
+void add_bytes_to_buf(struct string_buf *, const unsigned char *, size_t);
+void add_to_buf(struct string_buf *, const unsigned char *);
+void add_num_to_buf(struct string_buf *, off_t);
+unsigned char *buf_string(struct string_buf *);
+void free_buf(struct string_buf *);
+
+static inline void
+add_chr_to_buf(struct string_buf *b, unsigned char c)
+{
+	if (b->l + 1 >= b->size)
+		reserve_buf(b, 1);
+	b->s[b->l++] = c;
+	b->s[b->l] = 0;
+}
+
 void safe_strncpy(unsigned char *dst, const unsigned char *src,
                   size_t dst_size);
 int casestrcmp(const unsigned char *s1, const unsigned char *s2);
@@ -328,6 +359,8 @@ struct open_in_new *get_open_in_new(int);
 void os_free_clipboard(void);
 
 void os_detach_console(void);
+int bind_to_af_unix(void);
+void af_unix_close(void);
 
 /* memory.c */
 
@@ -406,6 +439,26 @@ void block_signals(int except1, int except2);
 void unblock_signals(void);
 void set_sigcld(void);
 
+/* perf.c */
+
+enum perf_stage {
+	PERF_DNS,
+	PERF_CONNECT,
+	PERF_TLS,
+	PERF_RESPONSE,
+	PERF_DOWNLOAD,
+	PERF_DECOMPRESS,
+	PERF_FORMAT,
+	PERF_DRAW,
+	PERF_TIMER_LAG,
+	PERF_N
+};
+
+extern int perf_stats;
+
+void perf_add(int, uttime);
+size_t add_perf_info(unsigned char **, size_t, struct terminal *);
+
 /* dns.c */
 
 #define MAX_ADDRESSES 64
@@ -438,6 +491,8 @@ int find_host(char *, struct lookup_result *, void **, void (*)(void *, int),
 int find_host_no_cache(char *, struct lookup_result *, void **,
                        void (*)(void *, int), void *);
 void kill_dns_request(void **);
+int dns_prefetch(char *);
+void abort_dns_prefetches(void);
 #if MAX_ADDRESSES > 1
 void dns_set_priority(char *, struct host_address *, int);
 #endif
@@ -456,6 +511,7 @@ struct cache_entry {
 	unsigned char *redirect;
 	off_t length;
 	off_t max_length;
+	off_t expected_length; /* announced by the server, 0 if unknown */
 	int incomplete;
 	int tgc;
 	unsigned char *last_modified;
@@ -478,6 +534,7 @@ struct fragment {
 	off_t offset;
 	off_t length;
 	off_t real_length;
+	size_t mapped; /* size of the mapping, 0 if allocated on the heap */
 	unsigned char data[1];
 };
 
@@ -507,6 +564,8 @@ typedef struct {
 	tcount bytes_written;
 	int session_set;
 	int session_retrieved;
+	int early_data; /* the request goes out before the handshake ends */
+	int new_ticket; /* the server sent a session ticket */
 	unsigned char *ca;
 } links_ssl;
 
@@ -538,6 +597,7 @@ struct connection {
 	list_entry_1st;
 	tcount count;
 	unsigned char *url;
+	struct parsed_url *purl;
 	unsigned char *prev_url; /* allocated string with referrer or NULL */
 	int running;
 	int state;
@@ -565,12 +625,21 @@ struct connection {
 	struct remaining_info prg;
 	struct timer *timer;
 	int detached;
+	int sink;        /* body is written to this fd instead of the cache */
+	off_t *sink_pos; /* file position of sink, updated as data are written */
+	int sink_no_splice; /* sink refused splice(2), write to it instead */
+	unsigned char *sink_buf; /* data the sink was full for */
+	int sink_buf_len;
+	void (*sink_wait)(struct connection *); /* goes on once they are out */
+	off_t range_end; /* request only bytes before this offset, or -1 */
 	char socks_proxy[MAX_STR_LEN];
 	unsigned char dns_append[MAX_STR_LEN];
 	struct lookup_state last_lookup_state;
 	links_ssl *ssl;
 	int no_ssl_session;
 	int no_tls;
+	int preconnect; /* only make the handshakes, see preconnect_url */
+	int dropped; /* a cancelled prefetch, see free_prefetch */
 };
 
 extern tcount netcfg_stamp;
@@ -601,6 +670,7 @@ enum ses {
 	S_CONN_ANOTHER,
 	S_SOCKS_NEG,
 	S_SSL_NEG,
+	S_SENDING,
 	S_SENT,
 	S_LOGIN,
 	S_GETH,
@@ -686,9 +756,16 @@ void abort_connection(struct connection *c);
 #define ALLOW_FILE 2
 #define ALLOW_ALL  (ALLOW_SMB | ALLOW_FILE)
 void load_url(unsigned char *, unsigned char *, struct status *, int, int, int,
-              int, off_t);
+              int, off_t, off_t);
+void preconnect_url(unsigned char *);
+void preconnected(struct connection *);
+void abort_preconnects(unsigned char *);
+void prefetch_url(unsigned char *, unsigned char *);
+void abort_prefetches(unsigned char *);
 void change_connection(struct status *, struct status *, int);
 void detach_connection(struct status *, off_t, int, int);
+int set_connection_sink(struct status *, int, off_t *, int);
+off_t get_connection_range_length(struct status *);
 void abort_all_connections(void);
 int abort_background_connections(void);
 int is_entry_used(struct cache_entry *);
@@ -702,15 +779,16 @@ void free_blacklist(void);
 
 enum bl {
 	BL_HTTP10 = 0x001,
-	BL_NO_ACCEPT_LANGUAGE,
-	BL_NO_CHARSET,
-	BL_NO_RANGE,
-	BL_NO_COMPRESSION,
-	BL_NO_BZIP2,
-	BL_IGNORE_CERTIFICATE,
-	BL_IGNORE_DOWNGRADE,
-	BL_IGNORE_CIPHER,
-	BL_AVOID_INSECURE
+	BL_NO_ACCEPT_LANGUAGE = 0x002,
+	BL_NO_CHARSET = 0x004,
+	BL_NO_RANGE = 0x008,
+	BL_NO_COMPRESSION = 0x010,
+	BL_NO_BZIP2 = 0x020,
+	BL_IGNORE_CERTIFICATE = 0x040,
+	BL_IGNORE_DOWNGRADE = 0x080,
+	BL_IGNORE_CIPHER = 0x100,
+	BL_AVOID_INSECURE = 0x200,
+	BL_NO_EARLY_DATA = 0x400
 };
 
 /* suffix.c */
@@ -725,6 +803,13 @@ struct session;
 #define POST_CHAR        1
 #define POST_CHAR_STRING "\001"
 
+/* A file uploaded from disk is not copied into the hex encoded POST data.
+ * It is written as POST_FILE_START, the hex encoded absolute file name,
+ * ':', the size, ':', the modification time and POST_FILE_END, and http.c
+ * streams it from the disk when sending the request. */
+#define POST_FILE_START '<'
+#define POST_FILE_END   '>'
+
 static inline int
 end_of_dir(unsigned char *url, unsigned char c)
 {
@@ -736,6 +821,29 @@ end_of_dir(unsigned char *url, unsigned char c)
 int parse_url(unsigned char *, int *, unsigned char **, int *, unsigned char **,
               int *, unsigned char **, int *, unsigned char **, int *,
               unsigned char **, int *, unsigned char **);
+
+/* URL split by parse_url, the parts are offsets to url or -1 */
+struct parsed_url {
+	int refcount;
+	int prot; /* index to the protocol table, -1 if the URL is invalid */
+	int prlen;
+	int user, uslen;
+	int pass, palen;
+	int host, holen;
+	int port, polen;
+	int data, dalen;
+	int post;
+	int port_num; /* -1 if invalid */
+	int kalen;    /* length of the keep-alive id, -1 if there is none */
+	unsigned char *url;
+};
+
+struct parsed_url *get_parsed_url(unsigned char *);
+struct parsed_url *hold_parsed_url(unsigned char *);
+void release_parsed_url(struct parsed_url **);
+void free_parsed_urls(void);
+int url_host_eq(struct parsed_url *, unsigned char *);
+int url_keepalive_eq(struct parsed_url *, unsigned char *);
 unsigned char *get_protocol_name(unsigned char *);
 unsigned char *get_host_name(unsigned char *);
 unsigned char *get_keepalive_id(unsigned char *);
@@ -750,6 +858,10 @@ int url_bypasses_socks(unsigned char *);
 unsigned char *get_url_data(unsigned char *);
 int url_non_ascii(unsigned char *url);
 unsigned char *join_urls(unsigned char *, unsigned char *);
+struct url_joins;
+unsigned char *join_urls_cached(struct url_joins **, unsigned char *,
+                                unsigned char *);
+void free_url_joins(struct url_joins **);
 unsigned char *translate_url(unsigned char *, unsigned char *);
 unsigned char *extract_position(unsigned char *);
 int url_not_saveable(unsigned char *);
@@ -769,6 +881,8 @@ struct read_buffer {
 	int sock;
 	int len;
 	int close;
+	off_t splice;  /* bytes that may bypass data[] and go to c->sink */
+	off_t spliced; /* bytes written to c->sink since the last done() */
 	void (*done)(struct connection *, struct read_buffer *);
 	unsigned char data[1];
 };
@@ -786,6 +900,10 @@ struct read_buffer *alloc_read_buffer(void);
 void read_from_socket(struct connection *, int, struct read_buffer *,
                       void (*)(struct connection *, struct read_buffer *));
 void kill_buffer_data(struct read_buffer *, int);
+int write_to_sink(struct connection *, unsigned char *, int);
+void wait_for_sink(struct connection *, void (*)(struct connection *));
+void stop_waiting_for_sink(struct connection *);
+int drop_connection_sink(struct connection *);
 
 /* cookies.c */
 
@@ -796,23 +914,24 @@ struct cookie {
 	unsigned char *path, *domain;
 	time_t expires; /* zero means undefined */
 	int secure;
+	size_t path_len;
+	size_t heap_pos; /* index in the expiry heap if expires is set */
 };
 
 struct c_domain {
 	list_entry_1st;
+	struct list_head cookies; /* longest paths first */
 	unsigned char domain[1];
 };
 
-extern struct list_head all_cookies;
 extern struct list_head c_domains;
 
 int set_cookie(struct terminal *, unsigned char *, unsigned char *);
-size_t add_cookies(unsigned char **, size_t, unsigned char *);
+void add_cookies(struct string_buf *, unsigned char *);
 void init_cookies(void);
 void free_cookies(void);
 int is_in_domain(unsigned char *d, unsigned char *s);
 int is_path_prefix(unsigned char *d, unsigned char *s);
-int cookie_expired(struct cookie *c);
 void free_cookie(struct cookie *c);
 
 /* auth.c */
@@ -833,11 +952,15 @@ unsigned char *parse_http_header(unsigned char *, unsigned char *,
 unsigned char *parse_header_param(unsigned char *, unsigned char *, int);
 void http_func(struct connection *);
 void proxy_func(struct connection *);
+void allow_post_file(unsigned char *);
+void free_post_file_names(void);
 
 /* https.c */
 
 void https_func(struct connection *c);
 void ssl_finish(void);
+void ssl_preload(void);
+void init_ssl(void);
 links_ssl *getSSL(void);
 void freeSSL(links_ssl *);
 int verify_ssl_certificate(links_ssl *ssl, unsigned char *host);
@@ -847,6 +970,7 @@ unsigned char *get_cipher_string(links_ssl *ssl);
 
 SSL_SESSION *get_session_cache_entry(SSL_CTX *ctx, unsigned char *host,
                                      int port);
+void drop_session_cache_entry(SSL_CTX *ctx, unsigned char *host, int port);
 void retrieve_ssl_session(struct connection *c);
 unsigned long session_info(int type);
 void init_session_cache(void);
@@ -945,7 +1069,7 @@ enum kbd {
 
 #define KBD_ESCAPE_MENU(x) ((x) <= KBD_F1 && (x) > KBD_CTRL_C)
 
-void handle_trm(int, void *, int);
+void handle_trm(int, int, void *, int);
 void free_all_itrms(void);
 void dispatch_special(unsigned char *);
 void kbd_ctrl_c(void);
@@ -1063,6 +1187,7 @@ struct term_spec {
 	int restrict_852;
 	int block_cursor;
 	int col;
+	int scroll;
 	int character_set;
 	int left_margin;
 	int right_margin;
@@ -1124,6 +1249,7 @@ int unblock_itrm(int);
 #define TERM_FN_TITLE  1
 #define TERM_FN_RESIZE 2
 
+void exec_thread(void *, int);
 void exec_on_terminal(struct terminal *, unsigned char *, unsigned char *,
                       unsigned char);
 void do_terminal_function(struct terminal *, unsigned char, unsigned char *);
@@ -1176,6 +1302,7 @@ struct object_request {
 	struct cache_entry *ce;
 	unsigned char *orig_url;
 	unsigned char *url;
+	struct parsed_url *purl;
 	unsigned char *prev_url; /* allocated string with referrer or NULL */
 	unsigned char *goto_position;
 	int pri;
@@ -1202,6 +1329,7 @@ void clone_object(struct object_request *, struct object_request **);
 void release_object(struct object_request **);
 void release_object_get_stat(struct object_request **, struct status *, int);
 void detach_object_connection(struct object_request *, off_t);
+int sink_object_connection(struct object_request *, int, off_t *);
 
 /* compress.c */
 
@@ -1348,6 +1476,11 @@ struct link {
 
 enum l_link { L_LINK, L_BUTTON, L_CHECKBOX, L_SELECT, L_FIELD, L_AREA };
 
+struct link_cell {
+	int x;
+	int link; /* index to f_data->links */
+};
+
 struct link_bg {
 	int x, y;
 	unsigned char c;
@@ -1461,6 +1594,25 @@ struct search {
 	unsigned short co;
 };
 
+struct search_index;
+
+/* character i of search data stored with width bytes per character */
+static inline char_t
+search_chr_at(const unsigned char *s, int width, int i)
+{
+	if (width == 1)
+		return s[i];
+	if (width == 2)
+		return ((const unsigned short *)s)[i];
+	return ((const char_t *)s)[i];
+}
+
+struct search_match {
+	int idx;    /* position in search_chr */
+	int len;
+	int y, ye;  /* first and last line where the match is visible */
+};
+
 struct frameset_desc;
 
 struct frame_desc {
@@ -1530,20 +1682,35 @@ struct f_data {
 	int nlinks;
 	struct link **lines1;
 	struct link **lines2;
+	int *link_rows; /* cells of line y are link_cells[link_rows[y]] to
+	                   link_cells[link_rows[y + 1] - 1] */
+	struct link_cell *link_cells; /* sorted by x within a line */
 	struct list_head nodes; /* struct node */
 	struct search *search_pos;
-	char_t *search_chr;
+	unsigned char *search_chr; /* search_chr_width bytes per character */
+	int search_chr_width;
 	int nsearch_chr;
 	int nsearch_pos;
-	int *slines1;
-	int *slines2;
+	struct search_index *search_index; /* != NULL while being built */
+	int search_done; /* 1 - search data complete, -1 - failed */
+	unsigned char *search_word; /* the word search_match was built for */
+	int search_regexp;
+	int search_match_chr; /* nsearch_chr when search_match was built */
+	struct search_match *search_match; /* sorted by y */
+	int nsearch_match;
+	int search_match_span; /* maximum ye - y */
 
 	struct list_head forms; /* struct form_control */
 	struct list_head tags;  /* struct tag */
 
+	struct url_joins *url_joins; /* links resolved by the formatter */
+
 	unsigned char *refresh;
 	int refresh_seconds;
 
+	unsigned char **prefetch; /* pages hinted by <link rel=prefetch> */
+	int nprefetch;
+
 	int uncacheable; /* cannot be cached - either created from source
 	                    modified by document.write or modified by javascript
 	                  */
@@ -1610,6 +1777,8 @@ struct f_data_c {
 
 	struct timer *refresh_timer;
 
+	int format_pending; /* to be reformatted from format_timer */
+
 	unsigned char scrolling;
 	unsigned char last_captured;
 };
@@ -1633,6 +1802,17 @@ struct kbdprefix {
 	int prefix;
 };
 
+struct download;
+
+struct download_segment {
+	list_entry_1st;
+	struct download *down;
+	struct status stat;
+	off_t start;
+	off_t pos; /* next byte to be written */
+	off_t end;
+};
+
 struct download {
 	list_entry_1st;
 	unsigned char *url;
@@ -1652,6 +1832,11 @@ struct download {
 	struct session *ses;
 	struct window *win;
 	struct window *ask;
+	struct list_head segments; /* struct download_segment, by offset */
+	off_t seg_total;           /* length when segmented, -1 if not */
+	off_t stream_end;          /* range end of the stream in stat or -1 */
+	off_t seg_loaded;          /* received by finished segment streams */
+	struct remaining_info prg; /* merged progress of all streams */
 };
 
 extern struct list_head downloads;
@@ -1688,8 +1873,12 @@ struct session {
 	unsigned char *search_word;
 	unsigned char *last_search_word;
 	int search_direction;
+	int search_regexp;
+	struct list_head search_regexps; /* compiled patterns, recent first */
 	int exit_query;
 	struct list_head format_cache; /* struct f_data */
+	struct timer *format_timer; /* formats the pending frames */
+	struct timer *prefetch_timer; /* looks ahead at the links on screen */
 
 	unsigned char *imgmap_href_base;
 	unsigned char *imgmap_target_base;
@@ -2175,11 +2364,14 @@ void do_for_frame(struct session *,
 int get_current_state(struct session *);
 unsigned char *print_current_link(struct session *);
 unsigned char *print_current_title(struct session *);
+unsigned char *print_current_search(struct session *);
 void loc_msg(struct terminal *, struct location *, struct f_data_c *);
 void state_msg(struct session *);
 void head_msg(struct session *);
 void search_for(void *, unsigned char *);
 void search_for_back(void *, unsigned char *);
+void search_for_regexp(void *, unsigned char *);
+void search_for_back_regexp(void *, unsigned char *);
 void find_next(struct session *, struct f_data_c *, int);
 void find_next_back(struct session *, struct f_data_c *, int);
 void set_frame(struct session *, struct f_data_c *, int);
@@ -2187,6 +2379,16 @@ struct f_data_c *current_frame(struct session *);
 void reset_form(struct f_data_c *f, int form_num);
 void set_textarea(struct session *, struct f_data_c *, int);
 
+/* regexp.c */
+
+struct regexp;
+
+struct regexp *regexp_get(struct list_head *, unsigned char *, int);
+void regexp_matches(struct regexp *, const unsigned char *, int, int,
+                    const unsigned char *, void (*)(void *, int, int),
+                    void *);
+void free_regexps(struct list_head *);
+
 /* html.c */
 
 enum html_attr {
@@ -2318,9 +2520,14 @@ void html_stack_dup(void);
 void kill_html_stack_item(struct html_element *);
 int should_skip_script(unsigned char *);
 unsigned char *skip_comment(unsigned char *, unsigned char *);
-void parse_html(unsigned char *, unsigned char *,
-                void (*)(void *, unsigned char *, int), void (*)(void *),
-                void *(*)(void *, int, ...), void *, unsigned char *);
+unsigned char *resume_html(unsigned char *, unsigned char *,
+                           void (*)(void *, unsigned char *, int),
+                           void (*)(void *), void *(*)(void *, int, ...),
+                           void *);
+unsigned char *parse_html(unsigned char *, unsigned char *,
+                          void (*)(void *, unsigned char *, int),
+                          void (*)(void *), void *(*)(void *, int, ...),
+                          void *, unsigned char *);
 int get_image_map(unsigned char *, unsigned char *, unsigned char *,
                   unsigned char *a, struct menu_item **, struct memory_list **,
                   unsigned char *, unsigned char *, int, int, int, int gfx);
@@ -2341,8 +2548,10 @@ enum sp {
 	SP_IMAGE,
 	SP_NOWRAP,
 	SP_REFRESH,
+	SP_PREFETCH,
 	SP_SET_BASE,
-	SP_HR
+	SP_HR,
+	SP_STOP
 };
 
 struct frameset_param {
@@ -2445,8 +2654,11 @@ struct part *format_html_part(unsigned char *, unsigned char *, int, int, int,
                               struct f_data *, int, int, unsigned char *, int);
 void really_format_html(struct cache_entry *, unsigned char *, unsigned char *,
                         struct f_data *, int frame);
+void format_lines(struct f_data *, int);
+int first_link_cell(struct f_data *f, int y, int x);
 struct link *get_link_at_location(struct f_data *f, int x, int y);
-int get_search_data(struct f_data *);
+int get_search_data(struct f_data *, int);
+int get_search_data_lines(struct f_data *);
 
 struct frameset_desc *create_frameset(struct f_data *fda,
                                       struct frameset_param *fp);
@@ -2509,6 +2721,7 @@ extern int first_use;
 
 extern int disable_libevent;
 extern int no_connect;
+extern int share_instance;
 extern int base_session;
 #define D_DUMP   1
 #define D_SOURCE 2
@@ -2526,6 +2739,10 @@ extern int timeout_multiple_addresses;
 extern unsigned char bind_ip_address[16];
 extern unsigned char bind_ipv6_address[INET6_ADDRSTRLEN];
 extern int download_utime;
+extern int download_segments;
+extern int prefetch;
+extern int prefetch_pages;
+extern unsigned char prefetch_pattern[MAX_STR_LEN];
 
 extern int max_format_cache_entries;
 extern int memory_cache_size;
@@ -2567,6 +2784,8 @@ enum ssl_cert {
 struct ssl_options {
 	int certificates;
 	int built_in_certificates;
+	int session_store;
+	int early_data;
 	unsigned char client_cert_key[MAX_STR_LEN];
 	unsigned char client_cert_crt[MAX_STR_LEN];
 	unsigned char client_cert_password[MAX_STR_LEN];
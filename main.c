@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #ifdef __OpenBSD__
 	#include <unistd.h>
@@ -24,6 +25,7 @@ int retval = RET_OK;
 static void initialize_all_subsystems(void);
 static void initialize_all_subsystems_2(void);
 static void poll_fg(void *);
+static void end_dump(struct object_request *, void *);
 
 static int init_b = 0;
 int g_argc;
@@ -188,7 +190,7 @@ attach_terminal(void *info, int len)
 	struct terminal *term;
 	set_nonblock(terminal_pipe[0]);
 	set_nonblock(terminal_pipe[1]);
-	handle_trm(terminal_pipe[1], info, len);
+	handle_trm(1, terminal_pipe[1], info, len);
 	free(info);
 	if ((term = init_term(terminal_pipe[0], 1, win_func))) {
 		handle_basic_signals(
@@ -204,6 +206,63 @@ attach_terminal(void *info, int len)
 static struct object_request *dump_obj;
 static off_t dump_pos;
 
+#define DUMP_IOV 16
+
+/* Write the fragments of ce that follow dump_pos to stdout. New data are
+ * appended at the end, so the first fragment to write is searched for from
+ * the tail. Returns 0, -1 on error, 1 if nothing could be written or 2 if
+ * stdout is full. */
+static int
+dump_fragments(struct cache_entry *ce)
+{
+	struct fragment *frag = NULL;
+	struct list_head *lfrag;
+	struct iovec iov[DUMP_IOV], *v;
+	off_t pos;
+	ssize_t w;
+	int n;
+again:
+	foreachback (struct fragment, frag, lfrag, ce->frag)
+		if (frag->offset <= dump_pos)
+			break;
+	pos = dump_pos;
+	n = 0;
+	foreachfrom (struct fragment, frag, lfrag, ce->frag, lfrag) {
+		if (frag->offset > pos || n == DUMP_IOV)
+			break;
+		if (frag->offset + frag->length <= pos)
+			continue;
+		iov[n].iov_base = frag->data + (pos - frag->offset);
+		iov[n].iov_len = (size_t)(frag->offset + frag->length - pos);
+		pos += iov[n++].iov_len;
+	}
+	for (v = iov; n;) {
+		EINTRLOOP(w, writev(1, v, n));
+		if (w < 0 && errno == EAGAIN)
+			return 2;
+		if (w <= 0)
+			return w ? -1 : 1;
+		dump_pos += w;
+		for (; n && (size_t)w >= v->iov_len; v++, n--)
+			w -= v->iov_len;
+		if (n) {
+			v->iov_base = (unsigned char *)v->iov_base + w;
+			v->iov_len -= w;
+		}
+	}
+	if (pos != dump_pos || lfrag == &ce->frag
+	    || list_struct(lfrag, struct fragment)->offset > pos)
+		return 0;
+	goto again;
+}
+
+static void
+dump_writable(void *p)
+{
+	set_handlers(1, NULL, NULL, NULL);
+	end_dump(dump_obj, NULL);
+}
+
 static void
 end_dump(struct object_request *r, void *p)
 {
@@ -213,45 +272,30 @@ end_dump(struct object_request *r, void *p)
 	ce = r->ce;
 	if (dmp == D_SOURCE) {
 		if (ce) {
-			struct fragment *frag = NULL;
-			struct list_head *lfrag;
-nextfrag:
-			foreach (struct fragment, frag, lfrag, ce->frag)
-				if (frag->offset <= dump_pos
-				    && frag->offset + frag->length > dump_pos) {
-					off_t l;
-					int w;
-					l = frag->length
-					    - (dump_pos - frag->offset);
-					if (l >= INT_MAX)
-						l = INT_MAX;
-					w = hard_write(1,
-					               frag->data + dump_pos
-					                   - frag->offset,
-					               (int)l);
-					if (w != l) {
-						detach_object_connection(
-						    r, dump_pos);
-						if (w < 0)
-							fprintf(
-							    stderr,
-							    "Error writing to "
-							    "stdout: %s.\n",
-							    strerror(errno));
-						else
-							fprintf(stderr,
-							        "Can't write "
-							        "to stdout.\n");
-						retval = RET_ERROR;
-						goto terminate;
-					}
-					dump_pos += w;
-					detach_object_connection(r, dump_pos);
-					goto nextfrag;
-				}
+			int err = dump_fragments(ce);
+			detach_object_connection(r, dump_pos);
+			if (err == 2) {
+				/* go on when stdout takes more */
+				set_handlers(1, NULL, dump_writable, NULL);
+				return;
+			}
+			if (err) {
+				if (err < 0)
+					fprintf(stderr,
+					        "Error writing to stdout: %s.\n",
+					        strerror(errno));
+				else
+					fprintf(stderr,
+					        "Can't write to stdout.\n");
+				retval = RET_ERROR;
+				goto terminate;
+			}
 		}
-		if (r->state >= 0)
+		if (r->state >= 0) {
+			if (r->stat.state == S_TRANS)
+				sink_object_connection(r, 1, &dump_pos);
 			return;
+		}
 	} else if (ce) {
 		struct document_options o;
 		struct f_data_c *fd;
@@ -298,7 +342,7 @@ static void
 init(void)
 {
 	void *info;
-	int len;
+	int len, uh;
 	unsigned char *u;
 
 	initialize_all_subsystems();
@@ -324,6 +368,18 @@ tttt:
 		terminate_loop = 1;
 		return;
 	}
+	if (!dmp && share_instance && !no_connect
+	    && (uh = bind_to_af_unix()) != -1) {
+		close_socket(&terminal_pipe[0]);
+		close_socket(&terminal_pipe[1]);
+		info =
+		    create_session_info(base_session, u, default_target, &len);
+		initialize_all_subsystems_2();
+		handle_trm(uh, uh, info, len);
+		handle_basic_signals(NULL);
+		free(info);
+		return;
+	}
 	init_cookies();
 	if (!dmp) {
 		init_b = 1;
@@ -335,6 +391,7 @@ tttt:
 		    create_session_info(base_session, u, default_target, &len);
 		if (attach_terminal(info, len) < 0)
 			fatal_exit("Could not open initial session");
+		init_ssl();
 	} else {
 		unsigned char *uu, *uuu, *wd;
 		initialize_all_subsystems_2();
@@ -386,6 +443,7 @@ terminate_all_subsystems(void)
 	check_bottom_halves();
 	free_all_itrms();
 	release_object(&dump_obj);
+	af_unix_close();
 	abort_all_connections();
 
 	free_all_caches();
@@ -397,8 +455,10 @@ terminate_all_subsystems(void)
 	free_types();
 	finalize_bookmarks();
 	free_blacklist();
+	free_post_file_names();
 	free_cookies();
 	free_auth();
+	free_parsed_urls();
 	check_bottom_halves();
 	end_config();
 	free_strerror_buf();
@@ -423,6 +483,12 @@ main(int argc, char *argv[])
 	init_page_size();
 	select_loop(init);
 	terminate_all_subsystems();
+	if (perf_stats) {
+		unsigned char *s = NULL;
+		add_perf_info(&s, 0, NULL);
+		fprintf(stderr, "%s\n", s);
+		free(s);
+	}
 
 	return retval;
 }
@@ -436,6 +436,43 @@ resource_info_menu(struct terminal *term, void *d, void *ses_)
 	resource_info(term, NULL);
 }
 
+static int
+perf_info(struct terminal *term, struct refresh *r2)
+{
+	unsigned char *a = NULL;
+	struct refresh *r;
+
+	add_perf_info(&a, 0, term);
+
+	if (r2
+	    && !strcmp(
+		cast_const_char a,
+		cast_const_char
+		    * (unsigned char **)((struct dialog_data *)r2->win->data)
+			  ->dlg->udata)) {
+		free(a);
+		r2->timer = install_timer(RESOURCE_INFO_REFRESH, refresh, r2);
+		return 1;
+	}
+
+	r = xmalloc(sizeof(struct refresh));
+	r->term = term;
+	r->fn = perf_info;
+	msg_box(term, getml(a, NULL), TEXT_(T_PERFORMANCE), AL_LEFT, a,
+	        MSG_BOX_END, (void *)r, 1, TEXT_(T_OK), msg_box_null,
+	        B_ENTER | B_ESC);
+	r->win = list_struct(term->windows.next, struct window);
+	((struct dialog_data *)r->win->data)->dlg->abort = refresh_abort;
+	r->timer = install_timer(RESOURCE_INFO_REFRESH, refresh, r);
+	return 0;
+}
+
+static void
+perf_info_menu(struct terminal *term, void *d, void *ses_)
+{
+	perf_info(term, NULL);
+}
+
 static void
 flush_caches(struct terminal *term, void *d, void *e)
 {
@@ -589,6 +626,7 @@ static unsigned char *const td_labels[] = { TEXT_(T_NO_FRAMES),
 						T_RESTRICT_FRAMES_IN_CP850_852),
 	                                    TEXT_(T_BLOCK_CURSOR),
 	                                    TEXT_(T_COLOR),
+	                                    TEXT_(T_USE_SCROLL_REGIONS),
 	                                    NULL };
 
 static void
@@ -596,7 +634,7 @@ terminal_options(struct terminal *term, void *xxx, void *ses_)
 {
 	struct dialog *d;
 	struct term_spec *ts = new_term_spec(term->term);
-	d = mem_calloc(sizeof(struct dialog) + 8 * sizeof(struct dialog_item));
+	d = mem_calloc(sizeof(struct dialog) + 9 * sizeof(struct dialog_item));
 	d->title = TEXT_(T_TERMINAL_OPTIONS);
 	d->fn = checkbox_list_fn;
 	d->udata = (void *)td_labels;
@@ -627,15 +665,19 @@ terminal_options(struct terminal *term, void *xxx, void *ses_)
 	d->items[5].gid = 0;
 	d->items[5].dlen = sizeof(int);
 	d->items[5].data = (void *)&ts->col;
-	d->items[6].type = D_BUTTON;
-	d->items[6].gid = B_ENTER;
-	d->items[6].fn = ok_dialog;
-	d->items[6].text = TEXT_(T_OK);
+	d->items[6].type = D_CHECKBOX;
+	d->items[6].gid = 0;
+	d->items[6].dlen = sizeof(int);
+	d->items[6].data = (void *)&ts->scroll;
 	d->items[7].type = D_BUTTON;
-	d->items[7].gid = B_ESC;
-	d->items[7].fn = cancel_dialog;
-	d->items[7].text = TEXT_(T_CANCEL);
-	d->items[8].type = D_END;
+	d->items[7].gid = B_ENTER;
+	d->items[7].fn = ok_dialog;
+	d->items[7].text = TEXT_(T_OK);
+	d->items[8].type = D_BUTTON;
+	d->items[8].gid = B_ESC;
+	d->items[8].fn = cancel_dialog;
+	d->items[8].text = TEXT_(T_CANCEL);
+	d->items[9].type = D_END;
 	do_dialog(term, d, getml(d, NULL));
 }
 
@@ -1236,6 +1278,8 @@ static unsigned char *const ssl_labels[] = {
 	TEXT_(T_ACCEPT_INVALID_CERTIFICATES),
 	TEXT_(T_WARN_ON_INVALID_CERTIFICATES),
 	TEXT_(T_REJECT_INVALID_CERTIFICATES),
+	TEXT_(T_KEEP_TLS_SESSIONS_ON_DISK),
+	TEXT_(T_SEND_REQUESTS_IN_EARLY_DATA),
 	TEXT_(T_CLIENT_CERTIFICATE_KEY_FILE),
 	TEXT_(T_CLIENT_CERTIFICATE_FILE),
 	TEXT_(T_CLIENT_CERTIFICATE_KEY_PASSWORD),
@@ -1316,7 +1360,7 @@ dlg_ssl_options(struct terminal *term, void *xxx, void *yyy)
 {
 	struct dialog *d;
 	int a = 0;
-	const int items = 8;
+	const int items = 10;
 	d = mem_calloc(sizeof(struct dialog)
 	               + items * sizeof(struct dialog_item));
 	d->title = TEXT_(T_SSL_OPTIONS);
@@ -1341,6 +1385,16 @@ dlg_ssl_options(struct terminal *term, void *xxx, void *yyy)
 	d->items[a].dlen = sizeof(int);
 	d->items[a].data = (void *)&ssl_options.certificates;
 	a++;
+	d->items[a].type = D_CHECKBOX;
+	d->items[a].gid = 0;
+	d->items[a].dlen = sizeof(int);
+	d->items[a].data = (void *)&ssl_options.session_store;
+	a++;
+	d->items[a].type = D_CHECKBOX;
+	d->items[a].gid = 0;
+	d->items[a].dlen = sizeof(int);
+	d->items[a].data = (void *)&ssl_options.early_data;
+	a++;
 	d->items[a].type = D_FIELD;
 	d->items[a].dlen = MAX_STR_LEN;
 	d->items[a].data = ssl_options.client_cert_key;
@@ -2052,6 +2106,8 @@ static const struct menu_item file_menu22[] = {
          TEXT_(T_HK_FLUSH_ALL_CACHES),						    flush_caches,              NULL, 0, 1},
 	{ TEXT_(T_RESOURCE_INFO),               cast_uchar "", TEXT_(T_HK_RESOURCE_INFO),
          resource_info_menu,											 NULL, 0, 1},
+	{ TEXT_(T_PERFORMANCE_INFO),            cast_uchar "", TEXT_(T_HK_PERFORMANCE_INFO),
+         perf_info_menu,											 NULL, 0, 1},
 	{ cast_uchar "",                        cast_uchar "", M_BAR,                     NULL,                      NULL, 0, 1},
 };
 
@@ -2610,7 +2666,8 @@ search_back_dlg(struct session *ses, struct f_data_c *f, int a)
 	input_field(
 	    ses->term, NULL, TEXT_(T_SEARCH_BACK), TEXT_(T_SEARCH_FOR_TEXT),
 	    ses, &search_history, MAX_INPUT_URL_LEN, cast_uchar "", 0, 0, NULL,
-	    2, TEXT_(T_OK), search_for_back, TEXT_(T_CANCEL), input_field_null);
+	    3, TEXT_(T_OK), search_for_back, TEXT_(T_REGEXP),
+	    search_for_back_regexp, TEXT_(T_CANCEL), input_field_null);
 }
 
 void
@@ -2624,8 +2681,8 @@ search_dlg(struct session *ses, struct f_data_c *f, int a)
 	}
 	input_field(ses->term, NULL, TEXT_(T_SEARCH), TEXT_(T_SEARCH_FOR_TEXT),
 	            ses, &search_history, MAX_INPUT_URL_LEN, cast_uchar "", 0,
-	            0, NULL, 2, TEXT_(T_OK), search_for, TEXT_(T_CANCEL),
-	            input_field_null);
+	            0, NULL, 3, TEXT_(T_OK), search_for, TEXT_(T_REGEXP),
+	            search_for_regexp, TEXT_(T_CANCEL), input_field_null);
 }
 
 void
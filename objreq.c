@@ -129,7 +129,7 @@ auth_ok(struct dialog_data *dlg, struct dialog_item_data *item)
 		rq->hold = 0;
 		change_connection(&rq->stat, NULL, PRI_CANCEL);
 		load_url(rq->url, rq->prev_url, &rq->stat, rq->pri, NC_RELOAD,
-		         0, 0, 0);
+		         0, 0, 0, -1);
 	}
 	cancel_dialog(dlg, item);
 	return 0;
@@ -237,7 +237,7 @@ cert_action(struct object_request *rq, int yes)
 		rq->hold = 0;
 		change_connection(&rq->stat, NULL, PRI_CANCEL);
 		load_url(rq->url, rq->prev_url, &rq->stat, rq->pri, NC_CACHE, 0,
-		         0, 0);
+		         0, 0, -1);
 	} else {
 		rq->hold = 0;
 		rq->dont_print_error = 1;
@@ -266,11 +266,8 @@ cert_forall(struct cert_dialog *cs, int yes)
 	foreach (struct object_request, rq, lrq, requests)
 		if (rq->term == cs->term && rq->hold == HOLD_CERT
 		    && rq->stat.state == cs->state) {
-			unsigned char *host = get_host_name(rq->url);
-			if (!strcmp(cast_const_char host,
-			            cast_const_char cs->host))
+			if (url_host_eq(rq->purl, cs->host))
 				cert_action(rq, yes);
-			free(host);
 		}
 }
 
@@ -361,6 +358,7 @@ request_object(struct terminal *term, unsigned char *url,
 	rq->stat.data = rq;
 	rq->orig_url = stracpy(url);
 	rq->url = stracpy(url);
+	rq->purl = hold_parsed_url(rq->url);
 	rq->pri = pri;
 	rq->cache = cache;
 	rq->upcall = upcall;
@@ -373,7 +371,7 @@ request_object(struct terminal *term, unsigned char *url,
 		*rqp = rq;
 	rq->count = obj_req_count++;
 	add_to_list(requests, rq);
-	load_url(url, prev_url, &rq->stat, pri, cache, 0, allow_flags, 0);
+	load_url(url, prev_url, &rq->stat, pri, cache, 0, allow_flags, 0, -1);
 }
 
 static void
@@ -434,8 +432,10 @@ objreq_end(struct status *stat, void *data)
 				allow_flags = get_allow_flags(rq->url);
 				free(rq->url);
 				rq->url = u;
+				release_parsed_url(&rq->purl);
+				rq->purl = hold_parsed_url(u);
 				load_url(u, rq->prev_url, &rq->stat, rq->pri,
-				         cache, 0, allow_flags, 0);
+				         cache, 0, allow_flags, 0, -1);
 				return;
 			} else {
 maxrd:
@@ -458,7 +458,7 @@ maxrd:
 					goto maxrd;
 				change_connection(stat, NULL, PRI_CANCEL);
 				load_url(rq->url, rq->prev_url, &rq->stat,
-				         rq->pri, NC_RELOAD, 0, 0, 0);
+				         rq->pri, NC_RELOAD, 0, 0, 0, -1);
 				return;
 			}
 			user = get_user_name(rq->url);
@@ -557,6 +557,7 @@ release_object_get_stat(struct object_request **rqq, struct status *news,
 		rq->ce->refcount--;
 	free(rq->orig_url);
 	free(rq->url);
+	release_parsed_url(&rq->purl);
 	free(rq->prev_url);
 	free(rq->goto_position);
 	del_from_list(rq);
@@ -581,6 +582,15 @@ detach_object_connection(struct object_request *rq, off_t pos)
 	}
 }
 
+int
+sink_object_connection(struct object_request *rq, int fd, off_t *pos)
+{
+	if (rq->state == O_WAITING || rq->state == O_FAILED
+	    || rq->refcount != 1)
+		return -1;
+	return set_connection_sink(&rq->stat, fd, pos, 1);
+}
+
 void
 clone_object(struct object_request *rq, struct object_request **rqq)
 {
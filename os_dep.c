@@ -7,6 +7,7 @@
 #include <limits.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "links.h"
@@ -373,6 +374,9 @@ is_xterm(void)
 	return xt;
 }
 
+static int af_unix_socket = -1;
+static struct sockaddr_un af_unix_addr;
+
 void
 close_fork_tty(void)
 {
@@ -385,6 +389,8 @@ close_fork_tty(void)
 	struct k_conn *k = NULL;
 	struct list_head *lk;
 	int rs;
+	if (af_unix_socket != -1)
+		EINTRLOOP(rs, close(af_unix_socket));
 	EINTRLOOP(rs, close(signal_pipe[0]));
 	EINTRLOOP(rs, close(signal_pipe[1]));
 	if (terminal_pipe[1] != -1)
@@ -599,3 +605,70 @@ os_detach_console(void)
 		_exit(0);
 #endif
 }
+
+static void
+af_unix_connection(void *p)
+{
+	int ns;
+	if ((ns = c_accept(af_unix_socket, NULL, NULL)) == -1)
+		return;
+	if (!init_term(ns, ns, win_func))
+		close_socket(&ns);
+}
+
+/* Connect to an instance that already owns the socket in links_home, or
+ * start listening on it so that later instances share our connections,
+ * caches and sessions. Returns the socket connected to the master instance
+ * or -1 if this process is the master. */
+int
+bind_to_af_unix(void)
+{
+	struct sockaddr_un *sa = &af_unix_addr;
+	int s, rs, e, retried = 0;
+	if (!links_home)
+		return -1;
+	memset(sa, 0, sizeof(struct sockaddr_un));
+	sa->sun_family = AF_UNIX;
+	if ((size_t)snprintf(sa->sun_path, sizeof sa->sun_path, "%ssocket",
+	                     (char *)links_home)
+	    >= sizeof sa->sun_path)
+		return -1;
+again:
+	s = c_socket(PF_UNIX, SOCK_STREAM, 0);
+	EINTRLOOP(rs, connect(s, (struct sockaddr *)sa, sizeof *sa));
+	if (!rs)
+		return s;
+	/* a master that died left its socket behind */
+	if (errno == ECONNREFUSED)
+		EINTRLOOP(rs, unlink(sa->sun_path));
+	close_socket(&s);
+	s = c_socket(PF_UNIX, SOCK_STREAM, 0);
+	EINTRLOOP(rs, bind(s, (struct sockaddr *)sa, sizeof *sa));
+	if (rs) {
+		e = errno;
+		close_socket(&s);
+		/* another instance got there first */
+		if (e == EADDRINUSE && !retried++)
+			goto again;
+		return -1;
+	}
+	EINTRLOOP(rs, listen(s, 100));
+	if (rs) {
+		close_socket(&s);
+		EINTRLOOP(rs, unlink(sa->sun_path));
+		return -1;
+	}
+	af_unix_socket = s;
+	set_handlers(s, af_unix_connection, NULL, NULL);
+	return -1;
+}
+
+void
+af_unix_close(void)
+{
+	int rs;
+	if (af_unix_socket == -1)
+		return;
+	close_socket(&af_unix_socket);
+	EINTRLOOP(rs, unlink(af_unix_addr.sun_path));
+}
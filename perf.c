@@ -0,0 +1,103 @@
+/* perf.c
+ * Latency statistics
+ * This file is a part of the Links program, released under GPL.
+ */
+
+#include "links.h"
+
+/*
+ * Every stage keeps a histogram of its durations in milliseconds. Bucket b
+ * holds the durations whose highest set bit is b - 1 (bucket 0 holds zero),
+ * so adding a sample costs a few shifts and the percentiles in the report
+ * are exact to within a factor of two.
+ */
+
+#define PERF_BUCKETS 24
+
+struct perf_stat {
+	unsigned long count;
+	uttime sum;
+	uttime max;
+	unsigned long hist[PERF_BUCKETS];
+};
+
+static struct perf_stat perf[PERF_N];
+
+static unsigned char *const perf_names[PERF_N] = {
+	TEXT_(T_DNS_LOOKUP),      TEXT_(T_TCP_CONNECT),   TEXT_(T_TLS_HANDSHAKE),
+	TEXT_(T_RESPONSE_TIME),   TEXT_(T_BODY_DOWNLOAD), TEXT_(T_DECOMPRESSION),
+	TEXT_(T_FORMATTING),      TEXT_(T_DRAWING),       TEXT_(T_TIMER_LAG),
+};
+
+int perf_stats = 0;
+
+void
+perf_add(int stage, uttime t)
+{
+	struct perf_stat *p = &perf[stage];
+	int b = 0;
+	while (b < PERF_BUCKETS - 1 && t >> b)
+		b++;
+	p->count++;
+	p->sum += t;
+	if (t > p->max)
+		p->max = t;
+	p->hist[b]++;
+}
+
+/* Upper bound of the duration that pct percent of the samples do not
+ * exceed. */
+static uttime
+perf_percentile(struct perf_stat *p, unsigned pct)
+{
+	unsigned long n = 0;
+	uttime u;
+	int b;
+	for (b = 0; b < PERF_BUCKETS - 1; b++) {
+		n += p->hist[b];
+		if ((uttime)n * 100 >= (uttime)p->count * pct)
+			break;
+	}
+	u = ((uttime)1 << b) - 1;
+	if (b == PERF_BUCKETS - 1 || u > p->max)
+		u = p->max;
+	return u;
+}
+
+static size_t
+add_ms_to_str(unsigned char **s, size_t l, unsigned char *text, uttime t,
+              struct terminal *term)
+{
+	l = add_to_str(s, l, cast_uchar ", ");
+	l = add_to_str(s, l, get_text_translation(text, term));
+	l = add_chr_to_str(s, l, ' ');
+	l = add_num_to_str(s, l, t);
+	l = add_chr_to_str(s, l, ' ');
+	return add_to_str(s, l, get_text_translation(TEXT_(T_MS), term));
+}
+
+size_t
+add_perf_info(unsigned char **s, size_t l, struct terminal *term)
+{
+	int i;
+	for (i = 0; i < PERF_N; i++) {
+		struct perf_stat *p = &perf[i];
+		if (i)
+			l = add_to_str(s, l, cast_uchar ".\n");
+		l = add_to_str(s, l, get_text_translation(perf_names[i], term));
+		l = add_to_str(s, l, cast_uchar ": ");
+		l = add_num_to_str(s, l, p->count);
+		l = add_chr_to_str(s, l, ' ');
+		l = add_to_str(s, l, get_text_translation(TEXT_(T_SAMPLES), term));
+		if (!p->count)
+			continue;
+		l = add_ms_to_str(s, l, TEXT_(T_AVERAGE), p->sum / p->count,
+		                  term);
+		l = add_ms_to_str(s, l, TEXT_(T_MEDIAN_AT_MOST),
+		                  perf_percentile(p, 50), term);
+		l = add_ms_to_str(s, l, TEXT_(T_90_PERCENT_AT_MOST),
+		                  perf_percentile(p, 90), term);
+		l = add_ms_to_str(s, l, TEXT_(T_MAXIMUM), p->max, term);
+	}
+	return add_chr_to_str(s, l, '.');
+}
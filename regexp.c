@@ -0,0 +1,859 @@
+/* regexp.c
+ * Regular expression search
+ * This file is a part of the Links program, released under GPL.
+ */
+
+#include <limits.h>
+
+#include "links.h"
+
+/*
+ * A pattern is compiled to two Thompson NFAs, one for the pattern and one
+ * for the pattern read backwards. They are run as lazily built DFAs: a set
+ * of NFA states becomes a DFA state when it is first reached and its
+ * transitions on ASCII characters are cached.
+ *
+ * Matches are found in two passes: a backward scan with the reversed
+ * pattern marks every position where a match starts, then an anchored
+ * forward scan from each marked position not covered by the previous match
+ * finds the longest match there. A forward scan gives up after
+ * RE_MAX_MATCH characters. It also stops where it reaches a position in a
+ * DFA state that an earlier scan had there, and takes the outcome of that
+ * scan, so overlapping scans do not walk the same text again.
+ *
+ * The ends of lines are spaces in the searched text. Only a literal space
+ * matches them, '.' and the classes do not, so that ".*" stops at the end
+ * of the line.
+ */
+
+#define RE_CHAR  0
+#define RE_ANY   1
+#define RE_CLASS 2
+#define RE_SPLIT 3
+#define RE_EMPTY 4
+#define RE_MATCH 5
+
+#define RE_MAX_STATES  4096
+#define RE_MAX_DSTATES 1024
+#define RE_HASH_SIZE   2048
+#define RE_DIRECT      128 /* next[RE_DIRECT] is the end of a line */
+#define RE_MAX_REPEAT  1000
+#define RE_MAX_MATCH   4096
+#define RE_MEMO_SIZE   16384
+
+#define REGEXP_CACHE 8
+
+struct re_state {
+	int type;
+	int out, out1;
+	char_t c;
+	int cls;
+};
+
+struct re_class {
+	int neg;
+	int n;
+	char_t *r; /* pairs of first and last character */
+};
+
+struct re_nfa {
+	struct re_state *s;
+	int n;
+	int start;
+};
+
+struct re_dstate {
+	int match;
+	int next[RE_DIRECT + 1];
+	int n;
+	int set[1];
+};
+
+struct re_dfa {
+	struct re_nfa *nfa;
+	int unanchored;
+	int *sset; /* closure of the start state */
+	int nsset;
+	int start;
+	struct re_dstate **d;
+	int nd;
+	unsigned flushes; /* the numbers of DFA states change on a flush */
+	int hash[RE_HASH_SIZE]; /* index to d + 1 */
+};
+
+/* the end of the longest match after the DFA state state is reached at
+ * position pos of the text, or -1 */
+struct re_memo {
+	int pos;
+	int state;
+	int end;
+};
+
+struct regexp {
+	list_entry_1st;
+	struct re_nfa fwd, rev;
+	struct re_class *cls;
+	int ncls;
+	struct re_dfa rscan, fscan;
+	unsigned *mark;
+	unsigned gen;
+	int nmark;
+	int *stack;
+	int *tmp;
+	int cp;
+	unsigned char pattern[1];
+};
+
+struct re_frag {
+	int start;
+	int out; /* list of unpatched pointers */
+};
+
+struct re_parse {
+	struct regexp *re;
+	struct re_nfa *nfa;
+	char_t *p;
+	int pos, len;
+	int cp;
+	int reverse;
+	int err;
+};
+
+static int
+re_new(struct re_parse *rp, int type)
+{
+	struct re_nfa *nfa = rp->nfa;
+	struct re_state *s;
+	if (nfa->n >= RE_MAX_STATES) {
+		rp->err = 1;
+		return 0;
+	}
+	if (!(nfa->n & (ALLOC_GR - 1)))
+		nfa->s = xreallocarray(nfa->s, nfa->n + ALLOC_GR,
+		                       sizeof(struct re_state));
+	s = &nfa->s[nfa->n];
+	s->type = type;
+	s->out = s->out1 = -1;
+	s->c = 0;
+	s->cls = -1;
+	return nfa->n++;
+}
+
+static int *
+re_field(struct re_nfa *nfa, int ref)
+{
+	return ref & 1 ? &nfa->s[ref >> 1].out1 : &nfa->s[ref >> 1].out;
+}
+
+static void
+re_patch(struct re_nfa *nfa, int l, int t)
+{
+	while (l != -1) {
+		int *f = re_field(nfa, l);
+		l = *f;
+		*f = t;
+	}
+}
+
+static int
+re_append(struct re_nfa *nfa, int l1, int l2)
+{
+	int l = l1;
+	if (l1 == -1)
+		return l2;
+	while (*re_field(nfa, l) != -1)
+		l = *re_field(nfa, l);
+	*re_field(nfa, l) = l2;
+	return l1;
+}
+
+static struct re_frag
+re_single(struct re_parse *rp, int type)
+{
+	struct re_frag f;
+	f.start = re_new(rp, type);
+	f.out = f.start * 2;
+	return f;
+}
+
+static struct re_frag
+re_cat(struct re_parse *rp, struct re_frag a, struct re_frag b)
+{
+	struct re_frag f;
+	if (rp->reverse) {
+		f = a;
+		a = b;
+		b = f;
+	}
+	re_patch(rp->nfa, a.out, b.start);
+	f.start = a.start;
+	f.out = b.out;
+	return f;
+}
+
+static struct re_frag
+re_split(struct re_parse *rp, struct re_frag a, int type)
+{
+	struct re_frag f;
+	int s = re_new(rp, RE_SPLIT);
+	if (rp->err)
+		return a;
+	rp->nfa->s[s].out = a.start;
+	switch (type) {
+	case '*':
+		re_patch(rp->nfa, a.out, s);
+		f.start = s;
+		f.out = s * 2 + 1;
+		break;
+	case '+':
+		re_patch(rp->nfa, a.out, s);
+		f.start = a.start;
+		f.out = s * 2 + 1;
+		break;
+	default:
+		f.start = s;
+		f.out = re_append(rp->nfa, a.out, s * 2 + 1);
+		break;
+	}
+	return f;
+}
+
+static void
+re_add_range(struct re_parse *rp, struct re_class *c, char_t a, char_t b)
+{
+	char_t ua, ub;
+	if (a > b)
+		return;
+	if (!(c->n & (ALLOC_GR - 1)))
+		c->r = xreallocarray(c->r, c->n + ALLOC_GR, 2 * sizeof(char_t));
+	c->r[c->n * 2] = a;
+	c->r[c->n * 2 + 1] = b;
+	c->n++;
+	/* the searched text is in upper case */
+	ua = charset_upcase(a, rp->cp);
+	ub = charset_upcase(b, rp->cp);
+	if (ua != a || ub != b)
+		re_add_range(rp, c, ua, ub);
+}
+
+static int
+re_builtin_class(struct re_parse *rp, struct re_class *c, char_t e)
+{
+	switch (e) {
+	case 'd':
+	case 'D':
+		re_add_range(rp, c, '0', '9');
+		break;
+	case 'w':
+	case 'W':
+		re_add_range(rp, c, '0', '9');
+		re_add_range(rp, c, 'A', 'Z');
+		re_add_range(rp, c, 'a', 'z');
+		re_add_range(rp, c, '_', '_');
+		break;
+	case 's':
+	case 'S':
+		re_add_range(rp, c, 0, ' ');
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+static struct re_class *
+re_new_class(struct re_parse *rp, int *idx)
+{
+	struct regexp *re = rp->re;
+	struct re_class *c;
+	if (!(re->ncls & (ALLOC_GR - 1)))
+		re->cls = xreallocarray(re->cls, re->ncls + ALLOC_GR,
+		                        sizeof(struct re_class));
+	c = &re->cls[*idx = re->ncls++];
+	c->neg = 0;
+	c->n = 0;
+	c->r = NULL;
+	return c;
+}
+
+static struct re_frag
+re_class(struct re_parse *rp)
+{
+	struct re_frag f = re_single(rp, RE_CLASS);
+	struct re_class *c;
+	int first = 1;
+	if (rp->err)
+		return f;
+	c = re_new_class(rp, &rp->nfa->s[f.start].cls);
+	if (rp->pos < rp->len && rp->p[rp->pos] == '^') {
+		c->neg = 1;
+		rp->pos++;
+	}
+	while (1) {
+		char_t a, b;
+		if (rp->pos >= rp->len) {
+			rp->err = 1;
+			return f;
+		}
+		a = rp->p[rp->pos++];
+		if (a == ']' && !first)
+			break;
+		first = 0;
+		if (a == '\\' && rp->pos < rp->len) {
+			a = rp->p[rp->pos++];
+			if (re_builtin_class(rp, c, a))
+				continue;
+		}
+		b = a;
+		if (rp->pos + 1 < rp->len && rp->p[rp->pos] == '-'
+		    && rp->p[rp->pos + 1] != ']') {
+			b = rp->p[rp->pos + 1];
+			rp->pos += 2;
+			if (b == '\\' && rp->pos < rp->len)
+				b = rp->p[rp->pos++];
+		}
+		re_add_range(rp, c, a, b);
+	}
+	return f;
+}
+
+static struct re_frag re_alt(struct re_parse *);
+
+static struct re_frag
+re_atom(struct re_parse *rp)
+{
+	struct re_frag f;
+	char_t c = rp->p[rp->pos++];
+	switch (c) {
+	case '(':
+		f = re_alt(rp);
+		if (rp->pos >= rp->len || rp->p[rp->pos] != ')')
+			rp->err = 1;
+		rp->pos++;
+		return f;
+	case '.':
+		return re_single(rp, RE_ANY);
+	case '[':
+		return re_class(rp);
+	case ')':
+	case '*':
+	case '+':
+	case '?':
+		rp->err = 1;
+		return re_single(rp, RE_EMPTY);
+	case '\\':
+		if (rp->pos >= rp->len) {
+			rp->err = 1;
+			return re_single(rp, RE_EMPTY);
+		}
+		c = rp->p[rp->pos++];
+		if (c == 'd' || c == 'w' || c == 's' || c == 'D' || c == 'W'
+		    || c == 'S') {
+			struct re_class *cl;
+			f = re_single(rp, RE_CLASS);
+			if (rp->err)
+				return f;
+			cl = re_new_class(rp, &rp->nfa->s[f.start].cls);
+			cl->neg = c < 'a';
+			re_builtin_class(rp, cl, c);
+			return f;
+		}
+		/*-fallthrough*/
+	default:
+		f = re_single(rp, RE_CHAR);
+		if (!rp->err)
+			rp->nfa->s[f.start].c = charset_upcase(c, rp->cp);
+		return f;
+	}
+}
+
+static int
+re_get_count(struct re_parse *rp, int *n)
+{
+	int v = 0, digits = 0;
+	while (rp->pos < rp->len && rp->p[rp->pos] >= '0'
+	       && rp->p[rp->pos] <= '9') {
+		v = v * 10 + (int)(rp->p[rp->pos++] - '0');
+		if (v > RE_MAX_REPEAT)
+			return -1;
+		digits++;
+	}
+	*n = v;
+	return digits;
+}
+
+/* Parse an atom and the repetition operators that follow it up to stop. */
+static struct re_frag
+re_repeat(struct re_parse *rp, int stop)
+{
+	int p0 = rp->pos;
+	struct re_frag f = re_atom(rp);
+	while (!rp->err && rp->pos < stop) {
+		char_t c = rp->p[rp->pos];
+		int m, n, q, p1, i;
+		struct re_frag g;
+		if (c == '*' || c == '+' || c == '?') {
+			rp->pos++;
+			f = re_split(rp, f, c);
+			continue;
+		}
+		if (c != '{')
+			break;
+		q = rp->pos++;
+		if (re_get_count(rp, &m) <= 0) {
+			rp->err = 1;
+			break;
+		}
+		n = m;
+		if (rp->pos < rp->len && rp->p[rp->pos] == ',') {
+			rp->pos++;
+			if (!re_get_count(rp, &n))
+				n = -1;
+			else if (n < m)
+				rp->err = 1;
+		}
+		if (rp->pos >= rp->len || rp->p[rp->pos] != '}')
+			rp->err = 1;
+		if (rp->err)
+			break;
+		p1 = ++rp->pos;
+		/* f is the first copy, the others are parsed again */
+		for (i = 1; i < (n < 0 ? m : n) && !rp->err; i++) {
+			rp->pos = p0;
+			g = re_repeat(rp, q);
+			f = re_cat(rp, f, i < m ? g : re_split(rp, g, '?'));
+		}
+		if (!n)
+			f = re_single(rp, RE_EMPTY);
+		else if (!m)
+			f = re_split(rp, f, n < 0 ? '*' : '?');
+		else if (n < 0) {
+			rp->pos = p0;
+			g = re_repeat(rp, q);
+			f = re_cat(rp, f, re_split(rp, g, '*'));
+		}
+		rp->pos = p1;
+	}
+	return f;
+}
+
+static struct re_frag
+re_concat(struct re_parse *rp)
+{
+	struct re_frag f;
+	int have = 0;
+	while (!rp->err && rp->pos < rp->len && rp->p[rp->pos] != '|'
+	       && rp->p[rp->pos] != ')') {
+		struct re_frag g = re_repeat(rp, rp->len);
+		f = have ? re_cat(rp, f, g) : g;
+		have = 1;
+	}
+	if (!have)
+		f = re_single(rp, RE_EMPTY);
+	return f;
+}
+
+static struct re_frag
+re_alt(struct re_parse *rp)
+{
+	struct re_frag f = re_concat(rp);
+	while (!rp->err && rp->pos < rp->len && rp->p[rp->pos] == '|') {
+		struct re_frag g;
+		int s;
+		rp->pos++;
+		g = re_concat(rp);
+		s = re_new(rp, RE_SPLIT);
+		if (rp->err)
+			break;
+		rp->nfa->s[s].out = f.start;
+		rp->nfa->s[s].out1 = g.start;
+		f.start = s;
+		f.out = re_append(rp->nfa, f.out, g.out);
+	}
+	return f;
+}
+
+static int
+re_compile_nfa(struct regexp *re, struct re_nfa *nfa, char_t *p, int len,
+               int cp, int reverse)
+{
+	struct re_parse rp;
+	struct re_frag f;
+	rp.re = re;
+	rp.nfa = nfa;
+	rp.p = p;
+	rp.pos = 0;
+	rp.len = len;
+	rp.cp = cp;
+	rp.reverse = reverse;
+	rp.err = 0;
+	f = re_alt(&rp);
+	if (rp.pos < rp.len)
+		rp.err = 1;
+	if (!rp.err) {
+		int m = re_new(&rp, RE_MATCH);
+		re_patch(nfa, f.out, m);
+		nfa->start = f.start;
+	}
+	return rp.err ? -1 : 0;
+}
+
+static int
+re_class_match(struct re_class *c, char_t ch)
+{
+	int i;
+	for (i = 0; i < c->n; i++)
+		if (ch >= c->r[i * 2] && ch <= c->r[i * 2 + 1])
+			return !c->neg;
+	return c->neg;
+}
+
+/* Mark the closure of state s with the current generation and store the
+ * states that consume a character or match into re->tmp. */
+static void
+re_closure(struct regexp *re, struct re_nfa *nfa, int s, int *n)
+{
+	int sp = 0;
+	re->stack[sp++] = s;
+	while (sp) {
+		struct re_state *st;
+		s = re->stack[--sp];
+		if (re->mark[s] == re->gen)
+			continue;
+		re->mark[s] = re->gen;
+		st = &nfa->s[s];
+		if (st->type == RE_SPLIT) {
+			re->stack[sp++] = st->out1;
+			re->stack[sp++] = st->out;
+		} else if (st->type == RE_EMPTY)
+			re->stack[sp++] = st->out;
+		else
+			re->tmp[(*n)++] = s;
+	}
+}
+
+static void
+re_next_gen(struct regexp *re)
+{
+	if (!++re->gen) {
+		memset(re->mark, 0, re->nmark * sizeof(unsigned));
+		re->gen = 1;
+	}
+}
+
+static int
+comp_int(const void *i1, const void *i2)
+{
+	return *(const int *)i1 - *(const int *)i2;
+}
+
+static unsigned
+re_set_hash(int *set, int n)
+{
+	unsigned h = n;
+	while (n--)
+		h = h * 31 + *set++;
+	return h & (RE_HASH_SIZE - 1);
+}
+
+static void
+re_flush_dfa(struct re_dfa *dfa)
+{
+	int i;
+	for (i = 0; i < dfa->nd; i++)
+		free(dfa->d[i]);
+	dfa->nd = 0;
+	dfa->start = -1;
+	dfa->flushes++;
+	memset(dfa->hash, 0, sizeof dfa->hash);
+}
+
+static int
+re_intern(struct re_dfa *dfa, int *set, int n)
+{
+	unsigned h = re_set_hash(set, n);
+	struct re_dstate *d;
+	int i;
+	for (; dfa->hash[h]; h = (h + 1) & (RE_HASH_SIZE - 1)) {
+		d = dfa->d[dfa->hash[h] - 1];
+		if (d->n == n && !memcmp(d->set, set, n * sizeof(int)))
+			return dfa->hash[h] - 1;
+	}
+	if (dfa->nd == RE_MAX_DSTATES)
+		return -1;
+	if (!dfa->d)
+		dfa->d = xreallocarray(NULL, RE_MAX_DSTATES,
+		                       sizeof(struct re_dstate *));
+	d = xmalloc(sizeof(struct re_dstate) + n * sizeof(int));
+	d->match = 0;
+	for (i = 0; i <= RE_DIRECT; i++)
+		d->next[i] = -1;
+	d->n = n;
+	memcpy(d->set, set, n * sizeof(int));
+	for (i = 0; i < n; i++)
+		if (dfa->nfa->s[set[i]].type == RE_MATCH)
+			d->match = 1;
+	dfa->d[dfa->nd] = d;
+	dfa->hash[h] = dfa->nd + 1;
+	return dfa->nd++;
+}
+
+static int
+re_start(struct regexp *re, struct re_dfa *dfa)
+{
+	int n = 0;
+	if (dfa->start >= 0)
+		return dfa->start;
+	/* the start state of an unanchored scan is implicit in all states */
+	if (!dfa->unanchored) {
+		re_next_gen(re);
+		re_closure(re, dfa->nfa, dfa->nfa->start, &n);
+		qsort(re->tmp, n, sizeof(int), comp_int);
+	}
+	if ((dfa->start = re_intern(dfa, re->tmp, n)) < 0) {
+		re_flush_dfa(dfa);
+		dfa->start = re_intern(dfa, re->tmp, n);
+	}
+	return dfa->start;
+}
+
+static int
+re_step(struct regexp *re, struct re_dfa *dfa, int ds, char_t c, int eol)
+{
+	struct re_dstate *d = dfa->d[ds];
+	int i, n = 0, next;
+	int slot = eol ? RE_DIRECT : c < RE_DIRECT ? (int)c : -1;
+	if (slot >= 0 && d->next[slot] >= 0)
+		return d->next[slot];
+	re_next_gen(re);
+	for (i = 0; i < d->n + (dfa->unanchored ? dfa->nsset : 0); i++) {
+		int s = i < d->n ? d->set[i] : dfa->sset[i - d->n];
+		struct re_state *st = &dfa->nfa->s[s];
+		switch (st->type) {
+		case RE_CHAR:
+			if (st->c != c)
+				continue;
+			break;
+		case RE_CLASS:
+			if (eol || !re_class_match(&re->cls[st->cls], c))
+				continue;
+			break;
+		case RE_ANY:
+			if (eol)
+				continue;
+			break;
+		default:
+			continue;
+		}
+		re_closure(re, dfa->nfa, st->out, &n);
+	}
+	qsort(re->tmp, n, sizeof(int), comp_int);
+	if ((next = re_intern(dfa, re->tmp, n)) < 0) {
+		/* d was freed by the flush */
+		re_flush_dfa(dfa);
+		return re_intern(dfa, re->tmp, n);
+	}
+	if (slot >= 0)
+		d->next[slot] = next;
+	return next;
+}
+
+static void
+re_init_dfa(struct regexp *re, struct re_dfa *dfa, struct re_nfa *nfa,
+            int unanchored)
+{
+	int n = 0;
+	dfa->nfa = nfa;
+	dfa->unanchored = unanchored;
+	dfa->d = NULL;
+	dfa->nd = 0;
+	dfa->start = -1;
+	memset(dfa->hash, 0, sizeof dfa->hash);
+	re_next_gen(re);
+	re_closure(re, nfa, nfa->start, &n);
+	dfa->sset = xreallocarray(NULL, n ? n : 1, sizeof(int));
+	memcpy(dfa->sset, re->tmp, n * sizeof(int));
+	dfa->nsset = n;
+}
+
+static void
+regexp_free(struct regexp *re)
+{
+	int i;
+	re_flush_dfa(&re->rscan);
+	re_flush_dfa(&re->fscan);
+	free(re->rscan.d);
+	free(re->fscan.d);
+	free(re->rscan.sset);
+	free(re->fscan.sset);
+	for (i = 0; i < re->ncls; i++)
+		free(re->cls[i].r);
+	free(re->cls);
+	free(re->fwd.s);
+	free(re->rev.s);
+	free(re->mark);
+	free(re->stack);
+	free(re->tmp);
+	free(re);
+}
+
+static struct regexp *
+regexp_compile(unsigned char *pattern, int cp)
+{
+	struct regexp *re;
+	size_t sl = strlen(cast_const_char pattern);
+	unsigned char *p = pattern;
+	char_t *pat;
+	int len, n;
+	re = mem_calloc(sizeof(struct regexp) + sl);
+	strcpy(cast_char re->pattern, cast_const_char pattern);
+	re->cp = cp;
+	pat = xmalloc((sl + 1) * sizeof(char_t));
+	for (len = 0; *p; len++) {
+		if (!cp)
+			GET_UTF_8(p, pat[len]);
+		else
+			pat[len] = *p++;
+	}
+	if (re_compile_nfa(re, &re->fwd, pat, len, cp, 0)
+	    || re_compile_nfa(re, &re->rev, pat, len, cp, 1)) {
+		free(pat);
+		regexp_free(re);
+		return NULL;
+	}
+	free(pat);
+	n = re->fwd.n > re->rev.n ? re->fwd.n : re->rev.n;
+	re->mark = mem_calloc(n * sizeof(unsigned));
+	re->nmark = n;
+	/* every state is pushed at most once per out pointer */
+	re->stack = xreallocarray(NULL, 2 * n + 1, sizeof(int));
+	re->tmp = xreallocarray(NULL, n, sizeof(int));
+	re_init_dfa(re, &re->rscan, &re->rev, 1);
+	re_init_dfa(re, &re->fscan, &re->fwd, 0);
+	return re;
+}
+
+/* Get the compiled pattern for the charset cp from the cache or compile it.
+ * Returns NULL on a syntax error. */
+struct regexp *
+regexp_get(struct list_head *cache, unsigned char *pattern, int cp)
+{
+	struct regexp *re = NULL;
+	struct list_head *lre;
+	int n = 0;
+	foreach (struct regexp, re, lre, *cache)
+		if (re->cp == cp
+		    && !strcmp(cast_const_char re->pattern,
+		               cast_const_char pattern)) {
+			del_from_list(re);
+			add_to_list(*cache, re);
+			return re;
+		}
+	if (!(re = regexp_compile(pattern, cp)))
+		return NULL;
+	add_to_list(*cache, re);
+	foreach (struct regexp, re, lre, *cache)
+		if (++n > REGEXP_CACHE) {
+			lre = lre->prev;
+			del_from_list(re);
+			regexp_free(re);
+		}
+	return list_struct(cache->next, struct regexp);
+}
+
+void
+free_regexps(struct list_head *cache)
+{
+	while (!list_empty(*cache)) {
+		struct regexp *re = list_struct(cache->next, struct regexp);
+		del_from_list(re);
+		regexp_free(re);
+	}
+}
+
+#define re_eol_at(eol, i) ((eol)[(i) >> 3] & (1 << ((i) & 7)))
+
+static struct re_memo *
+re_memo_find(struct re_memo *memo, int pos, int state)
+{
+	return &memo[((unsigned)pos * 31 + (unsigned)state) & (RE_MEMO_SIZE - 1)];
+}
+
+/* Call fn for each leftmost-longest, non-overlapping and non-empty match in
+ * the first n characters of s, stored with width bytes per character. The
+ * bits set in eol mark the spaces that end a line. */
+void
+regexp_matches(struct regexp *re, const unsigned char *s, int width, int n,
+               const unsigned char *eol, void (*fn)(void *, int, int),
+               void *data)
+{
+	unsigned char *starts;
+	struct re_memo *memo, *m;
+	int *path, *pend;
+	unsigned flushes;
+	int i, j, d, end;
+	if (n <= 0)
+		return;
+	starts = mem_calloc(n / 8 + 1);
+	d = re_start(re, &re->rscan);
+	for (i = n - 1; i >= 0; i--) {
+		d = re_step(re, &re->rscan, d, search_chr_at(s, width, i),
+		            re_eol_at(eol, i));
+		if (re->rscan.d[d]->match)
+			starts[i >> 3] |= 1 << (i & 7);
+	}
+	memo = xreallocarray(NULL, RE_MEMO_SIZE, sizeof(struct re_memo));
+	memset(memo, -1, RE_MEMO_SIZE * sizeof(struct re_memo));
+	path = xreallocarray(NULL, RE_MAX_MATCH, sizeof(int));
+	pend = xreallocarray(NULL, RE_MAX_MATCH, sizeof(int));
+	flushes = re->fscan.flushes;
+	for (i = 0; i < n; i++) {
+		if (!starts[i >> 3]) {
+			i |= 7;
+			continue;
+		}
+		if (!(starts[i >> 3] & (1 << (i & 7))))
+			continue;
+		d = re_start(re, &re->fscan);
+		end = -1;
+		for (j = i; j < n && j - i < RE_MAX_MATCH; j++) {
+			if (flushes != re->fscan.flushes) {
+				/* the numbers of the states have changed */
+				memset(memo, -1,
+				       RE_MEMO_SIZE * sizeof(struct re_memo));
+				flushes = re->fscan.flushes;
+			}
+			m = re_memo_find(memo, j, d);
+			if (m->pos == j && m->state == d) {
+				end = m->end;
+				break;
+			}
+			m->pos = j;
+			m->state = d;
+			m->end = -1;
+			path[j - i] = (int)(m - memo);
+			d = re_step(re, &re->fscan, d, search_chr_at(s, width, j),
+			            re_eol_at(eol, j));
+			if (!re->fscan.d[d]->n)
+				break;
+			pend[j - i] = re->fscan.d[d]->match ? j + 1 : -1;
+		}
+		/* store the end of the longest match from each position of the
+		 * path, later scans that come to the same state there stop */
+		while (j-- > i) {
+			if (end < pend[j - i])
+				end = pend[j - i];
+			m = &memo[path[j - i]];
+			if (m->pos == j)
+				m->end = end;
+		}
+		if (end > i) {
+			fn(data, i, end - i);
+			i = end - 1;
+		}
+	}
+	free(starts);
+	free(memo);
+	free(path);
+	free(pend);
+}
@@ -83,17 +83,11 @@ connection_disappeared(struct connection *c, tcount count)
 static struct h_conn *
 is_host_on_list(struct connection *c)
 {
-	char *ho = (char *)get_host_name(c->url);
 	struct h_conn *h = NULL;
 	struct list_head *lh;
-	if (!ho)
-		return NULL;
 	foreach (struct h_conn, h, lh, h_conns)
-		if (!strcmp((const char *)h->host, ho)) {
-			free(ho);
+		if (url_host_eq(c->purl, h->host))
 			return h;
-		}
-	free(ho);
 	return NULL;
 }
 
@@ -178,22 +172,18 @@ setcstate(struct connection *c, int state)
 static struct k_conn *
 is_host_on_keepalive_list(struct connection *c)
 {
-	char *ho = (char *)get_keepalive_id(c->url);
-	const int po = get_port(c->url);
+	const int po = c->purl->prot >= 0 ? c->purl->port_num : -1;
 	void (*ph)(struct connection *);
 	struct k_conn *h = NULL;
 	struct list_head *lh;
 	if (!(ph = get_protocol_handle(c->url)))
 		return NULL;
-	if (!ho || po < 0)
+	if (po < 0)
 		return NULL;
 	foreach (struct k_conn, h, lh, keepalive_connections)
 		if (h->protocol == ph && h->port == po
-		    && !strcmp((char *)h->host, ho)) {
-			free(ho);
+		    && url_keepalive_eq(c->purl, h->host))
 			return h;
-		}
-	free(ho);
 	return NULL;
 }
 
@@ -255,6 +245,7 @@ free_connection_data(struct connection *c)
 	c->running = 0;
 	if (c->dnsquery)
 		kill_dns_request(&c->dnsquery);
+	stop_waiting_for_sink(c);
 	free(c->buffer);
 	free(c->newconn);
 	free(c->info);
@@ -317,7 +308,10 @@ del_connection(struct connection *c)
 			delete_cache_entry(ce);
 	} else if (ce)
 		trim_cache_entry(ce);
+	stop_waiting_for_sink(c);
+	free(c->sink_buf);
 	free(c->url);
+	release_parsed_url(&c->purl);
 	free(c->prev_url);
 	free(c->ssl);
 	free(c);
@@ -371,6 +365,22 @@ del_keepalive_socket(struct k_conn *kc)
 	free(kc);
 }
 
+/* A TLS 1.3 server sends its session tickets after the handshake, so a
+ * socket parked right after the handshake gets readable without being
+ * closed. Read the tickets and look if anything else is there. */
+static int
+keepalive_socket_closed(struct k_conn *kc)
+{
+	unsigned char b;
+	int r;
+	if (!can_read(kc->conn))
+		return 0;
+	if (!kc->ssl || kc->ssl == DUMMY)
+		return 1;
+	r = SSL_peek(kc->ssl->ssl, &b, 1);
+	return r > 0 || SSL_get_error(kc->ssl->ssl, r) != SSL_ERROR_WANT_READ;
+}
+
 static struct timer *keepalive_timeout = NULL;
 
 static void
@@ -392,7 +402,8 @@ check_keepalive_connections(void)
 		keepalive_timeout = NULL;
 	}
 	foreach (struct k_conn, kc, lkc, keepalive_connections) {
-		if (can_read(kc->conn) || ct - kc->add_time > kc->timeout) {
+		if (keepalive_socket_closed(kc)
+		    || ct - kc->add_time > kc->timeout) {
 			lkc = lkc->prev;
 			del_keepalive_socket(kc);
 		} else
@@ -471,16 +482,8 @@ try_to_suspend_connection(struct connection *c, unsigned char *ho)
 			continue;
 		if (d->unrestartable == 2 && getpri(d) < PRI_CANCEL)
 			continue;
-		if (ho) {
-			unsigned char *h;
-			if (!(h = get_host_name(d->url)))
-				continue;
-			if (strcmp((const char *)h, (const char *)ho)) {
-				free(h);
-				continue;
-			}
-			free(h);
-		}
+		if (ho && !url_host_eq(d->purl, ho))
+			continue;
 		suspend_connection(d);
 		return 0;
 	}
@@ -694,7 +697,7 @@ again2:
 			setcstate(c, S_INTERRUPTED);
 			del_connection(c);
 			goto again2;
-		} else if (c->est_length
+		} else if (c->dropped || c->est_length
 		               > (long)memory_cache_size * MAX_CACHED_OBJECT
 		           || c->from > (long)memory_cache_size
 		                            * MAX_CACHED_OBJECT) {
@@ -770,10 +773,11 @@ disallow_url(unsigned char *url, int allow_flags)
 
 /* prev_url is a pointer to previous url or NULL */
 /* prev_url will NOT be deallocated */
+/* a new connection requests only the bytes before range_end unless it is -1 */
 void
 load_url(unsigned char *url, unsigned char *prev_url, struct status *stat,
          int pri, int no_cache, int no_compress, int allow_flags,
-         off_t position)
+         off_t position, off_t range_end)
 {
 	struct cache_entry *e = NULL;
 	struct connection *c = NULL;
@@ -841,9 +845,9 @@ skip_cache:
 	}
 	u = get_proxy(url);
 	foreach (struct connection, c, lc, queue)
-		if (!c->detached
+		if (!c->detached && !c->preconnect
 		    && !strcmp((const char *)c->url, (const char *)u)) {
-			if (c->from < position)
+			if (c->from < position || range_end != -1)
 				continue;
 			if (no_compress && !c->no_compress) {
 				unsigned char *enc;
@@ -862,6 +866,7 @@ skip_cache:
 				}
 			}
 			free(u);
+			c->dropped = 0;
 			if (getpri(c) > pri) {
 				del_from_list(c);
 				c->pri[pri]++;
@@ -881,6 +886,7 @@ skip_cache:
 	c = mem_calloc(sizeof(struct connection));
 	c->count = connection_count++;
 	c->url = u;
+	c->purl = hold_parsed_url(u);
 	c->prev_url = stracpy(prev_url);
 	c->running = 0;
 	c->prev_error = 0;
@@ -916,9 +922,13 @@ skip_cache:
 	    http_options.no_compression || no_compress || dmp == D_SOURCE;
 	c->prg.timer = NULL;
 	c->timer = NULL;
+	c->sink = -1;
+	c->sink_pos = NULL;
+	c->range_end = range_end > c->from ? range_end : -1;
 	if (position || must_detach) {
 		if (new_cache_entry(cast_uchar "", &c->cache)) {
 			free(c->url);
+			release_parsed_url(&c->purl);
 			free(c->prev_url);
 			free(c);
 			if (stat) {
@@ -946,10 +956,198 @@ ret:
 	return;
 }
 
+/*
+ * A preconnect only makes the TCP and TLS handshakes to the origin of url
+ * and parks the socket on the keepalive list, where the next request to
+ * that origin picks it up. It has no status and runs at PRI_CANCEL, so it
+ * takes only a slot that nothing else wants; check_queue drops it if it
+ * cannot start right away.
+ */
+void
+preconnect_url(unsigned char *url)
+{
+	struct connection *c = NULL;
+	struct list_head *lc;
+	unsigned char *u;
+	int n = 0;
+	if (casecmp(url, cast_uchar "http://", 7)
+	    && casecmp(url, cast_uchar "https://", 8))
+		return;
+	if (proxies.only_proxies || get_proxy_string(url))
+		return;
+	if (active_connections + 1 >= max_connections)
+		return;
+	foreach (struct connection, c, lc, queue)
+		n += c->preconnect;
+	if (n >= PRECONNECT_MAX)
+		return;
+	if (!(u = get_keepalive_id(url)))
+		return;
+	add_to_strn(&u, cast_uchar "/");
+	c = mem_calloc(sizeof(struct connection));
+	c->url = u;
+	c->purl = hold_parsed_url(u);
+	if (c->purl->port_num < 0 || is_host_on_list(c)
+	    || is_host_on_keepalive_list(c)) {
+		release_parsed_url(&c->purl);
+		free(u);
+		free(c);
+		return;
+	}
+	c->count = connection_count++;
+	c->pri[PRI_CANCEL] = 1;
+	c->no_cache = NC_CACHE;
+	c->sock1 = c->sock2 = -1;
+	c->netcfg_stamp = netcfg_stamp;
+	init_list(c->statuss);
+	c->est_length = -1;
+	c->unrestartable = 2;
+	c->no_compress = 1;
+	c->sink = -1;
+	c->range_end = -1;
+	c->preconnect = 1;
+	add_to_queue(c);
+	setcstate(c, S_WAIT);
+	register_bottom_half(check_queue, NULL);
+}
+
+/* The handshakes of a preconnect are done */
+void
+preconnected(struct connection *c)
+{
+	setcstate(c, S__OK);
+	add_keepalive_socket(c, PRECONNECT_TIMEOUT, 0);
+}
+
+/* Drop the preconnects that do not go to the host of url */
+void
+abort_preconnects(unsigned char *url)
+{
+	struct connection *c = NULL;
+	struct list_head *lc;
+	unsigned char *host = get_host_name(url);
+	foreach (struct connection, c, lc, queue)
+		if (c->preconnect && !url_host_eq(c->purl, host)) {
+			lc = lc->prev;
+			setcstate(c, S_INTERRUPTED);
+			abort_connection(c);
+		}
+	free(host);
+}
+
+/*
+ * Pages that are likely to be read next are loaded into the cache at
+ * PRI_PRELOAD, so any other request takes their connection slots first.
+ * The bytes they receive are charged to an allowance that refills at
+ * PREFETCH_RATE bytes per second up to PREFETCH_BURST; no new page is
+ * started while it is used up and a page that overdraws it, or that would
+ * not fit in the memory cache, is cancelled.
+ */
+struct prefetch {
+	list_entry_1st;
+	struct status stat;
+	off_t charged;
+	unsigned char url[1];
+};
+
+static struct list_head prefetches = { &prefetches, &prefetches };
+static off_t prefetch_allowance = PREFETCH_BURST;
+static uttime prefetch_refill_time = 0;
+
+/* If nobody else waits for the page, check_queue aborts its connection;
+ * this may be called from the connection's own status callback. */
+static void
+free_prefetch(struct prefetch *p)
+{
+	if (p->stat.state >= 0) {
+		struct connection *c = p->stat.c;
+		if (c->statuss.next == &p->stat.list_entry
+		    && p->stat.list_entry.next == &c->statuss)
+			c->dropped = 1;
+		change_connection(&p->stat, NULL, PRI_CANCEL);
+	}
+	del_from_list(p);
+	free(p);
+}
+
+static void
+prefetch_end(struct status *stat, void *p_)
+{
+	struct prefetch *p = (struct prefetch *)p_;
+	struct connection *c = stat->c;
+	const off_t max = (off_t)memory_cache_size * MAX_CACHED_OBJECT;
+	if (c && c->received > p->charged)
+		prefetch_allowance -= c->received - p->charged;
+	if (c)
+		p->charged = c->received;
+	if (stat->state < 0) {
+		free_prefetch(p);
+		return;
+	}
+	if (c
+	    && (prefetch_allowance < 0 || c->est_length > max || c->from > max))
+		free_prefetch(p);
+}
+
+void
+prefetch_url(unsigned char *url, unsigned char *prev_url)
+{
+	struct prefetch *p = NULL;
+	struct list_head *lp;
+	struct connection *c = NULL;
+	struct list_head *lc;
+	struct cache_entry *e;
+	uttime now = get_time();
+	size_t sl;
+	if (casecmp(url, cast_uchar "http://", 7)
+	    && casecmp(url, cast_uchar "https://", 8))
+		return;
+	prefetch_allowance += (off_t)((now - prefetch_refill_time)
+	                              * PREFETCH_RATE / 1000);
+	if (prefetch_allowance > PREFETCH_BURST)
+		prefetch_allowance = PREFETCH_BURST;
+	prefetch_refill_time = now;
+	if (prefetch_allowance <= 0
+	    || list_size(&prefetches) >= PREFETCH_PAGES_MAX)
+		return;
+	foreach (struct connection, c, lc, queue)
+		if (getpri(c) < PRI_PRELOAD)
+			return;
+	foreach (struct prefetch, p, lp, prefetches)
+		if (!strcmp(cast_const_char p->url, cast_const_char url))
+			return;
+	if (!find_in_cache(url, &e)) {
+		e->refcount--;
+		if (!e->incomplete)
+			return;
+	}
+	sl = strlen(cast_const_char url);
+	p = mem_calloc(sizeof(struct prefetch) + sl);
+	strcpy(cast_char p->url, cast_const_char url);
+	p->stat.end = prefetch_end;
+	p->stat.data = p;
+	add_to_list(prefetches, p);
+	load_url(url, prev_url, &p->stat, PRI_PRELOAD, NC_CACHE, 0, 0, 0, -1);
+}
+
+/* Cancel the prefetched pages other than url */
+void
+abort_prefetches(unsigned char *url)
+{
+	struct prefetch *p = NULL;
+	struct list_head *lp;
+	foreach (struct prefetch, p, lp, prefetches)
+		if (!url || strcmp(cast_const_char p->url, cast_const_char url)) {
+			lp = lp->prev;
+			free_prefetch(p);
+		}
+}
+
 void
 change_connection(struct status *oldstat, struct status *newstat, int newpri)
 {
 	struct connection *c;
+	int err = 0;
 	const int oldpri = oldstat->pri;
 	if (oldstat->state < 0) {
 		if (newstat) {
@@ -974,6 +1172,8 @@ change_connection(struct status *oldstat, struct status *newstat, int newpri)
 	c->pri[newpri]++;
 	del_from_list(oldstat);
 	oldstat->state = S_INTERRUPTED;
+	if (c->sink != -1)
+		err = drop_connection_sink(c);
 	if (newstat) {
 		newstat->prg = &c->prg;
 		add_to_list(c->statuss, newstat);
@@ -983,7 +1183,10 @@ change_connection(struct status *oldstat, struct status *newstat, int newpri)
 		newstat->c = c;
 		newstat->ce = c->cache;
 	}
-	if (c->detached && !newstat) {
+	if (err < 0) {
+		setcstate(c, err);
+		abort_connection(c);
+	} else if (c->detached && !newstat) {
 		setcstate(c, S_INTERRUPTED);
 		abort_connection(c);
 	}
@@ -1041,6 +1244,55 @@ detach_done:
 	}
 }
 
+/* Make the connection write the body to fd instead of the cache. This is
+ * possible only if stat is the only user and it has consumed everything up
+ * to c->from. *pos is advanced as the data are written. */
+int
+set_connection_sink(struct status *stat, int fd, off_t *pos,
+                    int dont_check_refcount)
+{
+	struct connection *c;
+	int i, n_users;
+	if (stat->state < 0)
+		return -1;
+	c = stat->c;
+	if (c->sink != -1)
+		return c->sink == fd && c->sink_pos == pos ? 0 : -1;
+	if (!c->cache || (!dont_check_refcount && c->cache->refcount))
+		return -1;
+	if (c->from != *pos)
+		return -1;
+	n_users = 0;
+	for (i = 0; i < PRI_CANCEL; i++)
+		n_users += c->pri[i];
+	if (n_users != 1)
+		return -1;
+	if (!c->detached) {
+		detach_cache_entry(c->cache);
+		c->detached = 1;
+	}
+	free_entry_to(c->cache, *pos);
+	c->sink = fd;
+	c->sink_pos = pos;
+	c->sink_no_splice = 0;
+	return 0;
+}
+
+/* Return the length of the object if parts of it can be requested by
+ * other connections, -1 otherwise. */
+off_t
+get_connection_range_length(struct status *stat)
+{
+	struct connection *c;
+	if (stat->state != S_TRANS)
+		return -1;
+	c = stat->c;
+	if (c->unrestartable || c->no_cache >= NC_IF_MOD
+	    || !is_connection_seekable(c))
+		return -1;
+	return c->est_length;
+}
+
 static uttime
 get_timeout_value(struct connection *c)
 {
@@ -1048,7 +1300,7 @@ get_timeout_value(struct connection *c)
 	if (c->state == S_CONN || c->state == S_CONN_ANOTHER)
 		t = timeout_multiple_addresses
 		    * (c->tries < 1 ? 1 : c->tries + 1);
-	else if (c->unrestartable)
+	else if (c->unrestartable && !c->preconnect)
 		t = unrestartable_receive_timeout;
 	else
 		t = receive_timeout;
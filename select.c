@@ -40,6 +40,7 @@ static int w_max;
 struct timer {
 	list_entry_1st;
 	uttime interval;
+	uttime expire;
 	void (*func)(void *);
 	void *data;
 };
@@ -304,10 +305,17 @@ event_callback(int h, short ev, void *data)
 	CHK_BH;
 }
 
+static void
+timer_lag(struct timer *tm, uttime now)
+{
+	perf_add(PERF_TIMER_LAG, now > tm->expire ? now - tm->expire : 0);
+}
+
 static void
 timer_callback(int h, short ev, void *data)
 {
 	struct timer *tm = data;
+	timer_lag(tm, get_time());
 	pr(tm->func(tm->data))
 	{
 	}
@@ -466,7 +474,8 @@ static uttime last_time;
 static void
 check_timers(void)
 {
-	uttime interval = get_time() - last_time;
+	uttime now = get_time();
+	uttime interval = now - last_time;
 	struct timer *t = NULL;
 	struct list_head *lt;
 	foreach (struct timer, t, lt, timers) {
@@ -479,6 +488,7 @@ check_timers(void)
 		struct timer *t = list_struct(timers.next, struct timer);
 		if (t->interval)
 			break;
+		timer_lag(t, now);
 		pr(t->func(t->data)) break;
 		kill_timer(t);
 		CHK_BH;
@@ -493,6 +503,7 @@ install_timer(uttime t, void (*func)(void *), void *data)
 	unsigned char *q = xmalloc(sizeof_struct_event + sizeof(struct timer));
 	tm = (struct timer *)(q + sizeof_struct_event);
 	tm->interval = t;
+	tm->expire = get_time() + t;
 	tm->func = func;
 	tm->data = data;
 	if (event_enabled) {
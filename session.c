@@ -13,6 +13,7 @@ struct list_head downloads = { &downloads, &downloads };
 static void abort_and_delete_download(void *);
 static void undisplay_download(void *);
 static void increase_download_file(unsigned char **f);
+static void download_data(struct status *, void *);
 static void copy_additional_files(struct additional_files **a);
 static struct location *new_location(void);
 static void destroy_location(struct location *loc);
@@ -59,6 +60,7 @@ static const struct s_msg_dsc msg_dsc[] = {
 	{ S_CONN_ANOTHER,        TEXT_(T_MAKING_CONNECTION_TO_ANOTHER_ADDRESS)},
 	{ S_SOCKS_NEG,           TEXT_(T_SOCKS_NEGOTIATION)                   },
 	{ S_SSL_NEG,             TEXT_(T_SSL_NEGOTIATION)                     },
+	{ S_SENDING,             TEXT_(T_SENDING_REQUEST)                     },
 	{ S_SENT,                TEXT_(T_REQUEST_SENT)                        },
 	{ S_LOGIN,               TEXT_(T_LOGGING_IN)                          },
 	{ S_GETH,                TEXT_(T_GETTING_HEADERS)                     },
@@ -253,6 +255,18 @@ get_stat_msg(struct status *stat, struct terminal *term)
 		}
 		return m;
 	}
+	if (stat->state == S_SENDING && stat->prg) {
+		unsigned char *m = NULL;
+		size_t l;
+		l = add_to_str(&m, 0, get_text_translation(TEXT_(T_SENT), term));
+		l = add_chr_to_str(&m, l, ' ');
+		l = add_xnum_to_str(&m, l, stat->prg->pos);
+		l = add_chr_to_str(&m, l, ' ');
+		l = add_to_str(&m, l, get_text_translation(TEXT_(T_OF), term));
+		l = add_chr_to_str(&m, l, ' ');
+		add_xnum_to_str(&m, l, stat->prg->size);
+		return m;
+	}
 	return stracpy(get_text_translation(get_err_msg(stat->state), term));
 }
 
@@ -298,6 +312,8 @@ change_screen_status(struct session *ses)
 	if (stat) {
 		if (stat->state == S__OK)
 			ses->st = print_current_link(ses);
+		if (stat->state == S__OK && !ses->st)
+			ses->st = print_current_search(ses);
 		if (!ses->st)
 			ses->st = ses->default_status
 			              ? stracpy(ses->default_status)
@@ -497,6 +513,19 @@ delete_download_file(struct download *down)
 	}
 }
 
+static void
+cancel_download_segments(struct download *down)
+{
+	while (!list_empty(down->segments)) {
+		struct download_segment *seg = list_struct(
+		    down->segments.next, struct download_segment);
+		if (seg->stat.state >= 0)
+			change_connection(&seg->stat, NULL, PRI_CANCEL);
+		del_from_list(seg);
+		free(seg);
+	}
+}
+
 static void
 abort_download(void *down_)
 {
@@ -511,6 +540,7 @@ abort_download(void *down_)
 		delete_window(down->ask);
 	if (down->stat.state >= 0)
 		change_connection(&down->stat, NULL, PRI_CANCEL);
+	cancel_download_segments(down);
 	free(down->url);
 	close_download_file(down);
 	if (down->prog) {
@@ -595,20 +625,26 @@ download_abort_function(struct dialog_data *dlg)
 	down->win = NULL;
 }
 
+/* The progress of a segmented download is merged over all its streams */
+static struct remaining_info *
+download_prg(struct download *down)
+{
+	return down->seg_total > 0 ? &down->prg : down->stat.prg;
+}
+
 static int
-test_percentage(struct status *stat)
+test_percentage(struct remaining_info *prg)
 {
-	return stat->prg->size > 0;
+	return prg->size > 0;
 }
 
 static int
-download_meter(int size, struct status *stat)
+download_meter(int size, struct remaining_info *prg)
 {
 	int m;
-	if (!stat->prg->size)
+	if (!prg->size)
 		return 0;
-	m = (int)((double)size * (double)stat->prg->pos
-	          / (double)stat->prg->size);
+	m = (int)((double)size * (double)prg->pos / (double)prg->size);
 	if (m < 0)
 		m = 0;
 	if (m > size)
@@ -623,11 +659,11 @@ download_percentage(struct download *down, int pad)
 	size_t l;
 	int perc;
 	struct status *stat = &down->stat;
-	if (stat->state != S_TRANS || !test_percentage(stat))
+	if (stat->state != S_TRANS || !test_percentage(download_prg(down)))
 		return stracpy(cast_uchar "");
 	s = NULL;
 	l = 0;
-	perc = download_meter(100, stat);
+	perc = download_meter(100, download_prg(down));
 	if (pad) {
 		if (perc < 10)
 			l = add_chr_to_str(&s, l, ' ');
@@ -650,26 +686,27 @@ download_window_function(struct dialog_data *dlg)
 	int show_percentage = 0;
 	unsigned char *m, *u;
 	struct status *stat = &down->stat;
+	struct remaining_info *prg = download_prg(down);
 	redraw_below_window(dlg->win);
 	down->win = dlg->win;
-	if (stat->state == S_TRANS && stat->prg->elapsed / 100) {
+	if (stat->state == S_TRANS && prg->elapsed / 100) {
 		size_t l;
 		m = NULL;
 		t = 1;
 		l = add_to_str(&m, 0,
 		               get_text_translation(TEXT_(T_RECEIVED), term));
 		l = add_chr_to_str(&m, l, ' ');
-		l = add_xnum_to_str(&m, l, stat->prg->pos);
-		if (stat->prg->size >= 0) {
+		l = add_xnum_to_str(&m, l, prg->pos);
+		if (prg->size >= 0) {
 			l = add_chr_to_str(&m, l, ' ');
 			l = add_to_str(&m, l,
 			               get_text_translation(TEXT_(T_OF), term));
 			l = add_chr_to_str(&m, l, ' ');
-			l = add_xnum_to_str(&m, l, stat->prg->size);
+			l = add_xnum_to_str(&m, l, prg->size);
 			l = add_chr_to_str(&m, l, ' ');
 		}
 		l = add_chr_to_str(&m, l, '\n');
-		if (stat->prg->elapsed >= CURRENT_SPD_AFTER * SPD_DISP_TIME)
+		if (prg->elapsed >= CURRENT_SPD_AFTER * SPD_DISP_TIME)
 			l = add_to_str(
 			    &m, l,
 			    get_text_translation(TEXT_(T_AVERAGE_SPEED), term));
@@ -678,10 +715,10 @@ download_window_function(struct dialog_data *dlg)
 			    &m, l, get_text_translation(TEXT_(T_SPEED), term));
 		l = add_chr_to_str(&m, l, ' ');
 		l = add_xnum_to_str(&m, l,
-		                    (long long)stat->prg->loaded * 10
-		                        / (stat->prg->elapsed / 100));
+		                    (long long)prg->loaded * 10
+		                        / (prg->elapsed / 100));
 		l = add_to_str(&m, l, cast_uchar "/s");
-		if (stat->prg->elapsed >= CURRENT_SPD_AFTER * SPD_DISP_TIME) {
+		if (prg->elapsed >= CURRENT_SPD_AFTER * SPD_DISP_TIME) {
 			l = add_to_str(&m, l, cast_uchar ", ");
 			l = add_to_str(
 			    &m, l,
@@ -689,7 +726,7 @@ download_window_function(struct dialog_data *dlg)
 			l = add_chr_to_str(&m, l, ' ');
 			l = add_xnum_to_str(
 			    &m, l,
-			    stat->prg->cur_loaded
+			    prg->cur_loaded
 				/ (CURRENT_SPD_SEC * SPD_DISP_TIME / 1000));
 			l = add_to_str(&m, l, cast_uchar "/s");
 		}
@@ -697,29 +734,29 @@ download_window_function(struct dialog_data *dlg)
 		l = add_to_str(
 		    &m, l, get_text_translation(TEXT_(T_ELAPSED_TIME), term));
 		l = add_chr_to_str(&m, l, ' ');
-		l = add_time_to_str(&m, l, stat->prg->elapsed / 1000);
-		if (stat->prg->size >= 0 && stat->prg->loaded > 0) {
+		l = add_time_to_str(&m, l, prg->elapsed / 1000);
+		if (prg->size >= 0 && prg->loaded > 0) {
 			l = add_to_str(&m, l, cast_uchar ", ");
 			l = add_to_str(&m, l,
 			               get_text_translation(
 					   TEXT_(T_ESTIMATED_TIME), term));
 			l = add_chr_to_str(&m, l, ' ');
-			/*add_time_to_str(&m, &l, stat->prg->elapsed / 1000 *
-			 * stat->prg->size / stat->prg->loaded * 1000 -
-			 * stat->prg->elapsed);*/
-			/*add_time_to_str(&m, &l, (stat->prg->size -
-			 * stat->prg->pos) / ((longlong)stat->prg->loaded * 10 /
-			 * (stat->prg->elapsed / 100)));*/
+			/*add_time_to_str(&m, &l, prg->elapsed / 1000 *
+			 * prg->size / prg->loaded * 1000 -
+			 * prg->elapsed);*/
+			/*add_time_to_str(&m, &l, (prg->size -
+			 * prg->pos) / ((longlong)prg->loaded * 10 /
+			 * (prg->elapsed / 100)));*/
 			l = add_time_to_str(
 			    &m, l,
-			    (uttime)((stat->prg->size - stat->prg->pos)
-			             / ((double)stat->prg->loaded * 1000
-			                / stat->prg->elapsed)));
+			    (uttime)((prg->size - prg->pos)
+			             / ((double)prg->loaded * 1000
+			                / prg->elapsed)));
 		}
 	} else
 		m = stracpy(
 		    get_text_translation(get_err_msg(stat->state), term));
-	show_percentage = t && test_percentage(stat);
+	show_percentage = t && test_percentage(prg);
 	u = display_url(term, down->url, 1);
 	max_text_width(term, u, &max, AL_LEFT);
 	min_text_width(term, u, &min, AL_LEFT);
@@ -766,7 +803,7 @@ download_window_function(struct dialog_data *dlg)
 		y++;
 		set_only_char(term, x, y, '[', 0);
 		set_only_char(term, x + p + 1, y, ']', 0);
-		fill_area(term, x + 1, y, download_meter(p, stat), 1,
+		fill_area(term, x + 1, y, download_meter(p, prg), 1,
 		          CHAR_DIALOG_METER, COLOR_DIALOG_METER);
 		q = download_percentage(down, 1);
 		print_text(term, x + p + 2, y, (int)strlen(cast_const_char q),
@@ -1032,6 +1069,173 @@ no_e2big:;
 	return 0;
 }
 
+/* Fill down->prg, which the download dialog shows, with the progress of the
+ * stream in down->stat and of all segments. */
+static void
+merge_download_progress(struct download *down)
+{
+	struct remaining_info *r = &down->prg;
+	struct download_segment *seg = NULL;
+	struct list_head *lseg;
+	if (down->seg_total <= 0 || down->stat.state < 0)
+		return;
+	*r = *down->stat.prg;
+	r->timer = NULL;
+	r->size = down->seg_total;
+	r->pos = down->last_pos;
+	r->loaded += down->seg_loaded;
+	foreach (struct download_segment, seg, lseg, down->segments) {
+		r->pos += seg->pos - seg->start;
+		if (seg->stat.state >= 0) {
+			r->loaded += seg->stat.prg->loaded;
+			r->cur_loaded += seg->stat.prg->cur_loaded;
+		}
+	}
+}
+
+static void
+download_segment_data(struct status *stat, void *seg_)
+{
+	struct download_segment *seg = (struct download_segment *)seg_;
+	struct download *down = seg->down;
+	struct cache_entry *ce;
+	struct fragment *frag = NULL;
+	struct list_head *lfrag;
+	if (!(ce = stat->ce) || (stat->state >= S_WAIT && stat->state < S_TRANS))
+		goto end_store;
+	foreach (struct fragment, frag, lfrag, ce->frag) {
+		if (frag->offset < seg->start) {
+			/* the server ignored the range, use a single stream */
+			down->seg_total = -1;
+			cancel_download_segments(down);
+			return;
+		}
+		while (frag->offset <= seg->pos
+		       && frag->offset + frag->length > seg->pos
+		       && seg->pos < seg->end) {
+			off_t l = frag->offset + frag->length - seg->pos;
+			ssize_t w;
+			if (l > seg->end - seg->pos)
+				l = seg->end - seg->pos;
+			if (l > INT_MAX)
+				l = INT_MAX;
+			EINTRLOOP(w, pwrite(down->handle,
+			                    frag->data + (seg->pos - frag->offset),
+			                    (size_t)l, seg->pos - down->file_shift));
+			if (w <= 0) {
+				/* let the main stream write it and report
+				 * the error */
+				cancel_download_segments(down);
+				return;
+			}
+			seg->pos += w;
+		}
+	}
+	if (seg->pos >= seg->end) {
+		if (stat->state >= 0) {
+			down->seg_loaded += stat->prg->loaded;
+			change_connection(stat, NULL, PRI_CANCEL);
+		}
+		return;
+	}
+	if (stat->state >= 0) {
+		detach_connection(stat, seg->pos, 0, 1);
+		return;
+	}
+end_store:
+	if (stat->state < 0) {
+		/* the stream before this segment will download the range */
+		if (stat->prg)
+			down->seg_loaded += stat->prg->loaded;
+		del_from_list(seg);
+		free(seg);
+	}
+}
+
+/* Split the rest of the download into ranges fetched by parallel
+ * connections. The stream in down->stat keeps the first one. */
+static void
+start_download_segments(struct download *down, struct status *stat)
+{
+	off_t len, part;
+	int i, n = download_segments;
+	down->seg_total = -1;
+	if (n > max_connections_to_host)
+		n = max_connections_to_host;
+	if (n < 2 || (len = get_connection_range_length(stat)) <= down->last_pos)
+		return;
+	if ((len - down->last_pos) / n < DOWNLOAD_SEGMENT_MIN)
+		n = (int)((len - down->last_pos) / DOWNLOAD_SEGMENT_MIN);
+	if (n < 2)
+		return;
+	part = (len - down->last_pos) / n;
+	down->seg_total = len;
+	for (i = 1; i < n; i++) {
+		struct download_segment *seg =
+		    mem_calloc(sizeof(struct download_segment));
+		seg->down = down;
+		seg->stat.data = seg;
+		seg->start = seg->pos = down->last_pos + part * i;
+		seg->end = i == n - 1 ? len : seg->start + part;
+		seg->stat.end = download_segment_data;
+		add_to_list_end(down->segments, seg);
+		load_url(down->url, NULL, &seg->stat, PRI_DOWNLOAD, NC_CACHE, 1,
+		         get_allow_flags(down->url), seg->start, seg->end);
+		/* the server ignored the range of a segment that was in the
+		 * cache already; one that failed was dropped and is covered
+		 * by the stream before it */
+		if (down->seg_total == -1)
+			return;
+	}
+}
+
+/* The stream in down->stat reached the first segment. Continue with the
+ * connection of that segment, or after it if it is already complete. */
+static void
+download_next_segment(struct download *down)
+{
+	struct download_segment *seg;
+	off_t rs;
+	merge_download_progress(down);
+	if (down->stat.state >= 0) {
+		down->seg_loaded += down->stat.prg->loaded;
+		change_connection(&down->stat, NULL, PRI_CANCEL);
+	}
+	down->stat.ce = NULL;
+	down->stream_end = -1;
+	while (!list_empty(down->segments)) {
+		seg = list_struct(down->segments.next, struct download_segment);
+		if (seg->start != down->last_pos)
+			break;
+		del_from_list(seg);
+		down->last_pos = seg->pos;
+		if (seg->stat.state >= 0) {
+			change_connection(&seg->stat, &down->stat,
+			                  PRI_DOWNLOAD);
+			down->stream_end = seg->end;
+			free(seg);
+			break;
+		}
+		free(seg);
+	}
+	EINTRLOOP(rs, lseek(down->handle, down->last_pos - down->file_shift,
+	                    SEEK_SET));
+	if (rs == -1) {
+		download_file_error(down, errno);
+		abort_download(down);
+		return;
+	}
+	if (down->stat.state >= 0)
+		return;
+	if (down->last_pos < down->seg_total) {
+		load_url(down->url, NULL, &down->stat, PRI_DOWNLOAD, NC_CACHE,
+		         1, get_allow_flags(down->url), down->last_pos, -1);
+		return;
+	}
+	down->stat.state = S__OK;
+	download_data(&down->stat, down);
+}
+
 static void
 download_data(struct status *stat, void *down_)
 {
@@ -1078,7 +1282,7 @@ download_data(struct status *stat, void *down_)
 				free(prev_down_url);
 				load_url(down->url, NULL, &down->stat,
 				         PRI_DOWNLOAD, cache, 1, allow_flags,
-				         down->last_pos);
+				         down->last_pos, -1);
 				return;
 			} else {
 				if (stat->state >= 0)
@@ -1102,21 +1306,28 @@ download_data(struct status *stat, void *down_)
 		}
 	}
 	if (!down->decompress) {
+		off_t limit = -1;
+		if (!list_empty(down->segments))
+			limit = list_struct(down->segments.next,
+			                    struct download_segment)
+			            ->start;
 		foreachback (struct fragment, frag, lfrag, ce->frag)
 			if (frag->offset <= down->last_pos)
 				goto have_frag;
 		foreach (struct fragment, frag, lfrag, ce->frag) {
 have_frag:
 			while (frag->offset <= down->last_pos
-			       && frag->offset + frag->length
-			              > down->last_pos) {
+			       && frag->offset + frag->length > down->last_pos
+			       && down->last_pos != limit) {
+				off_t l = frag->length
+				          - (down->last_pos - frag->offset);
+				if (limit != -1 && l > limit - down->last_pos)
+					l = limit - down->last_pos;
 				if (download_write(
 					down,
 					frag->data
 					    + (down->last_pos - frag->offset),
-					frag->length
-					    - (down->last_pos
-				               - frag->offset))) {
+					l)) {
 det_abt:
 					detach_connection(stat, down->last_pos,
 					                  0, 0);
@@ -1125,10 +1336,28 @@ det_abt:
 				}
 			}
 		}
-	}
-	if (!down->decompress)
+		if (down->last_pos == limit) {
+			download_next_segment(down);
+			return;
+		}
+		if (!down->seg_total && stat->state == S_TRANS)
+			start_download_segments(down, stat);
+		if (stat->state == S_TRANS && list_empty(down->segments)
+		    && !set_connection_sink(stat, down->handle,
+		                            &down->last_pos, 0))
+			down->downloaded_something = 1;
 		detach_connection(stat, down->last_pos, 0, 0);
+	}
 end_store:
+	if (stat->state == S__OK && down->stream_end != -1
+	    && down->last_pos == down->stream_end
+	    && down->last_pos < down->seg_total) {
+		/* the segment after this one failed, fetch the rest */
+		down->stream_end = -1;
+		load_url(down->url, NULL, &down->stat, PRI_DOWNLOAD, NC_CACHE,
+		         1, get_allow_flags(down->url), down->last_pos, -1);
+		return;
+	}
 	if (stat->state < 0) {
 		if (down->decompress) {
 			struct session *ses = get_download_ses(down);
@@ -1193,6 +1422,7 @@ end_store:
 		abort_download(down);
 		return;
 	}
+	merge_download_progress(down);
 	if (down->win) {
 		struct links_event ev = { EV_REDRAW, 0, 0, 0 };
 		ev.x = down->win->term->x;
@@ -1456,9 +1686,11 @@ start_download(struct session *ses, unsigned char *file, int mode)
 	down->handle = h;
 	down->ses = ses;
 	down->remotetime = 0;
+	init_list(down->segments);
+	down->stream_end = -1;
 	add_to_list(downloads, down);
 	load_url(url, NULL, &down->stat, PRI_DOWNLOAD, NC_CACHE, 1,
-	         ses->dn_allow_flags, down->last_pos);
+	         ses->dn_allow_flags, down->last_pos, -1);
 	display_download(ses->term, down, ses);
 }
 
@@ -1514,12 +1746,13 @@ f_need_reparse(struct f_data *f)
 
 static struct f_data *
 format_html(struct f_data_c *fd, struct object_request *rq, unsigned char *url,
-            struct document_options *opt, int *cch)
+            struct document_options *opt, int *cch, struct url_joins **uj)
 {
 	struct f_data *f;
 	pr(if (cch) *cch = 0;
 	   if (!rq->ce || !(f = init_formatted(opt))) goto nul; f->fd = fd;
 	   f->ses = fd->ses; f->time_to_get = -get_time();
+	   f->url_joins = *uj; *uj = NULL;
 	   clone_object(rq, &f->rq); if (f->rq->ce) {
 		   unsigned char *start;
 		   size_t len;
@@ -1561,7 +1794,8 @@ format_html(struct f_data_c *fd, struct object_request *rq, unsigned char *url,
 				   }
 			   }
 	   } else f->use_tag = 0;
-	   f->time_to_get += get_time();) nul : return NULL;
+	   f->time_to_get += get_time();
+	   perf_add(PERF_FORMAT, f->time_to_get);) nul : return NULL;
 	return f;
 }
 
@@ -1769,6 +2003,7 @@ cached_format_html(struct f_data_c *fd, struct object_request *rq,
 	struct session *ses = fd->ses;
 	struct f_data *f = NULL;
 	struct list_head *lf;
+	struct url_joins *uj = NULL;
 	if (fd->marginwidth != -1) {
 		int marg =
 		    (fd->marginwidth + G_HTML_MARGIN - 1) / G_HTML_MARGIN;
@@ -1814,8 +2049,25 @@ cached_format_html(struct f_data_c *fd, struct object_request *rq,
 		    || (rq->ce && rq->ce->length >= 1000000))
 			print_progress(ses, TEXT_(T_FORMATTING_DOCUMENT));
 	}
+	/* the links resolve the same at any width, keep them */
+	if (fd->f_data
+	    && !strcmp(cast_const_char fd->f_data->rq->url,
+	               cast_const_char url)) {
+		uj = fd->f_data->url_joins;
+		fd->f_data->url_joins = NULL;
+	} else if (ses) {
+		foreach (struct f_data, f, lf, ses->format_cache)
+			if (f->url_joins
+			    && !strcmp(cast_const_char f->rq->url,
+			               cast_const_char url)) {
+				uj = f->url_joins;
+				f->url_joins = NULL;
+				break;
+			}
+	}
 	detach_f_data(&fd->f_data);
-	f = format_html(fd, rq, url, opt, cch);
+	f = format_html(fd, rq, url, opt, cch, &uj);
+	free_url_joins(&uj);
 	if (f)
 		f->fd = fd;
 	shrink_memory(SH_CHECK_QUOTA);
@@ -1925,6 +2177,7 @@ html_interpret(struct f_data_c *fd, int report_status)
 	struct list_head *lsf;
 	int cch;
 	struct document_options o;
+	fd->format_pending = 0;
 	if (!fd->loc)
 		goto d;
 	if (fd->f_data) {
@@ -1998,6 +2251,40 @@ rd:
 d:;
 }
 
+static struct f_data_c *
+find_pending_frame(struct f_data_c *f)
+{
+	struct f_data_c *fd = NULL, *p;
+	struct list_head *lfd;
+	if (f->format_pending)
+		return f;
+	foreach (struct f_data_c, fd, lfd, f->subframes)
+		if ((p = find_pending_frame(fd)))
+			return p;
+	return NULL;
+}
+
+static void
+format_pending_frame(void *ses_)
+{
+	struct session *ses = (struct session *)ses_;
+	struct f_data_c *fd;
+	ses->format_timer = NULL;
+	fd = current_frame(ses);
+	if (!fd || !fd->format_pending)
+		fd = find_pending_frame(ses->screen);
+	if (!fd)
+		return;
+	html_interpret_recursive(fd);
+	draw_fd(fd);
+	if (!ses->format_timer && find_pending_frame(ses->screen))
+		ses->format_timer =
+		    install_timer(0, format_pending_frame, ses);
+}
+
+/* The frames are formatted one per pass of the main loop, the current one
+ * first, so that the terminal doesn't wait for the whole frameset. Until
+ * then they show the old formatting. */
 void
 html_interpret_recursive(struct f_data_c *f)
 {
@@ -2005,8 +2292,13 @@ html_interpret_recursive(struct f_data_c *f)
 	struct list_head *lfd;
 	if (f->rq)
 		html_interpret(f, 1);
+	else
+		f->format_pending = 0;
 	foreach (struct f_data_c, fd, lfd, f->subframes)
-		html_interpret_recursive(fd);
+		fd->format_pending = 1;
+	if (!list_empty(f->subframes) && !f->ses->format_timer)
+		f->ses->format_timer =
+		    install_timer(0, format_pending_frame, f->ses);
 }
 
 /* You get a struct_additionl_file. never mem_free it. When you stop
@@ -2664,6 +2956,8 @@ new_name:
 	down->handle = h;
 	down->ses = ses;
 	down->remotetime = 0;
+	init_list(down->segments);
+	down->stream_end = -1;
 	if (ses->tq_prog) {
 		down->prog = subst_file(ses->tq_prog, file, 1);
 		free(file);
@@ -3058,6 +3352,9 @@ goto_url_f(struct session *ses, void (*state2)(struct session *),
 		return;
 	}
 	ses_abort_1st_state_loading(ses);
+	abort_dns_prefetches();
+	abort_preconnects(u);
+	abort_prefetches(u);
 	ses->wtd = state2;
 	ses->wtd_target = stracpy(target);
 	ses->wtd_target_base = df;
@@ -3293,6 +3590,7 @@ create_session(struct window *win)
 	ses->screen->yw = term->y - 2;
 	memcpy(&ses->ds, &dds, sizeof(struct document_setup));
 	init_list(ses->format_cache);
+	init_list(ses->search_regexps);
 	add_to_list(sessions, ses);
 	if (first_use) {
 		first_use = 0;
@@ -3428,6 +3726,10 @@ cleanup_session(struct session *ses)
 void
 destroy_session(struct session *ses)
 {
+	if (ses->format_timer != NULL)
+		kill_timer(ses->format_timer);
+	if (ses->prefetch_timer != NULL)
+		kill_timer(ses->prefetch_timer);
 	cleanup_session(ses);
 	free(ses->screen);
 	free(ses->st);
@@ -3436,6 +3738,7 @@ destroy_session(struct session *ses)
 	ses->st_old = NULL;
 	free(ses->dn_url);
 	free(ses->last_search_word);
+	free_regexps(&ses->search_regexps);
 	free(ses->imgmap_href_base);
 	free(ses->imgmap_target_base);
 	free(ses->wanted_framename);
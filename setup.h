@@ -7,18 +7,32 @@
 
 #define DNS_TIMEOUT     3600000UL
 #define SESSION_TIMEOUT 14400000UL
+#define VERIFY_CACHE_TIMEOUT 3600000UL
+#define SSL_PRELOAD_TIME 500
 
 #define HTTP_KEEPALIVE_TIMEOUT    300000
 #define MAX_KEEPALIVE_CONNECTIONS 30
 #define KEEPALIVE_CHECK_TIME      20000
 
+#define PREFETCH_DELAY      300
+#define DNS_PREFETCH_MAX    4
+#define PRECONNECT_MAX      2
+#define PRECONNECT_TIMEOUT  60000
+#define PREFETCH_HINTS      8
+#define PREFETCH_PAGES_MAX  2
+#define PREFETCH_RATE       65536
+#define PREFETCH_BURST      1048576
+
 #define MAX_REDIRECTS        15
 #define MAX_CACHED_REDIRECTS 10
 
 #define DOWNLOAD_NAME_TRIES 10000
+#define DOWNLOAD_SEGMENT_MIN 1048576
 
 #define MEMORY_CACHE_GC_PERCENT 9 / 10
 #define MAX_CACHED_OBJECT       1 / 4
+#define MAX_FRAGMENT_RESERVE    1 / 16
+#define FRAGMENT_MMAP_MIN       131072
 
 #define MAX_HISTORY_ITEMS 4096
 #define MENU_HOTKEY_SPACE 2
@@ -75,6 +89,9 @@
 #define DISPLAY_TIME              15
 #define IMG_DISPLAY_TIME          7
 #define DISPLAY_FORMATTING_STATUS 500
+#define SEARCH_INDEX_TIME         20
+#define FORMAT_LAZY_SIZE          65536
+#define FORMAT_STEP_TIME          20
 
 #define STAT_UPDATE_MIN 100
 #define STAT_UPDATE_MAX 1000
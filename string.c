@@ -177,6 +177,83 @@ add_knum_to_str(unsigned char **s, size_t l, off_t n)
 	return add_to_str(s, l, a);
 }
 
+#define BUF_MIN_SIZE 64
+
+void
+init_buf(struct string_buf *b, unsigned char *stack, size_t size)
+{
+	b->s = b->stack = stack;
+	b->l = 0;
+	b->size = stack ? size : 0;
+	if (stack)
+		stack[0] = 0;
+}
+
+/* make room for n more bytes and the terminating 0 */
+void
+reserve_buf(struct string_buf *b, size_t n)
+{
+	unsigned char *p;
+	size_t size;
+	if (b->l + n < b->size)
+		return;
+	if (n > (size_t)-1 / 2 - b->l)
+		overalloc();
+	size = b->size ? b->size : BUF_MIN_SIZE;
+	while (size <= b->l + n)
+		size *= 2;
+	if (b->s != b->stack)
+		p = xrealloc(b->s, size);
+	else {
+		p = xmalloc(size);
+		if (b->l)
+			memcpy(p, b->s, b->l);
+	}
+	p[b->l] = 0;
+	b->s = p;
+	b->size = size;
+}
+
+void
+add_bytes_to_buf(struct string_buf *b, const unsigned char *a, size_t al)
+{
+	reserve_buf(b, al);
+	memcpy(b->s + b->l, a, al);
+	b->l += al;
+	b->s[b->l] = 0;
+}
+
+void
+add_to_buf(struct string_buf *b, const unsigned char *a)
+{
+	add_bytes_to_buf(b, a, strlen(cast_const_char a));
+}
+
+void
+add_num_to_buf(struct string_buf *b, off_t n)
+{
+	unsigned char a[64];
+	snzprint(a, sizeof a, n);
+	add_to_buf(b, a);
+}
+
+/* Give the text to the caller as a string allocated on the heap; the length
+ * stays in b->l. The buffer must not be used afterwards. */
+unsigned char *
+buf_string(struct string_buf *b)
+{
+	if (b->s == b->stack)
+		return memacpy(b->s, b->l);
+	return b->s;
+}
+
+void
+free_buf(struct string_buf *b)
+{
+	if (b->s != b->stack)
+		free(b->s);
+}
+
 long
 strtolx(unsigned char *c, unsigned char **end)
 {
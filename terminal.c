@@ -342,12 +342,31 @@ free_term_specs(void)
 }
 
 static struct term_spec dumb_term = {
-	init_list_1st(NULL) "", 0, 1, 0, 0, 0, 0, 0, 0, 0, 0
+	init_list_1st(NULL) "", 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static struct term_spec vt100_term = {
+	init_list_1st(NULL) "", 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0
+};
+
+/* Terminals known to implement VT100 scroll regions, with their variants
+ * such as xterm-256color or screen.xterm. */
+static const char *const vt100_terms[] = {
+	"vt100", "vt102", "vt220", "vt320", "vt420", "vt520", "xterm",
+	"rxvt", "screen", "tmux", "linux", "konsole", "gnome", "putty",
+	"st", "alacritty", "foot", "kitty", NULL
 };
 
 static struct term_spec *
 default_term_spec(unsigned char *term)
 {
+	const char *const *t;
+	for (t = vt100_terms; *t; t++) {
+		size_t l = strlen(*t);
+		if (!cmpbeg(term, cast_uchar *t)
+		    && (!term[l] || term[l] == '-' || term[l] == '.'))
+			return &vt100_term;
+	}
 	return &dumb_term;
 }
 
@@ -592,11 +611,11 @@ static unsigned char frame_vt100[49] =
 
 #define SETPOS(x, y)                                                           \
 	{                                                                      \
-		l = add_to_str(&a, l, cast_uchar "\033[");                     \
-		l = add_num_to_str(&a, l, (y) + 1 + term->top_margin);         \
-		l = add_chr_to_str(&a, l, ';');                                \
-		l = add_num_to_str(&a, l, (x) + 1 + term->left_margin);        \
-		l = add_chr_to_str(&a, l, 'H');                                \
+		add_to_buf(&a, cast_uchar "\033[");                            \
+		add_num_to_buf(&a, (y) + 1 + term->top_margin);                \
+		add_chr_to_buf(&a, ';');                                       \
+		add_num_to_buf(&a, (x) + 1 + term->left_margin);               \
+		add_chr_to_buf(&a, 'H');                                       \
 	}
 
 #define PRINT_CHAR(p)                                                          \
@@ -607,11 +626,9 @@ static unsigned char frame_vt100[49] =
 		if (s->mode == TERM_VT100) {                                   \
 			if (frm != mode) {                                     \
 				if (!(mode = frm))                             \
-					l = add_to_str(&a, l,                  \
-					               cast_uchar "\017");     \
+					add_to_buf(&a, cast_uchar "\017");     \
 				else                                           \
-					l = add_to_str(&a, l,                  \
-					               cast_uchar "\016");     \
+					add_to_buf(&a, cast_uchar "\016");     \
 			}                                                      \
 			if (frm && c >= 176 && c < 224)                        \
 				c = frame_vt100[c - 176];                      \
@@ -621,27 +638,27 @@ static unsigned char frame_vt100[49] =
 			A = (A & 070) | 7 * !(A & 020);                        \
 		if (A != attrib) {                                             \
 			attrib = A;                                            \
-			l = add_to_str(&a, l, cast_uchar "\033[0");            \
+			add_to_buf(&a, cast_uchar "\033[0");                   \
 			if (s->col) {                                          \
 				unsigned char m[4];                            \
 				m[0] = ';';                                    \
 				m[1] = '3';                                    \
 				m[3] = 0;                                      \
 				m[2] = (attrib & 7) + '0';                     \
-				l = add_to_str(&a, l, m);                      \
+				add_to_buf(&a, m);                             \
 				m[1] = '4';                                    \
 				m[2] = ((attrib >> 3) & 7) + '0';              \
-				l = add_to_str(&a, l, m);                      \
+				add_to_buf(&a, m);                             \
 			} else if (getcompcode(attrib & 7)                     \
 			           < getcompcode(attrib >> 3 & 7))             \
-				l = add_to_str(&a, l, cast_uchar ";7");        \
+				add_to_buf(&a, cast_uchar ";7");               \
 			if (attrib & 0100)                                     \
-				l = add_to_str(&a, l, cast_uchar ";1");        \
-			l = add_chr_to_str(&a, l, 'm');                        \
+				add_to_buf(&a, cast_uchar ";1");               \
+			add_chr_to_buf(&a, 'm');                               \
 		}                                                              \
 		if (c >= ' ' && c != 127 && c != 155) {                        \
 			if (c < 128 || frm) {                                  \
-				l = add_chr_to_str(&a, l, (unsigned char)c);   \
+				add_chr_to_buf(&a, (unsigned char)c);          \
 			} else {                                               \
 				/*                                             \
 				 * Linux UTF-8 console is broken and doesn't   \
@@ -654,37 +671,127 @@ static unsigned char frame_vt100[49] =
 				r = u2cp(c);                                   \
 				if (!(r && r[0] >= 32 && r[0] < 127 && !r[1])) \
 					r = cast_uchar "*";                    \
-				l = add_chr_to_str(&a, l, r[0]);               \
+				add_chr_to_buf(&a, r[0]);                      \
 				if (cx + 1 < term->x)                          \
-					l = add_chr_to_str(&a, l, 8);          \
+					add_chr_to_buf(&a, 8);                 \
 				else                                           \
 					SETPOS(cx, y);                         \
-				l = add_to_str(&a, l, encode_utf_8(c));        \
+				add_to_buf(&a, encode_utf_8(c));               \
 				SETPOS(cx + 1, y);                             \
 				print_next = 1;                                \
 			}                                                      \
 		} else if (!c || c == 1)                                       \
-			l = add_chr_to_str(&a, l, ' ');                        \
+			add_chr_to_buf(&a, ' ');                               \
 		else                                                           \
-			l = add_chr_to_str(&a, l, '.');                        \
+			add_chr_to_buf(&a, '.');                               \
 		cx++;                                                          \
 	}
 
+static unsigned
+row_hash(const chr *c, int n)
+{
+	unsigned h = 0;
+	while (n--) {
+		h = h * 31 + c->ch;
+		h = h * 31 + c->at;
+		c++;
+	}
+	return h;
+}
+
+/* Find a vertical shift of the rows between top and bot that turns
+ * last_screen into screen on more rows than leaving it in place does.
+ * A positive result means the content moved up. */
+static int
+get_scroll_shift(struct terminal *term, int *top, int *bot)
+{
+	size_t rl = term->x * sizeof(chr);
+	unsigned *oh, *nh;
+	int y, k, n, m, still = 0, best = 0, best_m = 0;
+	for (y = 0; y < term->y; y++)
+		if (memcmp(&term->screen[y * term->x],
+		           &term->last_screen[y * term->x], rl))
+			break;
+	*top = y;
+	for (y = term->y - 1; y > *top; y--)
+		if (memcmp(&term->screen[y * term->x],
+		           &term->last_screen[y * term->x], rl))
+			break;
+	*bot = y;
+	n = *bot - *top + 1;
+	if (n < 3)
+		return 0;
+	oh = xmalloc(2 * n * sizeof(unsigned));
+	nh = oh + n;
+	for (y = 0; y < n; y++) {
+		oh[y] = row_hash(&term->last_screen[(*top + y) * term->x],
+		                 term->x);
+		nh[y] = row_hash(&term->screen[(*top + y) * term->x], term->x);
+	}
+	for (k = 1 - n; k < n; k++) {
+		for (m = 0, y = k > 0 ? 0 : -k; y < n && y + k < n; y++)
+			m += nh[y] == oh[y + k]
+			     && !memcmp(&term->screen[(*top + y) * term->x],
+			                &term->last_screen[(*top + y + k)
+			                                   * term->x],
+			                rl);
+		if (!k)
+			still = m;
+		else if (m > best_m) {
+			best = k;
+			best_m = m;
+		}
+	}
+	free(oh);
+	/* scrolling costs about as much as repainting a row */
+	return best_m - still >= 2 ? best : 0;
+}
+
 static void
 redraw_screen(struct terminal *term)
 {
 	int x, y, p = 0;
 	int cx = term->lcx, cy = term->lcy;
-	unsigned char *a;
+	unsigned char stack[4096];
+	struct string_buf a;
 	int attrib = -1;
 	int mode = -1;
-	int l = 0;
 	int print_next = 0;
 	struct term_spec *s;
 	if (!term->dirty || (term->master && is_blocked()))
 		return;
-	a = NULL;
+	init_buf(&a, stack, sizeof stack);
 	s = term->spec;
+	if (s->scroll && !term->left_margin && term->x == term->real_x) {
+		int top, bot, k = get_scroll_shift(term, &top, &bot);
+		if (k) {
+			size_t rl = term->x * sizeof(chr);
+			add_to_buf(&a, cast_uchar "\033[");
+			add_num_to_buf(&a, top + 1 + term->top_margin);
+			add_chr_to_buf(&a, ';');
+			add_num_to_buf(&a, bot + 1 + term->top_margin);
+			add_chr_to_buf(&a, 'r');
+			SETPOS(0, k > 0 ? bot : top);
+			for (x = 0; x < abs(k); x++)
+				add_to_buf(&a, cast_uchar(k > 0 ? "\033D"
+				                                : "\033M"));
+			add_to_buf(&a, cast_uchar "\033[r");
+			if (k > 0) {
+				memmove(&term->last_screen[top * term->x],
+				        &term->last_screen[(top + k) * term->x],
+				        (bot - top + 1 - k) * rl);
+				memset(&term->last_screen[(bot + 1 - k) * term->x],
+				       -1, k * rl);
+			} else {
+				memmove(&term->last_screen[(top - k) * term->x],
+				        &term->last_screen[top * term->x],
+				        (bot - top + 1 + k) * rl);
+				memset(&term->last_screen[top * term->x], -1,
+				       -k * rl);
+			}
+			cx = cy = -1;
+		}
+	}
 	for (y = 0; y < term->y; y++) {
 		if (!memcmp(&term->screen[p], &term->last_screen[p],
 		            sizeof(chr) * term->x)) {
@@ -729,31 +836,31 @@ pc:
 			}
 		}
 		if (print_next && term->left_margin + term->x < term->real_x) {
-			l = add_to_str(&a, l, cast_uchar "\033[0m ");
+			add_to_buf(&a, cast_uchar "\033[0m ");
 			attrib = -1;
 			print_next = 0;
 		}
 	}
-	if (l) {
+	if (a.l) {
 		if (s->col)
-			l = add_to_str(&a, l, cast_uchar "\033[37;40m");
-		l = add_to_str(&a, l, cast_uchar "\033[0m");
+			add_to_buf(&a, cast_uchar "\033[37;40m");
+		add_to_buf(&a, cast_uchar "\033[0m");
 		if (s->mode == TERM_VT100)
-			l = add_to_str(&a, l, cast_uchar "\017");
+			add_to_buf(&a, cast_uchar "\017");
 	}
 	term->lcx = cx;
 	term->lcy = cy;
 	if (term->cx != term->lcx || term->cy != term->lcy) {
 		term->lcx = term->cx;
 		term->lcy = term->cy;
-		l = add_to_str(&a, l, cast_uchar "\033[");
-		l = add_num_to_str(&a, l, term->cy + 1 + term->top_margin);
-		l = add_chr_to_str(&a, l, ';');
-		l = add_num_to_str(&a, l, term->cx + 1 + term->left_margin);
-		l = add_chr_to_str(&a, l, 'H');
+		add_to_buf(&a, cast_uchar "\033[");
+		add_num_to_buf(&a, term->cy + 1 + term->top_margin);
+		add_chr_to_buf(&a, ';');
+		add_num_to_buf(&a, term->cx + 1 + term->left_margin);
+		add_chr_to_buf(&a, 'H');
 	}
-	hard_write(term->fdout, a, l);
-	free(a);
+	hard_write(term->fdout, a.s, a.l);
+	free_buf(&a);
 	term->dirty = 0;
 }
 
@@ -992,7 +1099,7 @@ set_cursor(struct terminal *term, int x, int y, int altx, int alty)
 	term->cy = y;
 }
 
-static void
+void
 exec_thread(void *path_, int p)
 {
 	char *path = path_;
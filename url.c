@@ -3,6 +3,8 @@
  * This file is a part of the Links program, released under GPL.
  */
 
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "links.h"
@@ -37,30 +39,6 @@ check_protocol(unsigned char *p, size_t l)
 	return -1;
 }
 
-static int
-get_prot_info(unsigned char *prot, int *port,
-              void (**func)(struct connection *),
-              void (**nc_func)(struct session *ses, unsigned char *),
-              int *allow_post, int *bypasses_socks)
-{
-	int i;
-	for (i = 0; protocols[i].prot; i++)
-		if (!casestrcmp(cast_uchar protocols[i].prot, prot)) {
-			if (port)
-				*port = protocols[i].port;
-			if (func)
-				*func = protocols[i].func;
-			if (nc_func)
-				*nc_func = protocols[i].nc_func;
-			if (allow_post)
-				*allow_post = protocols[i].allow_post;
-			if (bypasses_socks)
-				*bypasses_socks = protocols[i].bypasses_socks;
-			return 0;
-		}
-	return -1;
-}
-
 int
 parse_url(unsigned char *url, int *prlen, unsigned char **user, int *uslen,
           unsigned char **pass, int *palen, unsigned char **host, int *holen,
@@ -183,152 +161,253 @@ have_host:
 	return 0;
 }
 
+#define URL_CACHE_SIZE 256
+
+/* URLs held by connections and object requests; the table holds a reference
+ * to each of them. */
+static struct parsed_url *url_cache[URL_CACHE_SIZE];
+
+static void
+fill_parsed_url(struct parsed_url *pu, unsigned char *url)
+{
+	unsigned char *user, *pass, *host, *port, *data, *post, *k;
+	int hl, pl;
+	pu->url = url;
+	pu->prot = -1;
+	pu->user = pu->pass = pu->host = pu->port = pu->data = pu->post = -1;
+	pu->port_num = pu->kalen = -1;
+	if (parse_url(url, &pu->prlen, &user, &pu->uslen, &pass, &pu->palen,
+	              &host, &pu->holen, &port, &pu->polen, &data, &pu->dalen,
+	              &post))
+		return;
+	pu->prot = check_protocol(url, pu->prlen);
+	pu->user = user ? (int)(user - url) : -1;
+	pu->pass = pass ? (int)(pass - url) : -1;
+	pu->host = host ? (int)(host - url) : -1;
+	pu->port = port ? (int)(port - url) : -1;
+	pu->data = data ? (int)(data - url) : -1;
+	pu->post = post ? (int)(post - url) : -1;
+	pu->port_num = protocols[pu->prot].port;
+	if (port) {
+		long n = strtol(cast_const_char port, NULL, 10);
+		pu->port_num = n > 0 && n < 65536 ? (int)n : -1;
+	}
+	hl = pu->holen;
+	pl = pu->polen;
+	if (is_proxy_url(url) && !casecmp(data, cast_uchar "https://", 8)) {
+		if (parse_url(data, NULL, NULL, NULL, NULL, NULL, &host, &hl,
+		              &port, &pl, NULL, NULL, NULL))
+			return;
+	}
+	k = port ? port + pl : host ? host + hl : NULL;
+	pu->kalen = k ? (int)(k - url) : 0;
+}
+
+static unsigned
+url_hash(unsigned char *url)
+{
+	unsigned h = 0;
+	while (*url)
+		h = h * 33 + *url++;
+	return h % URL_CACHE_SIZE;
+}
+
+#define URL_RECENT_SIZE 16
+
+/* Other recently parsed URLs, the buffers are reused. */
+static struct parsed_url url_recent[URL_RECENT_SIZE];
+static size_t url_recent_size[URL_RECENT_SIZE];
+
+/* The returned structure is valid only until the next call; use
+ * hold_parsed_url to keep it. */
+struct parsed_url *
+get_parsed_url(unsigned char *url)
+{
+	unsigned h = url_hash(url);
+	struct parsed_url *c = url_cache[h];
+	size_t l;
+	if (c && !strcmp(cast_const_char c->url, cast_const_char url))
+		return c;
+	h %= URL_RECENT_SIZE;
+	c = &url_recent[h];
+	if (c->url && !strcmp(cast_const_char c->url, cast_const_char url))
+		return c;
+	l = strlen(cast_const_char url);
+	if (l >= url_recent_size[h]) {
+		if (l > INT_MAX)
+			overalloc();
+		free(c->url);
+		c->url = xmalloc(l + 1);
+		url_recent_size[h] = l + 1;
+	}
+	memcpy(c->url, url, l + 1);
+	fill_parsed_url(c, c->url);
+	return c;
+}
+
+struct parsed_url *
+hold_parsed_url(unsigned char *url)
+{
+	struct parsed_url **c = &url_cache[url_hash(url)];
+	size_t l;
+	if (!*c || strcmp(cast_const_char(*c)->url, cast_const_char url)) {
+		release_parsed_url(c);
+		l = strlen(cast_const_char url);
+		if (l > INT_MAX)
+			overalloc();
+		*c = xmalloc(sizeof(struct parsed_url) + l + 1);
+		memcpy(*c + 1, url, l + 1);
+		fill_parsed_url(*c, (unsigned char *)(*c + 1));
+		(*c)->refcount = 1;
+	}
+	(*c)->refcount++;
+	return *c;
+}
+
+void
+release_parsed_url(struct parsed_url **pu)
+{
+	if (*pu && !--(*pu)->refcount)
+		free(*pu);
+	*pu = NULL;
+}
+
+void
+free_parsed_urls(void)
+{
+	int i;
+	for (i = 0; i < URL_CACHE_SIZE; i++)
+		release_parsed_url(&url_cache[i]);
+	for (i = 0; i < URL_RECENT_SIZE; i++) {
+		free(url_recent[i].url);
+		url_recent[i].url = NULL;
+		url_recent_size[i] = 0;
+	}
+}
+
+/* Compare the host name of the URL with a string. */
+int
+url_host_eq(struct parsed_url *pu, unsigned char *host)
+{
+	if (pu->prot < 0 || pu->host < 0)
+		return !*host;
+	return !strncmp(cast_const_char host, cast_const_char pu->url + pu->host,
+	                pu->holen)
+	       && !host[pu->holen];
+}
+
+/* Compare the keep-alive id of the URL with a string. */
+int
+url_keepalive_eq(struct parsed_url *pu, unsigned char *id)
+{
+	if (pu->prot < 0 || pu->kalen < 0)
+		return 0;
+	return !strncmp(cast_const_char id, cast_const_char pu->url, pu->kalen)
+	       && !id[pu->kalen];
+}
+
 unsigned char *
 get_protocol_name(unsigned char *url)
 {
-	int l;
-	if (parse_url(url, &l, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-	              NULL, NULL, NULL))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return NULL;
-	return memacpy(url, l);
+	return memacpy(url, pu->prlen);
 }
 
 unsigned char *
 get_keepalive_id(unsigned char *url)
 {
-	unsigned char *h, *p, *k, *d;
-	int hl, pl;
-	if (parse_url(url, NULL, NULL, NULL, NULL, NULL, &h, &hl, &p, &pl, &d,
-	              NULL, NULL))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0 || pu->kalen < 0)
 		return NULL;
-	if (is_proxy_url(url) && !casecmp(d, cast_uchar "https://", 8)) {
-		if (parse_url(d, NULL, NULL, NULL, NULL, NULL, &h, &hl, &p, &pl,
-		              NULL, NULL, NULL))
-			return NULL;
-	}
-	k = p ? p + pl : h ? h + hl : NULL;
-	if (!k)
-		return stracpy(cast_uchar "");
-	return memacpy(url, k - url);
+	return memacpy(url, pu->kalen);
 }
 
 unsigned char *
 get_host_name(unsigned char *url)
 {
-	unsigned char *h;
-	int hl;
-	if (parse_url(url, NULL, NULL, NULL, NULL, NULL, &h, &hl, NULL, NULL,
-	              NULL, NULL, NULL))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0 || pu->host < 0)
 		return stracpy(cast_uchar "");
-	return memacpy(h, hl);
+	return memacpy(url + pu->host, pu->holen);
 }
 
 unsigned char *
 get_user_name(unsigned char *url)
 {
-	unsigned char *h;
-	int hl;
-	if (parse_url(url, NULL, &h, &hl, NULL, NULL, NULL, NULL, NULL, NULL,
-	              NULL, NULL, NULL))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return NULL;
-	return memacpy(h, hl);
+	return memacpy(pu->user >= 0 ? url + pu->user : url, pu->uslen);
 }
 
 unsigned char *
 get_pass(unsigned char *url)
 {
-	unsigned char *h;
-	int hl;
-	if (parse_url(url, NULL, NULL, NULL, &h, &hl, NULL, NULL, NULL, NULL,
-	              NULL, NULL, NULL))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return NULL;
-	return memacpy(h, hl);
+	return memacpy(pu->pass >= 0 ? url + pu->pass : url, pu->palen);
 }
 
 unsigned char *
 get_port_str(unsigned char *url)
 {
-	unsigned char *h;
-	int hl;
-	if (parse_url(url, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &h, &hl,
-	              NULL, NULL, NULL))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0 || !pu->polen)
 		return NULL;
-	return hl ? memacpy(h, hl) : NULL;
+	return memacpy(url + pu->port, pu->polen);
 }
 
 int
 get_port(unsigned char *url)
 {
-	unsigned char *h;
-	int hl;
-	long n = -1;
-	if (parse_url(url, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &h, &hl,
-	              NULL, NULL, NULL))
-		return -1;
-	if (h) {
-		n = strtol((char *)h, NULL, 10);
-		if (n > 0 && n < 65536)
-			return (int)n;
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return -1;
-	}
-	if ((h = get_protocol_name(url))) {
-		int nn = -1;
-		get_prot_info(h, &nn, NULL, NULL, NULL, NULL);
-		free(h);
-		n = nn;
-	}
-	return (int)n;
+	return pu->port_num;
 }
 
 void (*get_protocol_handle(unsigned char *url))(struct connection *)
 {
-	unsigned char *p;
-	void (*f)(struct connection *) = NULL;
-	int post = 0;
-	if (!(p = get_protocol_name(url)))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return NULL;
-	get_prot_info(p, NULL, &f, NULL, &post, NULL);
-	free(p);
-	if (!post && strchr(cast_const_char url, POST_CHAR))
+	if (!protocols[pu->prot].allow_post
+	    && strchr(cast_const_char url, POST_CHAR))
 		return NULL;
-	return f;
+	return protocols[pu->prot].func;
 }
 
 void (*get_external_protocol_function(unsigned char *url))(struct session *,
                                                            unsigned char *)
 {
-	unsigned char *p;
-	void (*f)(struct session *, unsigned char *) = NULL;
-	int post = 0;
-	if (!(p = get_protocol_name(url)))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return NULL;
-	get_prot_info(p, NULL, NULL, &f, &post, NULL);
-	free(p);
-	if (!post && strchr(cast_const_char url, POST_CHAR))
+	if (!protocols[pu->prot].allow_post
+	    && strchr(cast_const_char url, POST_CHAR))
 		return NULL;
-	return f;
+	return protocols[pu->prot].nc_func;
 }
 
 int
 url_bypasses_socks(unsigned char *url)
 {
-	int ret = 0;
-	unsigned char *p;
-	if (!(p = get_protocol_name(url)))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return 1;
-	get_prot_info(p, NULL, NULL, NULL, NULL, &ret);
-	free(p);
-	return ret;
+	return protocols[pu->prot].bypasses_socks;
 }
 
 unsigned char *
 get_url_data(unsigned char *url)
 {
-	unsigned char *d;
-	if (parse_url(url, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-	              &d, NULL, NULL))
+	struct parsed_url *pu = get_parsed_url(url);
+	if (pu->prot < 0)
 		return NULL;
-	return d;
+	return url + pu->data;
 }
 
 #define dsep(x) (lo ? dir_sep(x) : (x) == '/')
@@ -733,6 +812,157 @@ return_n:
 	return n;
 }
 
+#define URL_JOINS_SIZE 1024
+
+struct join_base {
+	list_entry_1st;
+	size_t frag_len;   /* without the fragment and post data */
+	size_t origin_len; /* prefix for absolute paths, 0 if unknown */
+	size_t dir_len;    /* prefix for relative paths, 0 if unknown */
+	unsigned char base[1];
+};
+
+struct join_entry {
+	struct join_entry *next;
+	struct join_base *b;
+	unsigned char *result;
+	unsigned char rel[1];
+};
+
+struct url_joins {
+	struct list_head bases;
+	struct join_entry *hash[URL_JOINS_SIZE];
+};
+
+static struct join_base *
+get_join_base(struct url_joins *uj, unsigned char *base)
+{
+	struct join_base *b;
+	struct list_head *lb;
+	unsigned char *p, *pp;
+	size_t l;
+	int lo = !casecmp(base, cast_uchar "file://", 7);
+	foreach (struct join_base, b, lb, uj->bases)
+		if (!strcmp(cast_const_char b->base, cast_const_char base)) {
+			if (lb != uj->bases.next) {
+				del_from_list(b);
+				add_to_list(uj->bases, b);
+			}
+			return b;
+		}
+	l = strlen(cast_const_char base);
+	if (l > INT_MAX - sizeof(struct join_base))
+		overalloc();
+	b = xmalloc(sizeof(struct join_base) + l);
+	memcpy(b->base, base, l + 1);
+	for (p = base; *p && *p != POST_CHAR && *p != '#'; p++)
+		;
+	b->frag_len = p - base;
+	b->origin_len = b->dir_len = 0;
+	if (casecmp(base, cast_uchar "data:", 5)
+	    && !parse_url(base, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	                  NULL, &p, NULL, NULL)
+	    && p) {
+		if (!dsep(*p))
+			p--;
+		b->origin_len = p - base;
+		for (pp = p; *pp; pp++) {
+			if (end_of_dir(base, *pp))
+				break;
+			if (dsep(*pp))
+				p = pp + 1;
+		}
+		b->dir_len = p - base;
+	}
+	add_to_list(uj->bases, b);
+	return b;
+}
+
+/* The common cases of join_urls without parsing anything. A relative URL
+ * without a colon can't be parsed as absolute, so join_urls would resolve
+ * it against the base the same way. */
+static unsigned char *
+join_urls_fast(struct join_base *b, unsigned char *rel)
+{
+	unsigned char *n;
+	size_t l;
+	int lo = !casecmp(b->base, cast_uchar "file://", 7);
+	if (!rel[0] || rel[0] == '#')
+		l = b->frag_len;
+	else if (!b->dir_len || strchr(cast_const_char rel, ':')
+	         || (rel[0] == '/' && rel[1] == '/') || rel[0] == '?'
+	         || rel[0] == '&' || end_of_dir(b->base, rel[0]))
+		return NULL;
+	else if (dsep(rel[0]))
+		l = b->origin_len;
+	else
+		l = b->dir_len;
+	n = memacpy(b->base, l);
+	add_to_strn(&n, rel);
+	n = translate_idn(n, 0);
+	return rewrite_url(n);
+}
+
+/* join_urls remembering the results in *ujp, so that formatting the same
+ * document again doesn't need to resolve its links again */
+unsigned char *
+join_urls_cached(struct url_joins **ujp, unsigned char *base,
+                 unsigned char *rel)
+{
+	struct url_joins *uj;
+	struct join_base *b;
+	struct join_entry *e;
+	unsigned char *n, *p;
+	unsigned h;
+	size_t l;
+	if (!ujp)
+		return join_urls(base, rel);
+	if (!(uj = *ujp)) {
+		uj = *ujp = mem_calloc(sizeof(struct url_joins));
+		init_list(uj->bases);
+	}
+	b = get_join_base(uj, base);
+	h = 0;
+	for (p = rel; *p; p++)
+		h = h * 33 + *p;
+	h %= URL_JOINS_SIZE;
+	for (e = uj->hash[h]; e; e = e->next)
+		if (e->b == b && !strcmp(cast_const_char e->rel,
+		                         cast_const_char rel))
+			return e->result ? stracpy(e->result) : NULL;
+	if (!(n = join_urls_fast(b, rel)))
+		n = join_urls(base, rel);
+	l = p - rel;
+	if (l > INT_MAX - sizeof(struct join_entry))
+		overalloc();
+	e = xmalloc(sizeof(struct join_entry) + l);
+	memcpy(e->rel, rel, l + 1);
+	e->b = b;
+	e->result = n ? stracpy(n) : NULL;
+	e->next = uj->hash[h];
+	uj->hash[h] = e;
+	return n;
+}
+
+void
+free_url_joins(struct url_joins **ujp)
+{
+	struct url_joins *uj = *ujp;
+	struct join_entry *e;
+	int i;
+	if (!uj)
+		return;
+	for (i = 0; i < URL_JOINS_SIZE; i++)
+		while ((e = uj->hash[i])) {
+			uj->hash[i] = e->next;
+			free(e->result);
+			free(e);
+		}
+	free_list(struct join_base, uj->bases);
+	free(uj);
+	*ujp = NULL;
+}
+
 unsigned char *
 translate_url(unsigned char *url, unsigned char *cwd)
 {
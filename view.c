@@ -16,6 +16,7 @@ static void set_pos_y(struct f_data_c *, struct link *);
 static void find_link(struct f_data_c *, int, int);
 
 static int is_active_frame(struct session *ses, struct f_data_c *f);
+static void arm_prefetch(struct session *ses);
 
 static void send_open_in_new_xterm(struct terminal *term, void *open_window_,
                                    void *ses_);
@@ -134,33 +135,97 @@ comp_links(const void *l1_, const void *l2_)
 	return l1->num - l2->num;
 }
 
+static int
+comp_int(const void *i1, const void *i2)
+{
+	return *(const int *)i1 - *(const int *)i2;
+}
+
+static int
+comp_link_cells(const void *c1_, const void *c2_)
+{
+	const struct link_cell *c1 = (const struct link_cell *)c1_;
+	const struct link_cell *c2 = (const struct link_cell *)c2_;
+	if (c1->x != c2->x)
+		return c1->x < c2->x ? -1 : 1;
+	return c1->link - c2->link;
+}
+
+/* Build the index of link positions by line. */
+static void
+index_links(struct f_data *f)
+{
+	int i, j, y, n = 0;
+	if ((unsigned)f->y > INT_MAX / sizeof(int) - 1)
+		overalloc();
+	f->link_rows = mem_calloc((f->y + 1) * sizeof(int));
+	for (i = 0; i < f->nlinks; i++)
+		for (j = 0; j < f->links[i].n; j++) {
+			y = f->links[i].pos[j].y;
+			if (y < 0 || y >= f->y)
+				continue;
+			if (n == INT_MAX)
+				overalloc();
+			f->link_rows[y]++;
+			n++;
+		}
+	if ((unsigned)n > INT_MAX / sizeof(struct link_cell))
+		overalloc();
+	f->link_cells = xmalloc((n ? n : 1) * sizeof(struct link_cell));
+	for (y = 1; y <= f->y; y++)
+		f->link_rows[y] += f->link_rows[y - 1];
+	for (i = f->nlinks - 1; i >= 0; i--)
+		for (j = f->links[i].n - 1; j >= 0; j--) {
+			struct link_cell *c;
+			y = f->links[i].pos[j].y;
+			if (y < 0 || y >= f->y)
+				continue;
+			c = &f->link_cells[--f->link_rows[y]];
+			c->x = f->links[i].pos[j].x;
+			c->link = i;
+		}
+	for (y = 0; y < f->y; y++) {
+		struct link_cell *c = &f->link_cells[f->link_rows[y]];
+		int k = f->link_rows[y + 1] - f->link_rows[y];
+		for (i = 1; i < k; i++)
+			if (comp_link_cells(&c[i - 1], &c[i]) > 0) {
+				qsort(c, k, sizeof(struct link_cell),
+				      comp_link_cells);
+				break;
+			}
+	}
+}
+
 void
 sort_links(struct f_data *f)
 {
-	int i;
-	if (f->nlinks)
-		qsort(f->links, f->nlinks, sizeof(struct link), comp_links);
+	int i, n;
+	for (i = 1; i < f->nlinks; i++)
+		if (comp_links(&f->links[i - 1], &f->links[i]) > 0) {
+			qsort(f->links, f->nlinks, sizeof(struct link),
+			      comp_links);
+			break;
+		}
 	if ((unsigned)f->y > INT_MAX / sizeof(struct link *))
 		overalloc();
 	f->lines1 = mem_calloc(f->y * sizeof(struct link *));
 	f->lines2 = mem_calloc(f->y * sizeof(struct link *));
-	for (i = 0; i < f->nlinks; i++) {
+	for (i = n = 0; i < f->nlinks; i++) {
 		int p, q, j;
 		struct link *link = &f->links[i];
-		if (!link->n) {
-			if (d_opt->num_links)
-				continue;
+		if (!link->n && !d_opt->num_links) {
 			free(link->where);
 			free(link->target);
 			free(link->where_img);
 			free(link->img_alt);
 			free(link->pos);
-			memmove(link, link + 1,
-			        (f->nlinks - i - 1) * sizeof(struct link));
-			f->nlinks--;
-			i--;
 			continue;
 		}
+		if (n != i)
+			f->links[n] = *link;
+		link = &f->links[n++];
+		if (!link->n)
+			continue;
 		p = f->y - 1;
 		q = 0;
 		for (j = 0; j < link->n; j++) {
@@ -179,11 +244,55 @@ sort_links(struct f_data *f)
 				internal("link out of screen");
 				continue;
 			}
-			f->lines2[j] = &f->links[i];
+			f->lines2[j] = link;
 			if (!f->lines1[j])
-				f->lines1[j] = &f->links[i];
+				f->lines1[j] = link;
+		}
+	}
+	f->nlinks = n;
+	index_links(f);
+}
+
+/* Return the links with a point on the lines in view, and unless allx is
+ * set also in the columns in view, sorted and each of them once. */
+static int
+get_links_in_view(struct f_data_c *f, int allx, int **links)
+{
+	struct f_data *fd = f->f_data;
+	int vx = f->vs->view_posx;
+	int y = f->vs->view_pos < 0 ? 0 : f->vs->view_pos;
+	int ye = f->vs->view_pos + f->yw;
+	int n = 0, size = 0, i, j;
+	*links = NULL;
+	if (ye > fd->y)
+		ye = fd->y;
+	for (; y < ye; y++) {
+		int s = fd->link_rows[y], e = fd->link_rows[y + 1];
+		if (!allx) {
+			s = first_link_cell(fd, y, vx);
+			while (e > s && fd->link_cells[e - 1].x >= vx + f->xw)
+				e--;
+		}
+		for (; s < e; s++) {
+			if (n && (*links)[n - 1] == fd->link_cells[s].link)
+				continue;
+			if (n == size) {
+				if (size > INT_MAX / 2)
+					overalloc();
+				size = size ? size * 2 : ALLOC_GR;
+				*links = xreallocarray(*links, size, sizeof(int));
+			}
+			(*links)[n++] = fd->link_cells[s].link;
 		}
 	}
+	if (n > 1) {
+		qsort(*links, n, sizeof(int), comp_int);
+		for (i = j = 1; i < n; i++)
+			if ((*links)[i] != (*links)[j - 1])
+				(*links)[j++] = (*links)[i];
+		n = j;
+	}
+	return n;
 }
 
 unsigned char *
@@ -500,90 +609,164 @@ search_lookup(struct f_data *f, int idx)
 }
 
 static int
-get_range(struct f_data *f, int y, int yw, int l, int *s1, int *s2)
+comp_search_match(const void *m1_, const void *m2_)
 {
-	int i;
-	*s1 = *s2 = -1;
-	for (i = y < 0 ? 0 : y; i < y + yw && i < f->y; i++) {
-		if (f->slines1[i] >= 0 && (*s1 < 0 || f->slines1[i] < *s1))
-			*s1 = f->slines1[i];
-		if (f->slines2[i] >= 0 && (*s2 < 0 || f->slines2[i] > *s2))
-			*s2 = f->slines2[i];
-	}
+	const struct search_match *m1 = (const struct search_match *)m1_;
+	const struct search_match *m2 = (const struct search_match *)m2_;
+	if (m1->y != m2->y)
+		return m1->y < m2->y ? -1 : 1;
+	return m1->idx < m2->idx ? -1 : m1->idx > m2->idx;
+}
 
-	if (l > f->nsearch_chr)
-		*s1 = *s2 = -1;
-	if (*s1 < 0 || *s2 < 0)
-		return -1;
+struct search_match_list {
+	struct f_data *f;
+	int size;
+};
 
-	if (*s1 < l)
-		*s1 = 0;
-	else
-		*s1 -= l;
+static void
+add_search_match(void *ml_, int idx, int len)
+{
+	struct search_match_list *ml = (struct search_match_list *)ml_;
+	struct f_data *f = ml->f;
+	struct search_match *m;
+	int i, y = INT_MAX, ye = -1;
+	for (i = 0; i < len; i++) {
+		struct search *sr = search_lookup(f, idx + i);
+		if (sr->n) {
+			if (sr->y < y)
+				y = sr->y;
+			if (sr->y > ye)
+				ye = sr->y;
+		}
+	}
+	if (ye < 0)
+		return;
+	if (f->nsearch_match == ml->size) {
+		if (ml->size > INT_MAX / 2)
+			overalloc();
+		ml->size = ml->size ? ml->size * 2 : ALLOC_GR;
+		f->search_match = xreallocarray(f->search_match, ml->size,
+		                                sizeof(struct search_match));
+	}
+	m = &f->search_match[f->nsearch_match++];
+	m->idx = idx;
+	m->len = len;
+	m->y = y;
+	m->ye = ye;
+	if (ye - y > f->search_match_span)
+		f->search_match_span = ye - y;
+}
 
-	if (f->nsearch_chr - *s2 < l)
-		*s2 = f->nsearch_chr - l;
+/* Boyer-Moore-Horspool, the skip table is indexed by the low byte of the
+ * character */
+static void
+find_search_word(struct f_data *f, unsigned char *w,
+                 struct search_match_list *ml)
+{
+	unsigned shift[256];
+	char_t *pat;
+	unsigned char *h = f->search_chr;
+	int cw = f->search_chr_width;
+	int pl, i, j;
+	pat = xmalloc((strlen(cast_const_char w) + 1) * sizeof(char_t));
+	for (pl = 0; *w; pl++) {
+		if (f->opt.cp == 0)
+			GET_UTF_8(w, pat[pl]);
+		else
+			pat[pl] = *w++;
+		/* the search data have no character this wide */
+		if (cw < 4 && pat[pl] >= 1U << (cw * 8))
+			goto ret;
+	}
+	if (!pl || pl > f->nsearch_chr)
+		goto ret;
+	for (i = 0; i < 256; i++)
+		shift[i] = pl;
+	for (i = 0; i < pl - 1; i++)
+		shift[pat[i] & 0xff] = pl - 1 - i;
+	for (i = 0; i <= f->nsearch_chr - pl;
+	     i += shift[search_chr_at(h, cw, i + pl - 1) & 0xff]) {
+		for (j = pl - 1; j >= 0; j--)
+			if (search_chr_at(h, cw, i + j) != pat[j])
+				break;
+		if (j < 0)
+			add_search_match(ml, i, pl);
+	}
+ret:
+	free(pat);
+}
 
-	if (*s1 > *s2)
-		*s1 = *s2 = -1;
-	if (*s1 < 0 || *s2 < 0)
-		return -1;
+/* Line ends are the only spaces that stand for no character on the screen.
+ * The returned bitmap has a bit set for each of them. */
+static unsigned char *
+search_line_ends(struct f_data *f)
+{
+	unsigned char *eol = mem_calloc(f->nsearch_chr / 8 + 1);
+	int i;
+	for (i = 0; i < f->nsearch_pos; i++) {
+		int idx = f->search_pos[i].idx;
+		if (!f->search_pos[i].n && idx < f->nsearch_chr)
+			eol[idx >> 3] |= 1 << (idx & 7);
+	}
+	return eol;
+}
 
+/* Find all matches of the session's search word or regular expression in
+ * the search data of f in one pass and keep them sorted by line. The result
+ * is cached in f until something else is searched for or more of the
+ * document is indexed. If all is not set, only the part indexed so far is
+ * searched. Returns -2 if the regular expression is invalid. */
+static int
+get_search_matches(struct session *ses, struct f_data *f, int all)
+{
+	struct search_match_list ml;
+	struct regexp *re = NULL;
+	unsigned char *w = ses->search_word;
+	if (get_search_data(f, all) < 0)
+		return -1;
+	if (f->search_word && f->search_regexp == ses->search_regexp
+	    && f->search_match_chr == f->nsearch_chr
+	    && !strcmp(cast_const_char f->search_word, cast_const_char w))
+		return 0;
+	if (ses->search_regexp
+	    && !(re = regexp_get(&ses->search_regexps, w, f->opt.cp)))
+		return -2;
+	free(f->search_word);
+	free(f->search_match);
+	f->search_word = stracpy(w);
+	f->search_regexp = ses->search_regexp;
+	f->search_match_chr = f->nsearch_chr;
+	f->search_match = NULL;
+	f->nsearch_match = 0;
+	f->search_match_span = 0;
+	ml.f = f;
+	ml.size = 0;
+	if (re) {
+		unsigned char *eol = search_line_ends(f);
+		regexp_matches(re, f->search_chr, f->search_chr_width,
+		               f->nsearch_chr, eol, add_search_match, &ml);
+		free(eol);
+	} else
+		find_search_word(f, w, &ml);
+	if (f->nsearch_match)
+		qsort(f->search_match, f->nsearch_match,
+		      sizeof(struct search_match), comp_search_match);
 	return 0;
 }
 
+/* index of the first match that starts at line y or below */
 static int
-is_in_range(struct f_data *f, int y, int yw, unsigned char *txt, int *min,
-            int *max)
+first_search_match(struct f_data *f, int y)
 {
-	int utf8 = f->opt.cp == 0;
-	int found = 0;
-	int l;
-	int s1, s2;
-	*min = INT_MAX;
-	*max = 0;
-
-	l = strlen((char *)txt);
-
-	if (get_range(f, y, yw, l, &s1, &s2))
-		return 0;
-	for (; s1 <= s2; s1++) {
-		int i;
-		if (!utf8) {
-			if (f->search_chr[s1] != txt[0])
-				continue;
-			for (i = 1; i < l; i++)
-				if (f->search_chr[s1 + i] != txt[i])
-					goto cont;
-		} else {
-			unsigned char *tt = txt;
-			for (i = 0; i < l; i++) {
-				unsigned cc;
-				GET_UTF_8(tt, cc);
-				if (f->search_chr[s1 + i] != cc)
-					goto cont;
-			}
-		}
-		for (i = 0; i < l; i++) {
-			struct search *sr = search_lookup(f, s1 + i);
-			if (sr->y >= y && sr->y < y + yw && sr->n)
-				goto in_view;
-		}
-		continue;
-in_view:
-		found = 1;
-		for (i = 0; i < l; i++) {
-			struct search *sr = search_lookup(f, s1 + i);
-			if (sr->n) {
-				if (sr->x < *min)
-					*min = sr->x;
-				if (sr->x + sr->n > *max)
-					*max = sr->x + sr->n;
-			}
-		}
-cont:;
+	int s = 0, e = f->nsearch_match;
+	while (s < e) {
+		int m = (int)(((unsigned)s + (unsigned)e) / 2);
+		if (f->search_match[m].y < y)
+			s = m + 1;
+		else
+			e = m;
 	}
-	return found;
+	return s;
 }
 
 static int
@@ -596,60 +779,41 @@ get_searched(struct f_data_c *scr, struct point **pt, int *pl)
 	int yw = scr->yw;
 	int vx = scr->vs->view_posx;
 	int vy = scr->vs->view_pos;
-	int s1, s2;
-	int l;
-	unsigned c;
+	int m;
 	struct point *points = NULL;
 	int len = 0;
-	unsigned char *ww;
 	unsigned char *w = scr->ses->search_word;
 	if (!w || !*w)
 		return -1;
-	if (get_search_data(f) < 0) {
+	if (get_search_matches(scr->ses, f, 0) < 0) {
 		free(scr->ses->search_word);
 		scr->ses->search_word = NULL;
 		return -1;
 	}
-	l = strlen((char *)w);
-	ww = w;
-	GET_UTF_8(ww, c);
-	if (get_range(f, scr->vs->view_pos, scr->yw, l, &s1, &s2))
-		goto ret;
-	for (; s1 <= s2; s1++) {
+	for (m = first_search_match(f, vy - f->search_match_span);
+	     m < f->nsearch_match && f->search_match[m].y < vy + yw; m++) {
 		int i, j;
-		if (f->search_chr[s1] != c) {
-c:
+		if (f->search_match[m].ye < vy)
 			continue;
-		}
-		ww = w;
-		for (i = 0; i < l; i++) {
-			unsigned cc;
-			GET_UTF_8(ww, cc);
-			if (f->search_chr[s1 + i] != cc)
-				goto c;
-		}
-		for (i = 0; i < l; i++) {
-			struct search *sr = search_lookup(f, s1 + i);
+		for (i = 0; i < f->search_match[m].len; i++) {
+			struct search *sr =
+			    search_lookup(f, f->search_match[m].idx + i);
 			for (j = 0; j < sr->n; j++) {
 				int x = sr->x + j + xp - vx;
 				int y = sr->y + yp - vy;
 				if (x >= xp && y >= yp && x < xp + xw
 				    && y < yp + yw) {
 					if (!(len & (ALLOC_GR - 1))) {
-						struct point *points2;
 						if ((unsigned)len
 						    > INT_MAX
 						              / sizeof(
 								  struct point)
 						          - ALLOC_GR)
 							goto ret;
-						points2 = xrealloc(
+						points = xrealloc(
 						    points,
 						    sizeof(struct point)
 							* (len + ALLOC_GR));
-						if (!points2)
-							goto ret;
-						points = points2;
 					}
 					points[len].x = sr->x + j;
 					points[len++].y = sr->y;
@@ -692,32 +856,6 @@ draw_current_link(struct terminal *t, struct f_data_c *scr)
 	draw_searched(t, scr);
 }
 
-static struct link *
-get_first_link(struct f_data_c *f)
-{
-	int i;
-	struct link *l = f->f_data->links + f->f_data->nlinks;
-	for (i = f->vs->view_pos; i < f->vs->view_pos + f->yw; i++)
-		if (i >= 0 && i < f->f_data->y && f->f_data->lines1[i]
-		    && f->f_data->lines1[i] < l)
-			l = f->f_data->lines1[i];
-	if (l == f->f_data->links + f->f_data->nlinks)
-		l = NULL;
-	return l;
-}
-
-static struct link *
-get_last_link(struct f_data_c *f)
-{
-	int i;
-	struct link *l = NULL;
-	for (i = f->vs->view_pos; i < f->vs->view_pos + f->yw; i++)
-		if (i >= 0 && i < f->f_data->y && f->f_data->lines2[i]
-		    && (!l || f->f_data->lines2[i] > l))
-			l = f->f_data->lines2[i];
-	return l;
-}
-
 void
 fixup_select_state(struct form_control *fc, struct form_state *fs)
 {
@@ -987,18 +1125,13 @@ x_draw_form_entry(struct session *ses, struct f_data_c *f, struct link *l)
 static void
 draw_forms(struct terminal *t, struct f_data_c *f)
 {
-	struct link *l1 = get_first_link(f);
-	struct link *l2 = get_last_link(f);
-	if (!l1 || !l2) {
-		if (l1 || l2)
-			internal("get_first_link == %p, get_last_link == %p",
-			         (void *)l1, (void *)l2);
-		return;
-	}
-	do {
-		if (l1->type != L_LINK)
-			draw_form_entry(t, f, l1);
-	} while (l1++ < l2);
+	int *links;
+	int n, i;
+	n = get_links_in_view(f, 0, &links);
+	for (i = 0; i < n; i++)
+		if (f->f_data->links[links[i]].type != L_LINK)
+			draw_form_entry(t, f, &f->f_data->links[links[i]]);
+	free(links);
 }
 
 /* 0 -> 1 <- 2 v 3 ^ */
@@ -1081,6 +1214,7 @@ draw_doc(struct terminal *t, void *scr_)
 	int yw = scr->yw;
 	struct view_state *vs;
 	int vx, vy;
+	arm_prefetch(ses);
 	if (!scr->vs || !scr->f_data) {
 		if (active) {
 			if (!scr->parent)
@@ -1099,6 +1233,15 @@ draw_doc(struct terminal *t, void *scr_)
 		           yp + yw - 1);
 		set_window_ptr(ses->win, xp, yp);
 	}
+	vs = scr->vs;
+	if (scr->goto_position || vs->orig_link >= scr->f_data->nlinks)
+		format_lines(scr->f_data, INT_MAX);
+	else
+		format_lines(scr->f_data,
+		             safe_add(vs->view_pos > vs->orig_view_pos
+		                          ? vs->view_pos
+		                          : vs->orig_view_pos,
+		                      yw * 2));
 	check_vs(scr);
 	if (scr->f_data->frame_desc) {
 		struct f_data_c *f = NULL;
@@ -1227,8 +1370,10 @@ draw_fd(struct f_data_c *f)
 	draw_to_window(f->ses->win, draw_doc_c, f);
 	change_screen_status(f->ses);
 	print_screen_status(f->ses);
-	if (f->f_data)
+	if (f->f_data) {
 		f->f_data->time_to_draw += get_time();
+		perf_add(PERF_DRAW, f->f_data->time_to_draw);
+	}
 }
 
 static void
@@ -1249,6 +1394,7 @@ dump_to_file(struct f_data *fd, int h)
 	unsigned char *buf;
 	int bptr = 0;
 	int retval;
+	format_lines(fd, INT_MAX);
 	buf = xmalloc(D_BUF);
 	for (y = 0; y < fd->y; y++)
 		for (x = 0; x <= fd->data[y].l; x++) {
@@ -1294,33 +1440,30 @@ dump_to_file(struct f_data *fd, int h)
 		for (i = 0; i < fd->nlinks; i++) {
 			struct form_control *fc;
 			struct link *lnk = &fd->links[i];
-			unsigned char *s = NULL;
-			size_t l;
-			l = add_num_to_str(&s, 0, i + 1);
-			l = add_to_str(&s, l, cast_uchar ". ");
+			unsigned char stack[256];
+			struct string_buf s;
+			init_buf(&s, stack, sizeof stack);
+			add_num_to_buf(&s, i + 1);
+			add_to_buf(&s, cast_uchar ". ");
 			if (lnk->where) {
-				l = add_to_str(&s, l, lnk->where);
+				add_to_buf(&s, lnk->where);
 			} else if (lnk->where_img) {
-				l = add_to_str(&s, l, cast_uchar "Image: ");
-				l = add_to_str(&s, l, lnk->where_img);
+				add_to_buf(&s, cast_uchar "Image: ");
+				add_to_buf(&s, lnk->where_img);
 			} else if (lnk->type == L_BUTTON) {
 				fc = lnk->form;
 				if (fc->type == FC_RESET)
-					l = add_to_str(&s, l,
-					               cast_uchar "Reset form");
+					add_to_buf(&s, cast_uchar "Reset form");
 				else if (fc->type == FC_BUTTON || !fc->action)
-					l = add_to_str(&s, l,
-					               cast_uchar "Button");
+					add_to_buf(&s, cast_uchar "Button");
 				else {
 					if (fc->method == FM_GET)
-						l = add_to_str(&s, l,
-						               cast_uchar
-						               "Submit form: ");
+						add_to_buf(&s, cast_uchar
+						           "Submit form: ");
 					else
-						l = add_to_str(&s, l,
-						               cast_uchar
-						               "Post form: ");
-					l = add_to_str(&s, l, fc->action);
+						add_to_buf(&s, cast_uchar
+						           "Post form: ");
+					add_to_buf(&s, fc->action);
 				}
 			} else if (lnk->type == L_CHECKBOX
 			           || lnk->type == L_SELECT
@@ -1329,58 +1472,53 @@ dump_to_file(struct f_data *fd, int h)
 				fc = lnk->form;
 				switch (fc->type) {
 				case FC_RADIO:
-					l = add_to_str(
-					    &s, l, cast_uchar "Radio button");
+					add_to_buf(&s,
+					           cast_uchar "Radio button");
 					break;
 				case FC_CHECKBOX:
-					l = add_to_str(&s, l,
-					               cast_uchar "Checkbox");
+					add_to_buf(&s, cast_uchar "Checkbox");
 					break;
 				case FC_SELECT:
-					l = add_to_str(
-					    &s, l, cast_uchar "Select field");
+					add_to_buf(&s,
+					           cast_uchar "Select field");
 					break;
 				case FC_TEXT:
-					l = add_to_str(&s, l,
-					               cast_uchar "Text field");
+					add_to_buf(&s,
+					           cast_uchar "Text field");
 					break;
 				case FC_TEXTAREA:
-					l = add_to_str(&s, l,
-					               cast_uchar "Text area");
+					add_to_buf(&s, cast_uchar "Text area");
 					break;
 				case FC_FILE_UPLOAD:
-					l = add_to_str(
-					    &s, l, cast_uchar "File upload");
+					add_to_buf(&s,
+					           cast_uchar "File upload");
 					break;
 				case FC_PASSWORD:
-					l = add_to_str(
-					    &s, l, cast_uchar "Password field");
+					add_to_buf(&s,
+					           cast_uchar "Password field");
 					break;
 				default:
 					goto unknown;
 				}
 				if (fc->name && fc->name[0]) {
-					l = add_to_str(&s, l,
-					               cast_uchar ", Name ");
-					l = add_to_str(&s, l, fc->name);
+					add_to_buf(&s, cast_uchar ", Name ");
+					add_to_buf(&s, fc->name);
 				}
 				if ((fc->type == FC_CHECKBOX
 				     || fc->type == FC_RADIO)
 				    && fc->default_value
 				    && fc->default_value[0]) {
-					l = add_to_str(&s, l,
-					               cast_uchar ", Value ");
-					l = add_to_str(&s, l,
-					               fc->default_value);
+					add_to_buf(&s, cast_uchar ", Value ");
+					add_to_buf(&s, fc->default_value);
 				}
 			}
 unknown:
-			l = add_chr_to_str(&s, l, '\n');
-			if ((retval = hard_write(h, s, l)) != l) {
-				free(s);
+			add_chr_to_buf(&s, '\n');
+			if ((retval = hard_write(h, s.s, s.l)) != (int)s.l) {
+				free_buf(&s);
 				goto fail;
 			}
-			free(s);
+			free_buf(&s);
 		}
 	}
 	return 0;
@@ -1434,30 +1572,27 @@ next_in_view(struct f_data_c *f, int p, int d,
              int (*fn)(struct f_data_c *, struct link *),
              void (*cntr)(struct f_data_c *, struct link *))
 {
-	int p1 = f->f_data->nlinks - 1;
-	int p2 = 0;
-	int y;
-	int yl = f->vs->view_pos + f->yw;
-	if (yl > f->f_data->y)
-		yl = f->f_data->y;
-	for (y = f->vs->view_pos < 0 ? 0 : f->vs->view_pos; y < yl; y++) {
-		if (f->f_data->lines1[y]
-		    && f->f_data->lines1[y] - f->f_data->links < p1)
-			p1 = (int)(f->f_data->lines1[y] - f->f_data->links);
-		if (f->f_data->lines2[y]
-		    && f->f_data->lines2[y] - f->f_data->links > p2)
-			p2 = (int)(f->f_data->lines2[y] - f->f_data->links);
-	}
-	while (p >= p1 && p <= p2) {
-		if (fn(f, &f->f_data->links[p])) {
-			f->vs->current_link = p;
+	int *links;
+	int n, i;
+	n = get_links_in_view(f, 1, &links);
+	if (d > 0) {
+		for (i = 0; i < n && links[i] < p; i++)
+			;
+	} else {
+		for (i = n - 1; i >= 0 && links[i] > p; i--)
+			;
+	}
+	for (; i >= 0 && i < n; i += d) {
+		if (fn(f, &f->f_data->links[links[i]])) {
+			f->vs->current_link = links[i];
 			f->vs->orig_link = f->vs->current_link;
 			if (cntr)
-				cntr(f, &f->f_data->links[p]);
+				cntr(f, &f->f_data->links[links[i]]);
+			free(links);
 			return 1;
 		}
-		p += d;
 	}
+	free(links);
 	f->vs->current_link = -1;
 	f->vs->orig_link = f->vs->current_link;
 	return 0;
@@ -1639,6 +1774,7 @@ home(struct session *ses, struct f_data_c *f, int a)
 static void
 x_end(struct session *ses, struct f_data_c *f, int a)
 {
+	format_lines(f->f_data, INT_MAX);
 	f->vs->view_posx = 0;
 	if (f->vs->view_pos < f->f_data->y - f->yw)
 		f->vs->view_pos = f->f_data->y - f->yw;
@@ -1877,9 +2013,43 @@ encode_controls(struct list_head *l, unsigned char **data)
 #define BL  56
 #define BL1 27
 
+/* A regular file to be sent from disk at offset pos of the encoded data */
+struct post_file {
+	size_t pos;
+	unsigned char *name;
+	off_t size;
+	time_t mtime;
+};
+
+static void
+free_post_files(struct post_file *files, int nfiles)
+{
+	int i;
+	for (i = 0; i < nfiles; i++)
+		free(files[i].name);
+	free(files);
+}
+
+static size_t
+add_post_file(unsigned char **s, size_t l, struct post_file *pf)
+{
+	unsigned char *p;
+	l = add_chr_to_str(s, l, POST_FILE_START);
+	for (p = pf->name; *p; p++) {
+		unsigned char h[3];
+		sprintf(cast_char h, "%02x", (int)*p);
+		l = add_to_str(s, l, h);
+	}
+	l = add_chr_to_str(s, l, ':');
+	l = add_num_to_str(s, l, pf->size);
+	l = add_chr_to_str(s, l, ':');
+	l = add_num_to_str(s, l, pf->mtime);
+	return add_chr_to_str(s, l, POST_FILE_END);
+}
+
 static size_t
 encode_multipart(struct session *ses, struct list_head *l, unsigned char **data,
-                 unsigned char *bound)
+                 unsigned char *bound, struct post_file **files, int *nfiles)
 {
 	int errn;
 	int *bound_ptrs = NULL;
@@ -1946,6 +2116,7 @@ bnd:
 			free(p);
 		} else {
 			int fh, rd;
+			struct stat st;
 #define F_BUFLEN 1024
 			unsigned char buffer[F_BUFLEN];
 			if (*sv->value) {
@@ -1964,10 +2135,39 @@ bnd:
 					}
 					goto error;
 				}
+				if (!fstat(fh, &st) && S_ISREG(st.st_mode)
+				    && st.st_size > 0) {
+					struct post_file *pf;
+					unsigned char *dir;
+					size_t nl = 0;
+					if (!(*nfiles & (ALLOC_GR - 1)))
+						*files = xreallocarray(
+						    *files, *nfiles + ALLOC_GR,
+						    sizeof(struct post_file));
+					pf = &(*files)[(*nfiles)++];
+					pf->pos = len;
+					pf->name = NULL;
+					if (sv->value[0] != '/'
+					    && (dir = get_cwd())) {
+						nl = add_to_str(&pf->name, nl,
+						                dir);
+						nl = add_chr_to_str(&pf->name,
+						                    nl, '/');
+						free(dir);
+					}
+					add_to_str(&pf->name, nl, sv->value);
+					allow_post_file(pf->name);
+					pf->size = st.st_size;
+					pf->mtime = st.st_mtime;
+					EINTRLOOP(rs, close(fh));
+					fh = -1;
+				}
 				if (wd) {
 					set_cwd(wd);
 					free(wd);
 				}
+				if (fh == -1)
+					goto next_value;
 				do {
 					if ((rd = hard_read(fh, buffer,
 					                    F_BUFLEN))
@@ -1983,6 +2183,7 @@ bnd:
 				EINTRLOOP(rs, close(fh));
 			}
 		}
+next_value:
 		len = add_to_str(data, len, cast_uchar "\r\n");
 	}
 	if (!flg) {
@@ -1992,6 +2193,11 @@ bnd:
 	len = add_to_str(data, len, cast_uchar "--\r\n");
 	memset(bound, '-', BL1);
 	memset(bound + BL1, '0', BL - BL1);
+	/* The contents of the files are not known here, so their boundary
+	 * is random to make a collision with them unlikely. */
+	if (*nfiles)
+		for (i = BL1; i < BL; i++)
+			bound[i] = '0' + arc4random_uniform(10);
 again:
 	for (i = 0; i <= len - BL; i++) {
 		for (j = 0; j < BL; j++)
@@ -2017,6 +2223,9 @@ error:
 	free(bound_ptrs);
 	free(*data);
 	*data = NULL;
+	free_post_files(*files, *nfiles);
+	*files = NULL;
+	*nfiles = 0;
 	m1 = stracpy(sv->value);
 	m2 = stracpy(cast_uchar strerror(errn));
 	msg_box(ses->term, getml(m1, m2, NULL),
@@ -2030,6 +2239,9 @@ not_allowed:
 	free(bound_ptrs);
 	free(*data);
 	*data = NULL;
+	free_post_files(*files, *nfiles);
+	*files = NULL;
+	*nfiles = 0;
 	msg_box(ses->term, NULL, TEXT_(T_ERROR_WHILE_POSTING_FORM), AL_CENTER,
 	        TEXT_(T_READING_FILES_IS_NOT_ALLOWED), MSG_BOX_END, (void *)ses,
 	        1, TEXT_(T_CANCEL), msg_box_null, B_ENTER | B_ESC);
@@ -2057,6 +2269,8 @@ get_form_url(struct session *ses, struct f_data_c *f, struct form_control *form,
 	unsigned char *data;
 	unsigned char bound[BL];
 	int len;
+	struct post_file *files = NULL;
+	int nfiles = 0;
 	unsigned char *go = NULL;
 	if (!form)
 		return NULL;
@@ -2072,7 +2286,8 @@ get_form_url(struct session *ses, struct f_data_c *f, struct form_control *form,
 	if (form->method == FM_GET || form->method == FM_POST)
 		len = encode_controls(&submit, &data);
 	else
-		len = encode_multipart(ses, &submit, &data, bound);
+		len = encode_multipart(ses, &submit, &data, bound, &files,
+		                       &nfiles);
 	if (!data)
 		goto ff;
 	if (!casecmp(form->action, cast_uchar "javascript:", 11)) {
@@ -2100,7 +2315,7 @@ get_form_url(struct session *ses, struct f_data_c *f, struct form_control *form,
 		}
 	} else {
 		size_t l;
-		int i;
+		int i, f = 0;
 		go = NULL;
 		l = add_to_str(&go, 0, form->action);
 		l = add_chr_to_str(&go, l, POST_CHAR);
@@ -2115,14 +2330,19 @@ get_form_url(struct session *ses, struct f_data_c *f, struct form_control *form,
 			l = add_bytes_to_str(&go, l, bound, BL);
 			l = add_chr_to_str(&go, l, '\n');
 		}
-		for (i = 0; i < len; i++) {
+		for (i = 0; i <= len; i++) {
 			unsigned char p[3];
+			while (f < nfiles && files[f].pos == (size_t)i)
+				l = add_post_file(&go, l, &files[f++]);
+			if (i == len)
+				break;
 			sprintf(cast_char p, "%02x", (int)data[i]);
 			l = add_to_str(&go, l, p);
 		}
 	}
 x:
 	free(data);
+	free_post_files(files, nfiles);
 ff:
 	free_succesful_controls(&submit);
 	return go;
@@ -2221,6 +2441,118 @@ get_current_link(struct f_data_c *f)
 	return NULL;
 }
 
+static int
+can_prefetch(unsigned char *url)
+{
+	return (!casecmp(url, cast_uchar "http://", 7)
+	        || !casecmp(url, cast_uchar "https://", 8))
+	       && !get_proxy_string(url);
+}
+
+/* Whether the text of the link contains one of the comma separated words
+ * of prefetch_pattern, ignoring the case of ASCII letters */
+static int
+link_matches_pattern(struct f_data *fd, struct link *l)
+{
+	unsigned char text[MAX_STR_LEN];
+	unsigned char *p;
+	int i, tl = 0;
+	for (i = 0; i < l->n && tl < (int)sizeof(text) - 1; i++) {
+		struct point *pt = &l->pos[i];
+		char_t ch;
+		if (pt->y < 0 || pt->y >= fd->y || pt->x < 0
+		    || pt->x >= fd->data[pt->y].l)
+			continue;
+		ch = fd->data[pt->y].d[pt->x].ch;
+		text[tl++] = ch >= 32 && ch < 127 ? (unsigned char)ch : '?';
+	}
+	text[tl] = 0;
+	p = prefetch_pattern;
+	while (*p) {
+		unsigned char word[MAX_STR_LEN];
+		size_t wl;
+		while (*p == ' ' || *p == ',')
+			p++;
+		wl = strcspn(cast_const_char p, ",");
+		memcpy(word, p, wl);
+		p += wl;
+		while (wl && word[wl - 1] == ' ')
+			wl--;
+		word[wl] = 0;
+		if (wl && casestrstr(text, word))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * When the screen has not changed for PREFETCH_DELAY and the document is
+ * loaded, start loading the pages it hints at and, with prefetch_pages,
+ * the links on the screen that match prefetch_pattern; see prefetch_url.
+ * With prefetch, look up the hosts of the links on the screen and, when it
+ * is 2, preconnect to the site of the current link and to the site of the
+ * document if it has links on the screen. The number of lookups and
+ * connections in flight is limited in dns_prefetch and preconnect_url.
+ */
+static void
+prefetch_links(void *ses_)
+{
+	struct session *ses = (struct session *)ses_;
+	struct f_data_c *f;
+	struct link *l;
+	unsigned char *host, *base = NULL;
+	int *links;
+	int n, i, lookups, same_origin = 0;
+	ses->prefetch_timer = NULL;
+	f = current_frame(ses);
+	if (ses->rq || !f || !f->f_data || !f->vs || !f->rq
+	    || f->rq->state >= 0)
+		return;
+	for (i = 0; i < f->f_data->nprefetch; i++)
+		prefetch_url(f->f_data->prefetch[i], f->rq->url);
+	lookups = prefetch && !proxies.only_proxies && !*proxies.socks_proxy;
+	if (!lookups && !(prefetch_pages && *prefetch_pattern))
+		return;
+	if (can_prefetch(f->rq->url))
+		base = get_keepalive_id(f->rq->url);
+	n = get_links_in_view(f, 0, &links);
+	for (i = 0; i < n; i++) {
+		l = &f->f_data->links[links[i]];
+		if (l->type != L_LINK || !l->where)
+			continue;
+		if (prefetch_pages && *prefetch_pattern
+		    && link_matches_pattern(f->f_data, l))
+			prefetch_url(l->where, f->rq->url);
+		if (!lookups || !can_prefetch(l->where))
+			continue;
+		if (base && url_keepalive_eq(get_parsed_url(l->where), base)) {
+			same_origin = 1;
+			continue;
+		}
+		host = get_host_name(l->where);
+		if (dns_prefetch((char *)host) < 0)
+			lookups = 0;
+		free(host);
+	}
+	free(links);
+	if (prefetch > 1 && !proxies.only_proxies && !*proxies.socks_proxy) {
+		if ((l = get_current_link(f)) && l->type == L_LINK && l->where
+		    && can_prefetch(l->where))
+			preconnect_url(l->where);
+		if (same_origin)
+			preconnect_url(f->rq->url);
+	}
+	free(base);
+}
+
+static void
+arm_prefetch(struct session *ses)
+{
+	if (ses->prefetch_timer)
+		kill_timer(ses->prefetch_timer);
+	ses->prefetch_timer = install_timer(PREFETCH_DELAY, prefetch_links, ses);
+}
+
 /* pokud je a==1, tak se nebude submitovat formular, kdyz kliknu na input field
  * a formular nema submit */
 int
@@ -2929,38 +3261,48 @@ set_textarea(struct session *ses, struct f_data_c *f, int dir)
 	}
 }
 
-void
-search_for_back(void *ses_, unsigned char *str)
+static void
+start_search(struct session *ses, unsigned char *str, int direction,
+             int regexp)
 {
-	struct session *ses = (struct session *)ses_;
 	struct f_data_c *f = current_frame(ses);
 	if (!f || !str || !str[0])
 		return;
 	free(ses->search_word);
 	ses->search_word = stracpy(str);
-	clr_spaces(ses->search_word, 0);
-	charset_upcase_string(&ses->search_word, 0);
+	if (!regexp) {
+		clr_spaces(ses->search_word, 0);
+		charset_upcase_string(&ses->search_word, 0);
+	}
 	free(ses->last_search_word);
 	ses->last_search_word = stracpy(ses->search_word);
-	ses->search_direction = -1;
+	ses->search_direction = direction;
+	ses->search_regexp = regexp;
 	find_next(ses, f, 1);
 }
 
+void
+search_for_back(void *ses_, unsigned char *str)
+{
+	start_search((struct session *)ses_, str, -1, 0);
+}
+
 void
 search_for(void *ses_, unsigned char *str)
 {
-	struct session *ses = (struct session *)ses_;
-	struct f_data_c *f = current_frame(ses);
-	if (!f || !f->vs || !f->f_data || !str || !str[0])
-		return;
-	free(ses->search_word);
-	ses->search_word = stracpy(str);
-	clr_spaces(ses->search_word, 0);
-	charset_upcase_string(&ses->search_word, 0);
-	free(ses->last_search_word);
-	ses->last_search_word = stracpy(ses->search_word);
-	ses->search_direction = 1;
-	find_next(ses, f, 1);
+	start_search((struct session *)ses_, str, 1, 0);
+}
+
+void
+search_for_back_regexp(void *ses_, unsigned char *str)
+{
+	start_search((struct session *)ses_, str, -1, 1);
+}
+
+void
+search_for_regexp(void *ses_, unsigned char *str)
+{
+	start_search((struct session *)ses_, str, 1, 1);
 }
 
 #define HASH_SIZE 4096
@@ -3026,15 +3368,16 @@ nx:
 void
 find_next(struct session *ses, struct f_data_c *f, int a)
 {
+	struct f_data *fd;
 	int min, max;
-	int c = 0;
-	int p;
+	int p, err, all;
 	if (!f->f_data || !f->vs) {
 		msg_box(ses->term, NULL, TEXT_(T_SEARCH), AL_CENTER,
 		        TEXT_(T_YOU_ARE_NOWHERE), MSG_BOX_END, NULL, 1,
 		        TEXT_(T_CANCEL), msg_box_null, B_ENTER | B_ESC);
 		return;
 	}
+	fd = f->f_data;
 	p = f->vs->view_pos;
 	if (!a && ses->search_word) {
 		if (!(find_next_link_in_search(f, ses->search_direction)))
@@ -3052,39 +3395,92 @@ find_next(struct session *ses, struct f_data_c *f, int a)
 		ses->search_word = stracpy(ses->last_search_word);
 	}
 	print_progress(ses, TEXT_(T_SEARCHING));
-	if (get_search_data(f->f_data) < 0) {
+	all = 0;
+again:
+	if ((err = get_search_matches(ses, fd, all)) < 0) {
 		free(ses->search_word);
 		ses->search_word = NULL;
 		msg_box(ses->term, NULL, TEXT_(T_SEARCH), AL_CENTER,
-		        TEXT_(T_OUT_OF_MEMORY), MSG_BOX_END, NULL, 1,
-		        TEXT_(T_CANCEL), msg_box_null, B_ENTER | B_ESC);
+		        err == -2 ? TEXT_(T_BAD_REGEXP) : TEXT_(T_OUT_OF_MEMORY),
+		        MSG_BOX_END, NULL, 1, TEXT_(T_CANCEL), msg_box_null,
+		        B_ENTER | B_ESC);
 		return;
 	}
-	do {
-		if (is_in_range(f->f_data, p, f->yw, ses->search_word, &min,
-		                &max)) {
-			f->vs->view_pos = p;
-			if (max >= min) {
-				if (max > f->vs->view_posx + f->xw)
-					f->vs->view_posx = max - f->xw;
-				if (min < f->vs->view_posx)
-					f->vs->view_posx = min;
+	/* The document may be indexed or formatted only partially; the match
+	 * found is good if it is in the part indexed completely, otherwise
+	 * index what is formatted, then format and index the rest, and search
+	 * again. */
+	if (!fd->nsearch_match && fd->search_index) {
+		all++;
+		goto again;
+	}
+	if (fd->nsearch_match) {
+		int yw = f->yw ? f->yw : 1;
+		int m = first_search_match(fd, p - fd->search_match_span);
+		int lines = get_search_data_lines(fd);
+		if (ses->search_direction > 0) {
+			for (; m < fd->nsearch_match; m++)
+				if (fd->search_match[m].ye >= p)
+					break;
+			if (fd->search_index
+			    && (m == fd->nsearch_match
+			        || fd->search_match[m].ye >= lines)) {
+				all++;
+				goto again;
 			}
-			f->vs->orig_view_pos = f->vs->view_pos;
-			f->vs->orig_view_posx = f->vs->view_posx;
-			set_link(f);
-			find_next_link_in_search(f, ses->search_direction * 2);
-			return;
+			if (m == fd->nsearch_match)
+				p = m = 0;
+			if (fd->search_match[m].y > p)
+				p += (fd->search_match[m].y - p) / yw * yw;
+		} else {
+			m = first_search_match(fd, p + yw) - 1;
+			if (fd->search_index && (m < 0 || p + yw > lines)) {
+				all++;
+				goto again;
+			}
+			if (m < 0) {
+				p = 0;
+				while (p < fd->y)
+					p += yw;
+				p -= yw;
+				m = fd->nsearch_match - 1;
+			}
+			if (fd->search_match[m].ye < p)
+				p -= (p - fd->search_match[m].y + yw - 1) / yw
+				     * yw;
 		}
-		if ((p += ses->search_direction * f->yw) > f->f_data->y)
-			p = 0;
-		if (p < 0) {
-			p = 0;
-			while (p < f->f_data->y)
-				p += f->yw ? f->yw : 1;
-			p -= f->yw;
+		min = INT_MAX;
+		max = 0;
+		for (m = first_search_match(fd, p - fd->search_match_span);
+		     m < fd->nsearch_match && fd->search_match[m].y < p + yw;
+		     m++) {
+			int i;
+			if (fd->search_match[m].ye < p)
+				continue;
+			for (i = 0; i < fd->search_match[m].len; i++) {
+				struct search *sr = search_lookup(
+				    fd, fd->search_match[m].idx + i);
+				if (sr->n) {
+					if (sr->x < min)
+						min = sr->x;
+					if (sr->x + sr->n > max)
+						max = sr->x + sr->n;
+				}
+			}
 		}
-	} while ((c += f->yw ? f->yw : 1) < f->f_data->y + f->yw);
+		f->vs->view_pos = p;
+		if (max >= min) {
+			if (max > f->vs->view_posx + f->xw)
+				f->vs->view_posx = max - f->xw;
+			if (min < f->vs->view_posx)
+				f->vs->view_posx = min;
+		}
+		f->vs->orig_view_pos = f->vs->view_pos;
+		f->vs->orig_view_posx = f->vs->view_posx;
+		set_link(f);
+		find_next_link_in_search(f, ses->search_direction * 2);
+		return;
+	}
 	msg_box(ses->term, NULL, TEXT_(T_SEARCH), AL_CENTER,
 	        TEXT_(T_SEARCH_STRING_NOT_FOUND), MSG_BOX_END, NULL, 1,
 	        TEXT_(T_CANCEL), msg_box_null, B_ENTER | B_ESC);
@@ -3103,8 +3499,10 @@ rep_ev(struct session *ses, struct f_data_c *fd,
        void (*f)(struct session *, struct f_data_c *, int), int a)
 {
 	int i = ses->kbdprefix.rep ? ses->kbdprefix.rep_num : 1;
-	while (i--)
+	while (i--) {
+		format_lines(fd->f_data, safe_add(fd->vs->view_pos, fd->yw * 3));
 		f(ses, fd, a);
+	}
 }
 
 static struct link *
@@ -3278,6 +3676,7 @@ frame_ev(struct session *ses, struct f_data_c *fd, struct links_event *ev)
 			unsigned char d[2];
 			d[0] = (unsigned char)ev->x;
 			d[1] = 0;
+			format_lines(f_data, INT_MAX);
 			nl = f_data->nlinks;
 			lnl = 1;
 			while (nl) {
@@ -4566,6 +4965,37 @@ print_current_title(struct session *ses)
 	return print_current_titlex(current_frame(ses), ses->term->x);
 }
 
+unsigned char *
+print_current_search(struct session *ses)
+{
+	struct f_data_c *fd = current_frame(ses);
+	struct f_data *f;
+	unsigned char *m = NULL;
+	size_t l = 0;
+	int i;
+	if (!ses->search_word || !fd || !fd->vs || !(f = fd->f_data)
+	    || f->search_index || f->search_match_chr != f->nsearch_chr
+	    || !f->search_word || f->search_regexp != ses->search_regexp
+	    || strcmp(cast_const_char f->search_word,
+	              cast_const_char ses->search_word))
+		return NULL;
+	i = first_search_match(f, fd->vs->view_pos - f->search_match_span);
+	while (i < f->nsearch_match
+	       && f->search_match[i].ye < fd->vs->view_pos)
+		i++;
+	if (i == f->nsearch_match
+	    || f->search_match[i].y >= fd->vs->view_pos + fd->yw)
+		return NULL;
+	l = add_to_str(&m, l, get_text_translation(TEXT_(T_MATCH), ses->term));
+	l = add_chr_to_str(&m, l, ' ');
+	l = add_num_to_str(&m, l, i + 1);
+	l = add_chr_to_str(&m, l, ' ');
+	l = add_to_str(&m, l, get_text_translation(TEXT_(T_OF), ses->term));
+	l = add_chr_to_str(&m, l, ' ');
+	l = add_num_to_str(&m, l, f->nsearch_match);
+	return m;
+}
+
 void
 loc_msg(struct terminal *term, struct location *lo, struct f_data_c *frame)
 {